@@ -0,0 +1,153 @@
+#include "activity_history.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+constexpr uint64_t ActivityHistory::resolution_usec[];
+
+ActivityHistory::ActivityHistory()
+: mLevels{}
+, mStarted(false)
+, mWindowLevel(0)
+, mWindowLength(0)
+, mBusyRate(0)
+, mBusyPackets(0)
+, mWindowSum(0)
+, mWindowBuckets(0)
+, mBusyBuckets(0)
+{
+}
+
+void
+ActivityHistory::setWindow(int window_sec, double busy_rate) {
+    mWindowLength = 0;
+    mBusyRate = busy_rate;
+    if (window_sec > 0) {
+        const uint64_t window_usec = uint64_t(std::min(window_sec, max_window_sec)) * 1000000;
+        // The finest resolution holding the whole window
+        mWindowLevel = 0;
+        while (mWindowLevel + 1 < levels &&
+               window_usec > max_window_buckets * resolution_usec[mWindowLevel]) {
+            ++mWindowLevel;
+        }
+        const uint64_t resolution = resolution_usec[mWindowLevel];
+        mWindowLength = (window_usec + resolution - 1) / resolution;
+        const double busy_packets = ceil(busy_rate * double(resolution) / 1000000);
+        mBusyPackets = busy_packets > 0 ? uint64_t(busy_packets) : 0;
+    }
+    recomputeWindow();
+}
+
+void
+ActivityHistory::clear() {
+    mStarted = false;
+    recomputeWindow();
+}
+
+void
+ActivityHistory::add(uint64_t start_usec, uint64_t end_usec, uint64_t packets) {
+    if (end_usec <= start_usec) {
+        return;
+    }
+    if (!mStarted) {
+        for (size_t i = 0; i < levels; ++i) {
+            auto &level = mLevels[i];
+            level.current = level.first = start_usec / resolution_usec[i];
+            level.packets[level.current % buckets] = 0;
+        }
+        mStarted = true;
+    }
+
+    const uint64_t span = end_usec - start_usec;
+    for (size_t i = 0; i < levels; ++i) {
+        auto &level = mLevels[i];
+        const uint64_t resolution = resolution_usec[i];
+        const uint64_t last = (end_usec - 1) / resolution;
+        // Buckets older than the ring would be overwritten again at once
+        const uint64_t first = std::max(start_usec / resolution,
+                                        last >= 2 * buckets ? last - 2 * buckets : 0);
+        // Cumulative shares, so the buckets add up to packets exactly
+        uint64_t assigned = uint64_t((unsigned __int128)packets *
+            (std::max(first * resolution, start_usec) - start_usec) / span);
+        for (uint64_t b = first; b <= last; ++b) {
+            advance(i, b);
+            const uint64_t end = std::min(end_usec, (b + 1) * resolution);
+            const uint64_t share = uint64_t((unsigned __int128)packets * (end - start_usec) / span);
+            level.packets[b % buckets] += share - assigned;
+            assigned = share;
+        }
+    }
+}
+
+// Completes the buckets up to index, the ones skipped over stay empty.
+void
+ActivityHistory::advance(size_t i, uint64_t index) {
+    auto &level = mLevels[i];
+    if (index <= level.current) {
+        return;
+    }
+    // After two rings of empty buckets the ring and the window only hold
+    // empty buckets, more would not change them.
+    const uint64_t steps = std::min<uint64_t>(index - level.current, 2 * buckets);
+    for (uint64_t s = 0; s < steps; ++s) {
+        complete(i, level.current);
+        ++level.current;
+        level.packets[level.current % buckets] = 0;
+    }
+    level.current = index;
+}
+
+void
+ActivityHistory::complete(size_t i, uint64_t index) {
+    if (i != mWindowLevel || mWindowLength == 0) {
+        return;
+    }
+    const auto &level = mLevels[i];
+    const uint64_t packets = level.packets[index % buckets];
+    mWindowSum += packets;
+    mBusyBuckets += packets >= mBusyPackets;
+    ++mWindowBuckets;
+    // The window holds the buckets (index - length, index]
+    if (index >= level.first + mWindowLength) {
+        const uint64_t old = level.packets[(index - mWindowLength) % buckets];
+        mWindowSum -= old;
+        mBusyBuckets -= old >= mBusyPackets;
+        --mWindowBuckets;
+    }
+}
+
+void
+ActivityHistory::recomputeWindow() {
+    mWindowSum = 0;
+    mWindowBuckets = 0;
+    mBusyBuckets = 0;
+    if (!mStarted || mWindowLength == 0) {
+        return;
+    }
+    const auto &level = mLevels[mWindowLevel];
+    const uint64_t from = std::max(level.first,
+                                   level.current >= mWindowLength ? level.current - mWindowLength : 0);
+    for (uint64_t b = from; b < level.current; ++b) {
+        const uint64_t packets = level.packets[b % buckets];
+        mWindowSum += packets;
+        mBusyBuckets += packets >= mBusyPackets;
+        ++mWindowBuckets;
+    }
+}
+
+double
+ActivityHistory::meanRate() const {
+    if (mWindowBuckets == 0) {
+        return 0;
+    }
+    return double(mWindowSum) * 1000000 / (double(mWindowBuckets) * resolution_usec[mWindowLevel]);
+}
+
+uint64_t
+ActivityHistory::bucket(size_t i, size_t age) const {
+    const auto &level = mLevels[i];
+    if (!mStarted || age == 0 || age >= buckets || level.current < level.first + age) {
+        return 0;
+    }
+    return level.packets[(level.current - age) % buckets];
+}
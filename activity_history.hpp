@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Packet history of one interface at 1 s, 10 s and 60 s resolution, each a
+ * ring of the last 64 buckets.
+ *
+ * add() spreads the packets of a sample evenly over the buckets its time
+ * span covers, so samples taken at any interval feed every resolution. The
+ * window set with setWindow() is kept on the finest resolution covering
+ * it: a running sum and a count of busy buckets, updated as buckets
+ * complete, so the queries never rescan the history.
+ */
+class ActivityHistory {
+public:
+    static constexpr size_t levels = 3;
+    static constexpr size_t buckets = 64;
+    // Leaves room for the bucket still filling in the ring
+    static constexpr uint32_t max_window_buckets = 60;
+    static constexpr uint64_t resolution_usec[levels] = { 1000000, 10000000, 60000000 };
+    static constexpr int max_window_sec = 3600;
+
+    ActivityHistory();
+
+    // window_sec of 0 disables the window queries, longer windows are
+    // clamped to max_window_sec. A bucket is busy when its rate reaches
+    // busy_rate packets/s.
+    void setWindow(int window_sec, double busy_rate);
+    // Packets seen over [start_usec, end_usec), spans must not overlap.
+    void add(uint64_t start_usec, uint64_t end_usec, uint64_t packets);
+    void clear();
+
+    // Mean packets/s over the completed buckets of the window.
+    double meanRate() const;
+    // Completed buckets in the window, fewer than its length until the
+    // history is long enough.
+    uint32_t windowBuckets() const { return mWindowBuckets; }
+    uint32_t busyBuckets() const { return mBusyBuckets; }
+
+    // Packets in the bucket age buckets before the one still filling.
+    uint64_t bucket(size_t level, size_t age) const;
+
+private:
+    struct level_t {
+        uint64_t packets[buckets];
+        // Bucket number of the one still filling
+        uint64_t current;
+        // First bucket number with history
+        uint64_t first;
+    };
+
+    void advance(size_t level, uint64_t index);
+    void complete(size_t level, uint64_t index);
+    void recomputeWindow();
+
+    level_t mLevels[levels];
+    bool mStarted;
+    size_t mWindowLevel;
+    // In buckets of mWindowLevel, 0 without window
+    uint32_t mWindowLength;
+    double mBusyRate;
+    uint64_t mBusyPackets;
+    uint64_t mWindowSum;
+    uint32_t mWindowBuckets;
+    uint32_t mBusyBuckets;
+};
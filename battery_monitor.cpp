@@ -1,130 +1,303 @@
 #include "battery_monitor.hpp"
 
-#include <fstream>
-#include <sys/epoll.h>
-#include <sys/eventfd.h>
-#include <unistd.h>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <libudev.h>
 
+#include "utils.hpp"
+#include "clock.hpp"
+#include "state_handler.hpp"
+#include "flight_recorder.hpp"
+#include "perf_counters.hpp"
 #include "log.hpp"
 
 namespace {
-template<typename t>
-t get_value_from_file(const std::string &filename, t failed_value) {
-    std::ifstream f(filename);
-    if (!f.good()) {
+int64_t property_int(struct udev_device *dev, const char *key, int64_t failed_value) {
+    const char *str = udev_device_get_property_value(dev, key);
+    int64_t value;
+    if (!str || !parse_sysfs_int(str, str + strlen(str), value)) {
         return failed_value;
     }
-    t value = failed_value;
-    f >> value;
-
     return value;
 }
 
-double get_battery_voltage(const settings_t &settings) {
-    std::string voltage_file = "/sys/class/power_supply/";
-    voltage_file += settings.battery_name;
-    voltage_file += "/voltage_now";
-    int voltage = get_value_from_file(voltage_file, -1000000);
-    return double(voltage)/1000000;
+std::string uevent_path(const settings_t &settings) {
+    return root_path("/sys/class/power_supply/" + settings.battery_name + "/uevent");
 }
 
-double get_battery_capacity(const settings_t &settings) {
-    std::string capacity_file = "/sys/class/power_supply/";
-    capacity_file += settings.battery_name;
-    capacity_file += "/capacity";
-    int capacity = get_value_from_file(capacity_file, -1);
-    return capacity;
+// Predictions further out only mean the battery is not running down
+const double max_prediction_sec = 7 * 24 * 3600;
+
+timestamp_t trend_limit_time(const DischargeTrend &trend, double limit) {
+    const double seconds = trend.secondsToLimit(limit);
+    if (!(seconds < max_prediction_sec)) {
+        return no_deadline;
+    }
+    return timestamp_t(llround(double(trend.lastUsec()) / 1000000 + seconds));
 }
 }
 
-BatteryMonitor::BatteryMonitor(const settings_t settings,
-                   size_t nbr_samples,
-                   int sample_period_ms)
-: mSettings(settings)
-, mNumberSamples(nbr_samples)
+BatteryMonitor::BatteryMonitor(settings_snapshot_t settings,
+                   int sample_period_ms,
+                   int max_sample_period_ms)
+: mSettings(std::move(settings))
 , mSamplePeriod(sample_period_ms)
-, mBatteryVoltage(mNumberSamples)
-, mBatteryCapacity(mNumberSamples)
+, mMaxSamplePeriod(std::max(sample_period_ms, max_sample_period_ms))
+, mSampleInterval(sample_period_ms)
+, mSources("bat_mon", &g_perf.battery_wakeups)
+, mUdev(nullptr)
+, mUdevMonitor(nullptr)
+, mFallbackTimer(-1)
 {
+    mStatus.store(evaluateWindows());
 }
 
 BatteryMonitor::~BatteryMonitor() {
-    if (mAbortFD >= 0) {
-        uint64_t v = 1;
-        write(mAbortFD, &v, sizeof(v));
-        if (mThread.joinable()) {
-            mThread.join();
-        }
-        close(mAbortFD);
+    mSources.stop();
+    if (mUdevMonitor) {
+        udev_monitor_unref(mUdevMonitor);
+    }
+    if (mUdev) {
+        udev_unref(mUdev);
     }
 }
 
 void
 BatteryMonitor::reset() {
+    resetSamples();
+    mStatus.store(evaluateWindows());
+}
+
+void
+BatteryMonitor::resetSamples() {
+    g_flight_recorder.record(flight_event::BATTERY_RESET, 0);
     mBatteryVoltage.reset();
     mBatteryCapacity.reset();
+    mVoltageTrend.reset();
+    mCapacityTrend.reset();
+    mSampleInterval = mSamplePeriod;
 }
 
 
 bool
-BatteryMonitor::start() {
-    int epollfd = epoll_create1(0);
-    struct epoll_event ev;
-    mAbortFD = eventfd(0, 0);
-    ev.events = EPOLLIN;
-    ev.data.fd = mAbortFD;
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, mAbortFD, &ev) == -1) {
-        LOG_ERROR("bat_mon: epoll_ctl: sd_bus fd: '%s' (%d)", strerror(errno), errno);
+BatteryMonitor::start(EventLoop &loop) {
+    mSources.attach(loop);
+
+    // voltage_now and capacity are both read from the uevent file
+    mUevent.setPath(uevent_path(*mSettings));
+    sample();
+
+    // Battery and charger share one udev socket. The subsystem match is a
+    // socket filter, so uevents of other subsystems never wake us up.
+    // Below a filesystem root the battery is only sampled by the timer.
+    if (filesystem_root().empty()) {
+        mUdev = udev_new();
+        if (!mUdev) {
+            LOG_ERROR("bat_mon: Can't create udev");
+            return false;
+        }
+        mUdevMonitor = udev_monitor_new_from_netlink(mUdev, "udev");
+        if (!mUdevMonitor) {
+            LOG_ERROR("bat_mon: Can't create udev monitor");
+            return false;
+        }
+        udev_monitor_filter_add_match_subsystem_devtype(mUdevMonitor, "power_supply", NULL);
+        udev_monitor_enable_receiving(mUdevMonitor);
+        const int udev_fd = udev_monitor_get_fd(mUdevMonitor);
+        if (!mSources.addFd(udev_fd, EPOLLIN, [this] (uint32_t) { handleUdev(); })) {
+            LOG_ERROR("bat_mon: Failed to watch udev_fd.");
+            return false;
+        }
+    }
+
+    // Fallback for gauges that do not emit change uevents, rearmed on each sample
+    mFallbackTimer = mSources.addTimer([this] (uint32_t) { sample(); });
+    if (mFallbackTimer == -1 || !armFallback()) {
+        LOG_ERROR("bat_mon: Failed to start sample timer.");
         return false;
     }
 
-    mBatteryVoltage.addValue(get_battery_voltage(mSettings));
-    mBatteryCapacity.addValue(get_battery_capacity(mSettings));
-
-    mThread = std::thread([this, epollfd] () mutable
-    {
-        bool stop_thread = false;
-        for (;;) {
-            struct epoll_event ep_events[1];
-            int nfds = epoll_wait(epollfd, ep_events, 1, mSamplePeriod);
-            if (nfds == -1) {
-                if (errno != EINTR) {
-                    LOG_ERROR("bat_mon: epoll_wait: '%s' (%d)", strerror(errno), errno);
-                }
-                continue;
-            }
-            for (int n = 0; n < nfds; ++n) {
-                if (ep_events[n].data.fd == mAbortFD) {
-                    stop_thread = true;
-                    break;
-                }
-            }
-            if (stop_thread) {
-                break;
-            }
-            auto voltage = get_battery_voltage(mSettings);
-            mBatteryVoltage.addValue(voltage);
-            auto capacity = get_battery_capacity(mSettings);
-            mBatteryCapacity.addValue(capacity);
-        }
-        if (epollfd >= 0) {
-            close(epollfd);
+    return mSources.start();
+}
+
+void
+BatteryMonitor::applySettings(settings_snapshot_t settings, settings_changes_t changes) {
+    // The limit times and the sample interval depend on these
+    const settings_changes_t limits =
+        settings_change(settings_field::BAT_MONITOR_MODE) |
+        settings_change(settings_field::BAT_VOLTAGE_LIMIT) |
+        settings_change(settings_field::BAT_PERCENTAGE_LIMIT);
+
+    mSources.invoke([&] () {
+        mSettings = std::move(settings);
+        if (changes & settings_change(settings_field::NAME_BATTERY)) {
+            mUevent.setPath(uevent_path(*mSettings));
+            resetSamples();
+            sample();
+        } else if (changes & limits) {
+            mStatus.store(evaluateWindows());
+            mSampleInterval = mSamplePeriod;
+            armFallback();
         }
     });
+}
+
+void
+BatteryMonitor::handleUdev() {
+    const auto dev = udev_monitor_receive_device(mUdevMonitor);
+    if (!dev) {
+        return;
+    }
+    g_perf.udev_received.add();
+    const char *sysname = udev_device_get_sysname(dev);
+    if (sysname && mSettings->battery_name == sysname) {
+        handleBattery(dev);
+    } else if (sysname && mSettings->charger_name == sysname) {
+        handleCharger(dev);
+    } else {
+        g_perf.udev_filtered.add();
+    }
+    udev_device_unref(dev);
+}
+
+void
+BatteryMonitor::handleBattery(struct udev_device *dev) {
+    // The change uevent carries all POWER_SUPPLY_* properties, no sysfs
+    // read is needed unless the driver left out the voltage.
+    auto values = power_supply_failed_values();
+    values.voltage_now = property_int(dev, "POWER_SUPPLY_VOLTAGE_NOW", values.voltage_now);
+    values.capacity = property_int(dev, "POWER_SUPPLY_CAPACITY", values.capacity);
+    if (values.voltage_now == power_supply_failed_values().voltage_now) {
+        values = read_power_supply(mUevent);
+    }
+    addSample(values);
+}
+
+void
+BatteryMonitor::handleCharger(struct udev_device *dev) {
+    int64_t online = property_int(dev, "POWER_SUPPLY_ONLINE", -1);
+    if (online == -1) {
+        const char *value = udev_device_get_sysattr_value(dev, "online");
+        online = value ? atoi(value) : -1;
+    }
+    const bool charger_online = (online == 1);
+    LOG_DEBUG("Power supply is %s.", charger_online?"ONLINE":"OFFLINE");
+    g_flight_recorder.record(flight_event::CHARGER, charger_online);
+    if (mChargerListener) {
+        mChargerListener(charger_online);
+    }
+}
+
+void
+BatteryMonitor::sample() {
+    addSample(read_power_supply(mUevent));
+}
+
+void
+BatteryMonitor::addSample(const power_supply_values_t &values) {
+    g_flight_recorder.record(flight_event::BATTERY_SAMPLE, uint32_t(values.capacity), values.voltage_now);
+    mBatteryVoltage.addValue(double(values.voltage_now)/1000000);
+    mBatteryCapacity.addValue(values.capacity);
+    // On the clock of the records, so a replay fits the same trends
+    add_battery_trend_sample(mVoltageTrend, mCapacityTrend, get_clock().nowUsec(), values);
+
+    const auto status = evaluateWindows();
+    const auto last_status = mStatus.load();
+    // A later shutdown deadline is found when the daemon wakes up for the
+    // earlier one, only an earlier one needs a notification.
+    const bool changed = status.valid != last_status.valid ||
+        status.voltage_below_limit != last_status.voltage_below_limit ||
+        status.capacity_below_limit != last_status.capacity_below_limit ||
+        get_battery_deadline(*mSettings, status) < get_battery_deadline(*mSettings, last_status);
+    mStatus.store(status);
+    if (changed && mStatusListener) {
+        mStatusListener();
+    }
+
+    const auto &settings = *mSettings;
+    const bool voltage = settings.battery_monitor_mode == battery_monitor_mode_t::BOTH ||
+        settings.battery_monitor_mode == battery_monitor_mode_t::VOLTAGE;
+    const bool capacity = settings.battery_monitor_mode == battery_monitor_mode_t::BOTH ||
+        settings.battery_monitor_mode == battery_monitor_mode_t::PERCENTAGE;
+    double seconds_to_limit = INFINITY;
+    if (voltage) {
+        seconds_to_limit = mVoltageTrend.valid() ?
+            mVoltageTrend.secondsToLimit(settings.battery_voltage_limit) : 0;
+    }
+    if (capacity) {
+        seconds_to_limit = std::min(seconds_to_limit, mCapacityTrend.valid() ?
+            mCapacityTrend.secondsToLimit(settings.battery_capacity_limit) : 0);
+    }
+    mSampleInterval = next_battery_sample_ms(seconds_to_limit, mSamplePeriod, mMaxSamplePeriod);
+    armFallback();
+}
+
+// Restarts the fallback period from now
+bool
+BatteryMonitor::armFallback() {
+    if (mFallbackTimer == -1) {
+        return true;
+    }
+    return mSources.armTimer(mFallbackTimer, mSampleInterval, mSampleInterval);
+}
 
-    return true;
+void
+BatteryMonitor::setChargerListener(std::function<void(bool)> listener) {
+    mChargerListener = std::move(listener);
+}
+
+void
+BatteryMonitor::setStatusListener(std::function<void()> listener) {
+    mStatusListener = std::move(listener);
 }
 
 battery_status_t
 BatteryMonitor::getStatus() {
+    return mStatus.load();
+}
+
+battery_status_t
+BatteryMonitor::evaluateWindows() {
+    return evaluate_battery_windows(mBatteryVoltage, mBatteryCapacity,
+                                    mVoltageTrend, mCapacityTrend, *mSettings);
+}
+
+battery_status_t evaluate_battery_windows(const battery_window_t &voltage,
+                                          const battery_window_t &capacity,
+                                          const DischargeTrend &voltage_trend,
+                                          const DischargeTrend &capacity_trend,
+                                          const settings_t &settings) {
     return {
-        .valid = mBatteryVoltage.isFullyPopulated(),
-        .voltage_below_limit = mBatteryVoltage.allValuesAreBelow(mSettings.battery_voltage_limit),
-        .capacity_below_limit = mBatteryCapacity.allValuesAreBelow(mSettings.battery_capacity_limit),
+        .valid = voltage.isFullyPopulated(),
+        .voltage_below_limit = voltage.allValuesAreBelow(settings.battery_voltage_limit),
+        .capacity_below_limit = capacity.allValuesAreBelow(settings.battery_capacity_limit),
+        .voltage_limit_time = trend_limit_time(voltage_trend, settings.battery_voltage_limit),
+        .capacity_limit_time = trend_limit_time(capacity_trend, settings.battery_capacity_limit),
     };
 }
 
+void add_battery_trend_sample(DischargeTrend &voltage_trend, DischargeTrend &capacity_trend,
+                              uint64_t time_usec, const power_supply_values_t &values) {
+    const auto failed = power_supply_failed_values();
+    if (values.voltage_now != failed.voltage_now) {
+        voltage_trend.add(time_usec, double(values.voltage_now) / 1000000);
+    }
+    if (values.capacity != failed.capacity) {
+        capacity_trend.add(time_usec, double(values.capacity));
+    }
+}
+
+int next_battery_sample_ms(double seconds_to_limit, int min_ms, int max_ms) {
+    const double interval_ms = seconds_to_limit * 1000 / BatteryMonitor::window_size;
+    if (!(interval_ms < max_ms)) {
+        return max_ms;
+    }
+    return std::max(min_ms, int(interval_ms));
+}
+
 void
 BatteryMonitor::printData() {
     const std::string voltages = mBatteryVoltage.getDataAsString();
@@ -1,31 +1,95 @@
 #pragma once
 
-#include <thread>
-#include <mutex>
+#include <functional>
 #include <vector>
 
 #include "types.hpp"
+#include "discharge_trend.hpp"
+#include "event_loop.hpp"
 #include "rolling_window.hpp"
+#include "seqlock.hpp"
+#include "sysfs_attribute.hpp"
 
+struct udev;
+struct udev_monitor;
+struct udev_device;
 
+/*
+ * Monitors the battery and charger power supplies.
+ *
+ * Battery samples are taken from kernel change uevents. A fallback timer
+ * samples the uevent file when the gauge has been silent for a sample
+ * period. Every sample also feeds the voltage and capacity trends that
+ * predict when the limits are reached. The period is the shortest one
+ * until the trends are known, then it grows with the predicted time up to
+ * the longest period, so a battery far from empty is rarely sampled.
+ */
 class BatteryMonitor {
 public:
-    BatteryMonitor(const settings_t settings,
-                   size_t nbr_samples,
-                   int sample_period_ms);
+    // Number of samples that all must be below the limits
+    static const size_t window_size = 10;
+
+    BatteryMonitor(settings_snapshot_t settings,
+                   int sample_period_ms,
+                   int max_sample_period_ms);
     ~BatteryMonitor();
     battery_status_t getStatus();
-    bool start();
+    bool start(EventLoop &loop);
     void reset();
+    // Applies changed settings, the sample windows are only cleared when
+    // the battery changes.
+    void applySettings(settings_snapshot_t settings, settings_changes_t changes);
     void printData();
+    // Called when the status changes in a way the state evaluation cannot
+    // predict from time alone. May be called from the monitor's own thread.
+    void setStatusListener(std::function<void()> listener);
+    // Called with the new online state when the charger changes.
+    void setChargerListener(std::function<void(bool)> listener);
 
 private:
-    settings_t mSettings;
-    size_t mNumberSamples;
+    void handleUdev();
+    void handleBattery(struct udev_device *dev);
+    void handleCharger(struct udev_device *dev);
+    void sample();
+    void addSample(const power_supply_values_t &values);
+    battery_status_t evaluateWindows();
+    void resetSamples();
+    bool armFallback();
+
+    settings_snapshot_t mSettings;
     int mSamplePeriod;
-    std::mutex mMutex;
-    std::thread mThread;
-    int mAbortFD;
-    RollingWindow<double> mBatteryVoltage;
-    RollingWindow<double> mBatteryCapacity;
+    int mMaxSamplePeriod;
+    int mSampleInterval;
+    EventSourceGroup mSources;
+    SysfsAttribute mUevent;
+    struct udev *mUdev;
+    struct udev_monitor *mUdevMonitor;
+    int mFallbackTimer;
+    RollingWindow<double, window_size> mBatteryVoltage;
+    RollingWindow<double, window_size> mBatteryCapacity;
+    DischargeTrend mVoltageTrend;
+    DischargeTrend mCapacityTrend;
+    std::function<void()> mStatusListener;
+    std::function<void(bool)> mChargerListener;
+    SeqLock<battery_status_t> mStatus;
 };
+
+using battery_window_t = RollingWindow<double, BatteryMonitor::window_size>;
+
+// Status of the voltage (V) and capacity (%) sample windows, valid once
+// the voltage window is full, with the limit times of the trends. Shared
+// with the trace replay.
+battery_status_t evaluate_battery_windows(const battery_window_t &voltage,
+                                          const battery_window_t &capacity,
+                                          const DischargeTrend &voltage_trend,
+                                          const DischargeTrend &capacity_trend,
+                                          const settings_t &settings);
+
+// Adds a sample taken at time_usec to the trends, failed reads are left out.
+void add_battery_trend_sample(DischargeTrend &voltage_trend, DischargeTrend &capacity_trend,
+                              uint64_t time_usec, const power_supply_values_t &values);
+
+// Fallback sample interval for seconds_to_limit, the shortest predicted
+// time of the monitored trends, 0 while they are not known. Leaves room
+// for a full window of samples before the limit.
+int next_battery_sample_ms(double seconds_to_limit, int min_ms, int max_ms);
@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#include "../clock.hpp"
+#include "../event_loop.hpp"
+#include "../input_monitor.hpp"
+#include "../perf_counters.hpp"
+#include "../utils.hpp"
+
+namespace {
+// A touchscreen drag: X, Y and SYN every millisecond
+const int flood_period_us = 1000;
+const int flood_duration_ms = 2000;
+// Re-arms a second after the last event, the shortest delay there is
+const int idle_limit_sec = 2;
+
+// Stamps the events like the kernel after EVIOCSCLOCKID
+void flood(int fd, const std::atomic<bool> &done) {
+    struct input_event burst[3] = {};
+    burst[0].type = EV_ABS;
+    burst[0].code = ABS_X;
+    burst[1].type = EV_ABS;
+    burst[1].code = ABS_Y;
+    burst[2].type = EV_SYN;
+    while (!done) {
+        const uint64_t now = get_clock().nowUsec();
+        for (auto &ev: burst) {
+            ev.input_event_sec = now / 1000000;
+            ev.input_event_usec = now % 1000000;
+        }
+        // A full FIFO drops the burst, as evdev drops a full queue
+        write(fd, burst, sizeof(burst));
+        usleep(flood_period_us);
+    }
+}
+}
+
+// Wakeups of the input monitor under an event flood, for a device without
+// monotonic event times which stays level triggered (range 0) and one
+// armed with EPOLLONESHOT and re-armed before the idle deadline (1). A
+// FIFO below a filesystem root stands in for the evdev node.
+static void BM_InputFloodWakeups(benchmark::State &state) {
+    const bool oneshot = state.range(0);
+    const uint64_t wakeups_before = g_perf.input_wakeups.value();
+    const uint64_t events_before = g_perf.evdev_events.value();
+
+    std::string root = "/tmp/fam_bench_XXXXXX";
+    if (!mkdtemp(&root[0])) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    const std::string node = root + "/event0";
+    mkfifo(node.c_str(), 0600);
+    set_filesystem_root(root);
+    set_input_clock_probe([oneshot] (int) { return oneshot; });
+
+    settings_t settings = {};
+    settings.input_event_devices = { "/event*" };
+    settings.input_coalescing = true;
+    settings.sleep_enabled = true;
+    settings.inactive_on_battery_limit = idle_limit_sec;
+    settings.inactive_on_charger_limit = idle_limit_sec;
+    for (auto _ : state) {
+        EventLoop loop;
+        std::unique_ptr<InputMonitor> monitor(new InputMonitor(std::make_shared<const settings_t>(settings)));
+        if (!monitor->start(loop)) {
+            state.SkipWithError("input monitor failed to start");
+            break;
+        }
+        const int writer_fd = open(node.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        const int stop_timer = loop.addTimer([&] (uint32_t) { loop.stop(); });
+        loop.armTimer(stop_timer, flood_duration_ms, 0);
+
+        std::atomic<bool> done(false);
+        std::thread writer(flood, writer_fd, std::cref(done));
+        loop.run();
+        done = true;
+        writer.join();
+        loop.removeTimer(stop_timer);
+        monitor.reset();
+        close(writer_fd);
+    }
+    set_input_clock_probe(nullptr);
+    set_filesystem_root("");
+    unlink(node.c_str());
+    rmdir(root.c_str());
+
+    const double seconds = state.iterations() * flood_duration_ms / 1000.0;
+    state.counters["wakeups/s"] = (g_perf.input_wakeups.value() - wakeups_before) / seconds;
+    state.counters["events/s"] = (g_perf.evdev_events.value() - events_before) / seconds;
+}
+BENCHMARK(BM_InputFloodWakeups)->Arg(0)->Arg(1)->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
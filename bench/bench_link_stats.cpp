@@ -0,0 +1,66 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "../activity_history.hpp"
+#include "../link_stats.hpp"
+
+namespace {
+// Every other interface matches, as wlan/usb among virtual interfaces
+std::vector<std::string> interface_names(size_t count) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < count; ++i) {
+        names.push_back((i % 2 ? "veth" : "wlan") + std::to_string(i));
+    }
+    return names;
+}
+}
+
+// One sample: a full RTM_GETLINK dump into the table and the max diff.
+static void BM_LinkTableSample(benchmark::State &state) {
+    const auto names = interface_names(state.range(0));
+    LinkTable table({"wlan*"});
+    uint64_t packets = 0;
+    for (auto _ : state) {
+        table.beginDump();
+        for (size_t i = 0; i < names.size(); ++i) {
+            const link_msg_t link = {int(i + 1), names[i].c_str(), true, packets + i, packets};
+            table.update(link);
+        }
+        table.endDump();
+        benchmark::DoNotOptimize(table.maxPacketsSinceLastSample());
+        packets += 10;
+    }
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_LinkTableSample)->RangeMultiplier(4)->Range(1, 256)->Complexity();
+
+static void BM_LinkTableMaxPackets(benchmark::State &state) {
+    const auto names = interface_names(state.range(0));
+    LinkTable table({"wlan*"});
+    for (size_t i = 0; i < names.size(); ++i) {
+        table.update({int(i + 1), names[i].c_str(), true, i, 0});
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.maxPacketsSinceLastSample());
+    }
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_LinkTableMaxPackets)->RangeMultiplier(4)->Range(1, 256)->Complexity();
+
+// One sample of range(0) seconds into the history of an interface, the
+// window query included.
+static void BM_ActivityHistoryAdd(benchmark::State &state) {
+    const uint64_t interval_usec = uint64_t(state.range(0)) * 1000000;
+    ActivityHistory history;
+    history.setWindow(600, 10);
+    uint64_t now_usec = 0;
+    for (auto _ : state) {
+        history.add(now_usec, now_usec + interval_usec, 100);
+        now_usec += interval_usec;
+        benchmark::DoNotOptimize(history.meanRate());
+        benchmark::DoNotOptimize(history.busyBuckets());
+    }
+}
+BENCHMARK(BM_ActivityHistoryAdd)->Arg(1)->Arg(10)->Arg(60);
@@ -0,0 +1,74 @@
+#include <benchmark/benchmark.h>
+
+#include "../discharge_trend.hpp"
+#include "../rolling_window.hpp"
+
+template <size_t N>
+static void BM_RollingWindowAddValue(benchmark::State &state) {
+    RollingWindow<double> window(N);
+    double v = 0;
+    for (auto _ : state) {
+        window.addValue(v);
+        v += 0.5;
+    }
+}
+
+template <size_t N>
+static void BM_FixedRollingWindowAddValue(benchmark::State &state) {
+    RollingWindow<double, N> window;
+    double v = 0;
+    for (auto _ : state) {
+        window.addValue(v);
+        v += 0.5;
+    }
+}
+
+template <size_t N>
+static void BM_RollingWindowAllBelow(benchmark::State &state) {
+    RollingWindow<double> window(N);
+    for (size_t i = 0; i < N; ++i) {
+        window.addValue(3.0 + i * 0.001);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(window.allValuesAreBelow(3.2));
+    }
+}
+
+template <size_t N>
+static void BM_FixedRollingWindowAllBelow(benchmark::State &state) {
+    RollingWindow<double, N> window;
+    for (size_t i = 0; i < N; ++i) {
+        window.addValue(3.0 + i * 0.001);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(window.allValuesAreBelow(3.2));
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_RollingWindowAddValue, 10);
+BENCHMARK_TEMPLATE(BM_RollingWindowAddValue, 100);
+BENCHMARK_TEMPLATE(BM_RollingWindowAddValue, 1000);
+BENCHMARK_TEMPLATE(BM_FixedRollingWindowAddValue, 10);
+BENCHMARK_TEMPLATE(BM_FixedRollingWindowAddValue, 100);
+BENCHMARK_TEMPLATE(BM_FixedRollingWindowAddValue, 1000);
+BENCHMARK_TEMPLATE(BM_RollingWindowAllBelow, 10);
+BENCHMARK_TEMPLATE(BM_RollingWindowAllBelow, 100);
+BENCHMARK_TEMPLATE(BM_RollingWindowAllBelow, 1000);
+BENCHMARK_TEMPLATE(BM_FixedRollingWindowAllBelow, 10);
+BENCHMARK_TEMPLATE(BM_FixedRollingWindowAllBelow, 100);
+BENCHMARK_TEMPLATE(BM_FixedRollingWindowAllBelow, 1000);
+
+// A battery sample into the trend and its prediction, the work the trend
+// adds to every sample next to the window.
+static void BM_DischargeTrendAdd(benchmark::State &state) {
+    DischargeTrend trend;
+    uint64_t time_usec = 0;
+    double v = 4.0;
+    for (auto _ : state) {
+        trend.add(time_usec, v);
+        benchmark::DoNotOptimize(trend.secondsToLimit(3.2));
+        time_usec += 10000000;
+        v -= 0.0001;
+    }
+}
+BENCHMARK(BM_DischargeTrendAdd);
@@ -0,0 +1,84 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "../settings_handler.hpp"
+#include "../config_file.hpp"
+#include "../log.hpp"
+
+// Loads the published snapshot, as every D-Bus getter does. Used to be a
+// full copy of the settings, vectors and strings included, under a mutex.
+static void BM_GetSettings(benchmark::State &state) {
+    SettingsHandler handler;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(handler.getSettings());
+    }
+}
+BENCHMARK(BM_GetSettings);
+
+// Startup and every reload parse the whole config file, one with every key
+// set and a few comments.
+static void BM_ParseConfig(benchmark::State &state) {
+    const std::string content =
+        "# Battery\n"
+        "battery_monitor_mode = voltage\n"
+        "battery_voltage_limit = 3.2\n"
+        "battery_capacity_limit = 5\n"
+        "battery_shutdown_lead = 0\n"
+        "battery_name = battery\n"
+        "charger_name = pf1550-charger\n"
+        "\n"
+        "# Activity\n"
+        "net_devices = wlan0, usb0, p2p0\n"
+        "net_activity_limit = 100\n"
+        "net_sample_min_interval = 5\n"
+        "net_sample_max_interval = 60\n"
+        "net_activity_window = 600\n"
+        "net_activity_percentile = 90\n"
+        "input_event_devices = /dev/input/event0, /dev/input/event1, /dev/input/event2\n"
+        "input_device_properties = ID_INPUT_KEY, ID_INPUT_TOUCHSCREEN\n"
+        "input_coalescing = true\n"
+        "inactive_on_battery_limit = 1800\n"
+        "inactive_on_charger_limit = 0\n"
+        "\n"
+        "# Transitions\n"
+        "sleep_enabled = true\n"
+        "use_logind = true\n"
+        "sleep_system_cmd = systemctl suspend\n"
+        "shutdown_system_cmd = systemctl poweroff\n"
+        "stats_target = /var/spool/flir-activity-monitor/statistics\n";
+    const settings_t defaults = {};
+    std::string error;
+    for (auto _ : state) {
+        settings_t settings = defaults;
+        benchmark::DoNotOptimize(parse_config(content.data(), content.size(), settings, error));
+        benchmark::DoNotOptimize(settings);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(content.size()));
+}
+BENCHMARK(BM_ParseConfig);
+
+// Debug messages with the level filtered out, through the macro which
+// checks the level before evaluating the arguments ...
+static void BM_LogDebugFilteredOut(benchmark::State &state) {
+    const log_level_t previous = g_logger_level.load();
+    logger_set_level(log_level_t::INFO);
+    const std::string device = "/dev/input/event0";
+    for (auto _ : state) {
+        LOG_DEBUG("Got input event on: %s (%zu)", device.c_str(), device.size());
+    }
+    logger_set_level(previous);
+}
+BENCHMARK(BM_LogDebugFilteredOut);
+
+// ... and calling logger_log() directly, as the macros did before.
+static void BM_LoggerLogFilteredOut(benchmark::State &state) {
+    const log_level_t previous = g_logger_level.load();
+    logger_set_level(log_level_t::INFO);
+    const std::string device = "/dev/input/event0";
+    for (auto _ : state) {
+        logger_log(log_level_t::DEBUG, "Got input event on: %s (%zu)", device.c_str(), device.size());
+    }
+    logger_set_level(previous);
+}
+BENCHMARK(BM_LoggerLogFilteredOut);
@@ -0,0 +1,69 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "../state_handler.hpp"
+#include "../log.hpp"
+
+namespace {
+settings_t bench_settings() {
+    settings_t settings = {};
+    settings.battery_monitor_mode = battery_monitor_mode_t::VOLTAGE;
+    settings.battery_voltage_limit = 3.2;
+    settings.battery_capacity_limit = 5;
+    settings.net_activity_limit = 100;
+    settings.inactive_on_battery_limit = 300;
+    settings.inactive_on_charger_limit = 1800;
+    settings.sleep_enabled = true;
+    return settings;
+}
+
+// Statuses covering every branch, drawn up front so only the evaluation
+// is measured.
+std::vector<status_t> random_statuses(size_t count, timestamp_t now) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> coin(0, 1);
+    std::uniform_int_distribution<timestamp_t> idle(0, 3600);
+    std::uniform_real_distribution<double> traffic(0, 200);
+    std::vector<status_t> statuses(count);
+    for (auto &s: statuses) {
+        s.input.event_time = now - idle(rng);
+        s.input.charger_online = coin(rng);
+        s.net.max_traffic_last_period = traffic(rng);
+        s.bat.valid = coin(rng);
+        s.bat.voltage_below_limit = coin(rng) && coin(rng);
+        s.bat.capacity_below_limit = coin(rng) && coin(rng);
+    }
+    return statuses;
+}
+}
+
+// The warnings logged on transitions are filtered out, they would
+// measure syslog instead of the decision.
+static void BM_GetNewState(benchmark::State &state) {
+    const settings_t settings = bench_settings();
+    const timestamp_t now = 100000;
+    const auto statuses = random_statuses(1024, now);
+    const log_level_t previous = g_logger_level.load();
+    logger_set_level(log_level_t::ERROR);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(get_new_state(state_t::ACTIVE, settings, statuses[i], now));
+        i = (i + 1) & (statuses.size() - 1);
+    }
+    logger_set_level(previous);
+}
+BENCHMARK(BM_GetNewState);
+
+static void BM_GetNextDeadline(benchmark::State &state) {
+    const settings_t settings = bench_settings();
+    const timestamp_t now = 100000;
+    const auto statuses = random_statuses(1024, now);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(get_next_deadline(state_t::ACTIVE, settings, statuses[i], now));
+        i = (i + 1) & (statuses.size() - 1);
+    }
+}
+BENCHMARK(BM_GetNextDeadline);
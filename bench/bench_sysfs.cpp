@@ -0,0 +1,110 @@
+#include <benchmark/benchmark.h>
+
+#include <fstream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../sysfs_attribute.hpp"
+
+namespace {
+
+// The per-sample readers used before SysfsAttribute, kept as the baseline.
+template<typename t>
+t legacy_get_value_from_file(const std::string &filename, t failed_value) {
+    std::ifstream f(filename);
+    if (!f.good()) {
+        return failed_value;
+    }
+    t value = failed_value;
+    f >> value;
+
+    return value;
+}
+
+double legacy_get_battery_voltage(const std::string &root, const std::string &name) {
+    std::string voltage_file = root;
+    voltage_file += name;
+    voltage_file += "/voltage_now";
+    int voltage = legacy_get_value_from_file(voltage_file, -1000000);
+    return double(voltage)/1000000;
+}
+
+double legacy_get_battery_capacity(const std::string &root, const std::string &name) {
+    std::string capacity_file = root;
+    capacity_file += name;
+    capacity_file += "/capacity";
+    int capacity = legacy_get_value_from_file(capacity_file, -1);
+    return capacity;
+}
+
+// Fake /sys/class/power_supply/battery tree, on tmpfs when available.
+class FakePowerSupply {
+public:
+    FakePowerSupply() {
+        const char *base = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+        mRoot = std::string(base) + "/fam_bench_XXXXXX";
+        mkdtemp(&mRoot[0]);
+        mRoot += "/";
+        mkdir((mRoot + "battery").c_str(), 0755);
+        write("battery/voltage_now", "3712000\n");
+        write("battery/capacity", "42\n");
+        write("battery/uevent",
+              "POWER_SUPPLY_NAME=battery\n"
+              "POWER_SUPPLY_STATUS=Discharging\n"
+              "POWER_SUPPLY_PRESENT=1\n"
+              "POWER_SUPPLY_VOLTAGE_NOW=3712000\n"
+              "POWER_SUPPLY_CURRENT_NOW=-250000\n"
+              "POWER_SUPPLY_CAPACITY=42\n"
+              "POWER_SUPPLY_TEMP=250\n");
+    }
+    ~FakePowerSupply() {
+        unlink((mRoot + "battery/voltage_now").c_str());
+        unlink((mRoot + "battery/capacity").c_str());
+        unlink((mRoot + "battery/uevent").c_str());
+        rmdir((mRoot + "battery").c_str());
+        rmdir(mRoot.c_str());
+    }
+    const std::string &root() const { return mRoot; }
+
+private:
+    void write(const char *name, const char *content) {
+        FILE *f = fopen((mRoot + name).c_str(), "w");
+        fputs(content, f);
+        fclose(f);
+    }
+
+    std::string mRoot;
+};
+}
+
+static void BM_SysfsIfstreamSample(benchmark::State &state) {
+    FakePowerSupply fake;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(legacy_get_battery_voltage(fake.root(), "battery"));
+        benchmark::DoNotOptimize(legacy_get_battery_capacity(fake.root(), "battery"));
+    }
+}
+BENCHMARK(BM_SysfsIfstreamSample);
+
+static void BM_SysfsAttributeSample(benchmark::State &state) {
+    FakePowerSupply fake;
+    SysfsAttribute voltage(fake.root() + "battery/voltage_now");
+    SysfsAttribute capacity(fake.root() + "battery/capacity");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(double(voltage.readInt(-1000000))/1000000);
+        benchmark::DoNotOptimize(capacity.readInt(-1));
+    }
+}
+BENCHMARK(BM_SysfsAttributeSample);
+
+static void BM_SysfsUeventSample(benchmark::State &state) {
+    FakePowerSupply fake;
+    SysfsAttribute uevent(fake.root() + "battery/uevent");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(read_power_supply(uevent));
+    }
+}
+BENCHMARK(BM_SysfsUeventSample);
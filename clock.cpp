@@ -0,0 +1,136 @@
+#include "clock.hpp"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace {
+struct timespec usec_to_timespec(uint64_t usec) {
+    struct timespec ts;
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    return ts;
+}
+
+KernelClock kernel_clock;
+std::atomic<Clock *> current_clock(&kernel_clock);
+}
+
+uint64_t
+KernelClock::nowUsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int
+KernelClock::createTimer() {
+    return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+bool
+KernelClock::armTimer(int timer_fd, uint64_t deadline_usec, uint64_t interval_usec) {
+    struct itimerspec spec;
+    spec.it_value = usec_to_timespec(deadline_usec);
+    spec.it_interval = usec_to_timespec(interval_usec);
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0;
+}
+
+void
+KernelClock::destroyTimer(int timer_fd) {
+    close(timer_fd);
+}
+
+
+VirtualClock::VirtualClock(uint64_t start_usec)
+: mNow(start_usec)
+{
+}
+
+VirtualClock::~VirtualClock() {
+    for (const auto &t: mTimers) {
+        close(t.first);
+    }
+}
+
+uint64_t
+VirtualClock::nowUsec() {
+    return mNow.load(std::memory_order_acquire);
+}
+
+int
+VirtualClock::createTimer() {
+    const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> l(mMutex);
+    mTimers[fd] = { 0, 0 };
+    return fd;
+}
+
+bool
+VirtualClock::armTimer(int timer_fd, uint64_t deadline_usec, uint64_t interval_usec) {
+    std::lock_guard<std::mutex> l(mMutex);
+    const auto it = mTimers.find(timer_fd);
+    if (it == mTimers.end()) {
+        return false;
+    }
+    // Like a timerfd, re-arming discards an expiration not read yet
+    uint64_t count;
+    read(timer_fd, &count, sizeof(count));
+    it->second = { deadline_usec, interval_usec };
+    return true;
+}
+
+void
+VirtualClock::destroyTimer(int timer_fd) {
+    std::lock_guard<std::mutex> l(mMutex);
+    if (mTimers.erase(timer_fd) > 0) {
+        close(timer_fd);
+    }
+}
+
+void
+VirtualClock::advance(uint64_t usec, const std::function<void()> &settle) {
+    const uint64_t target = mNow.load(std::memory_order_relaxed) + usec;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> l(mMutex);
+            // Lowest fd first among equal deadlines, for repeatable runs
+            auto next = mTimers.end();
+            for (auto it = mTimers.begin(); it != mTimers.end(); ++it) {
+                const auto &t = it->second;
+                if (t.deadline_usec == 0 || t.deadline_usec > target) {
+                    continue;
+                }
+                if (next == mTimers.end() || t.deadline_usec < next->second.deadline_usec ||
+                    (t.deadline_usec == next->second.deadline_usec && it->first < next->first)) {
+                    next = it;
+                }
+            }
+            if (next == mTimers.end()) {
+                break;
+            }
+            auto &t = next->second;
+            // Time never goes backwards for timers armed in the past
+            if (t.deadline_usec > mNow.load(std::memory_order_relaxed)) {
+                mNow.store(t.deadline_usec, std::memory_order_release);
+            }
+            t.deadline_usec = t.interval_usec ? t.deadline_usec + t.interval_usec : 0;
+            const uint64_t v = 1;
+            write(next->first, &v, sizeof(v));
+        }
+        settle();
+    }
+    mNow.store(target, std::memory_order_release);
+}
+
+Clock &get_clock() {
+    return *current_clock.load(std::memory_order_acquire);
+}
+
+void set_clock(Clock *clock) {
+    current_clock.store(clock ? clock : &kernel_clock, std::memory_order_release);
+}
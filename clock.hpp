@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+
+/*
+ * Monotonic time of the daemon: idle times, deadlines, the timers of the
+ * event loop and the timestamps of the flight recorder.
+ *
+ * The daemon runs on KernelClock, CLOCK_MONOTONIC and timerfds. Tests
+ * install a VirtualClock whose timers are eventfds fired by advance(), so
+ * hours of idle time pass in milliseconds.
+ */
+class Clock {
+public:
+    virtual ~Clock() = default;
+
+    virtual uint64_t nowUsec() = 0;
+
+    // Returns an fd which becomes readable with an 8 byte expiration count
+    // when the timer fires, or -1 with errno set.
+    virtual int createTimer() = 0;
+    // Fires at the absolute deadline_usec, then every interval_usec unless
+    // it is 0. A deadline_usec of 0 disarms the timer.
+    virtual bool armTimer(int timer_fd, uint64_t deadline_usec, uint64_t interval_usec) = 0;
+    // Closes the fd.
+    virtual void destroyTimer(int timer_fd) = 0;
+};
+
+class KernelClock : public Clock {
+public:
+    uint64_t nowUsec() override;
+    int createTimer() override;
+    bool armTimer(int timer_fd, uint64_t deadline_usec, uint64_t interval_usec) override;
+    void destroyTimer(int timer_fd) override;
+};
+
+/*
+ * Time only passes in advance(). Timers due on the way fire one at a time
+ * in deadline order with the clock set to their deadline, and settle() runs
+ * after each one so the callbacks see that time and may arm timers again.
+ */
+class VirtualClock : public Clock {
+public:
+    explicit VirtualClock(uint64_t start_usec = 1000000);
+    ~VirtualClock() override;
+
+    uint64_t nowUsec() override;
+    int createTimer() override;
+    bool armTimer(int timer_fd, uint64_t deadline_usec, uint64_t interval_usec) override;
+    void destroyTimer(int timer_fd) override;
+
+    // settle() typically dispatches the ready events of the loops.
+    void advance(uint64_t usec, const std::function<void()> &settle);
+
+private:
+    struct virtual_timer_t {
+        uint64_t deadline_usec;
+        uint64_t interval_usec;
+    };
+
+    std::mutex mMutex;
+    std::atomic<uint64_t> mNow;
+    std::unordered_map<int, virtual_timer_t> mTimers;
+};
+
+Clock &get_clock();
+// nullptr restores the kernel clock. Event loops keep the clock installed
+// when they were created.
+void set_clock(Clock *clock);
@@ -0,0 +1,383 @@
+#include "config_file.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "log.hpp"
+
+namespace {
+// In settings_field order
+const char *const field_names[] = {
+    "battery_monitor_mode",
+    "battery_voltage_limit",
+    "battery_capacity_limit",
+    "net_devices",
+    "net_activity_limit",
+    "input_event_devices",
+    "input_device_properties",
+    "input_coalescing",
+    "inactive_on_battery_limit",
+    "inactive_on_charger_limit",
+    "battery_name",
+    "charger_name",
+    "sleep_system_cmd",
+    "shutdown_system_cmd",
+    "sleep_enabled",
+    "use_logind",
+    "stats_target",
+    "net_sample_min_interval",
+    "net_sample_max_interval",
+    "net_activity_window",
+    "net_activity_percentile",
+    "battery_shutdown_lead",
+};
+const size_t field_count = sizeof(field_names) / sizeof(field_names[0]);
+static_assert(field_count == size_t(settings_field::BAT_SHUTDOWN_LEAD) + 1, "a settings_field has no name");
+
+// Far larger than any sensible config, guards against reading a wrong path
+const size_t max_config_size = 64 * 1024;
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char *skip_space(const char *first, const char *last) {
+    while (first < last && is_space(*first)) {
+        ++first;
+    }
+    return first;
+}
+
+const char *trim_space(const char *first, const char *last) {
+    while (last > first && is_space(last[-1])) {
+        --last;
+    }
+    return last;
+}
+
+bool equals(const char *first, const char *last, const char *s) {
+    const size_t len = strlen(s);
+    return size_t(last - first) == len && strncasecmp(first, s, len) == 0;
+}
+
+bool find_field(const char *first, const char *last, settings_field &field) {
+    for (size_t i = 0; i < field_count; ++i) {
+        const size_t len = strlen(field_names[i]);
+        if (size_t(last - first) == len && memcmp(first, field_names[i], len) == 0) {
+            field = settings_field(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+bool parse_number(const char *first, const char *last, T &value) {
+    const auto result = std::from_chars(first, last, value);
+    return result.ec == std::errc() && result.ptr == last && first != last;
+}
+
+// std::from_chars for floating point needs gcc 11, the toolchain is gcc 8
+bool parse_number(const char *first, const char *last, double &value) {
+    if (first == last || *first == ' ' || *first == '\t') {
+        return false;
+    }
+    const std::string copy(first, last);
+    char *end;
+    errno = 0;
+    const double result = strtod(copy.c_str(), &end);
+    // strtod also takes "nan", "inf" and hex floats, a limit of nan or inf
+    // would silently disable the comparison it feeds
+    if (errno != 0 || end != copy.c_str() + copy.size() ||
+        !std::isfinite(result) || copy.find_first_of("xX") != std::string::npos) {
+        return false;
+    }
+    value = result;
+    return true;
+}
+
+bool parse_bool(const char *first, const char *last, bool &value) {
+    if (equals(first, last, "true") || equals(first, last, "yes") ||
+        equals(first, last, "on") || equals(first, last, "1")) {
+        value = true;
+        return true;
+    }
+    if (equals(first, last, "false") || equals(first, last, "no") ||
+        equals(first, last, "off") || equals(first, last, "0")) {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+bool parse_mode(const char *first, const char *last, battery_monitor_mode_t &mode) {
+    if (equals(first, last, "none")) {
+        mode = battery_monitor_mode_t::NONE;
+    } else if (equals(first, last, "voltage")) {
+        mode = battery_monitor_mode_t::VOLTAGE;
+    } else if (equals(first, last, "percentage")) {
+        mode = battery_monitor_mode_t::PERCENTAGE;
+    } else if (equals(first, last, "both")) {
+        mode = battery_monitor_mode_t::BOTH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Empty entries are skipped, so an empty value is an empty list.
+std::vector<std::string> parse_list(const char *first, const char *last) {
+    std::vector<std::string> list;
+    while (first < last) {
+        const char *comma = static_cast<const char *>(memchr(first, ',', last - first));
+        const char *end = comma ? comma : last;
+        const char *item = skip_space(first, end);
+        const char *item_end = trim_space(item, end);
+        if (item != item_end) {
+            list.emplace_back(item, item_end);
+        }
+        first = comma ? comma + 1 : last;
+    }
+    return list;
+}
+}
+
+const char *settings_field_name(settings_field field) {
+    const size_t i = size_t(field);
+    return i < field_count ? field_names[i] : "unknown";
+}
+
+bool parse_setting_value(settings_t &settings, settings_field field, const char *first, const char *last) {
+    first = skip_space(first, last);
+    last = trim_space(first, last);
+    switch (field) {
+        case settings_field::BAT_MONITOR_MODE:
+            return parse_mode(first, last, settings.battery_monitor_mode);
+        case settings_field::BAT_VOLTAGE_LIMIT:
+            return parse_number(first, last, settings.battery_voltage_limit);
+        case settings_field::BAT_PERCENTAGE_LIMIT:
+            return parse_number(first, last, settings.battery_capacity_limit);
+        case settings_field::NET_DEVICES:
+            settings.net_devices = parse_list(first, last);
+            return true;
+        case settings_field::NET_ACTIVITY_LIMIT:
+            return parse_number(first, last, settings.net_activity_limit);
+        case settings_field::INPUT_DEVICES:
+            settings.input_event_devices = parse_list(first, last);
+            return true;
+        case settings_field::INPUT_PROPERTIES:
+            settings.input_device_properties = parse_list(first, last);
+            return true;
+        case settings_field::INPUT_COALESCING:
+            return parse_bool(first, last, settings.input_coalescing);
+        case settings_field::INACT_ON_BAT_LIMIT:
+            return parse_number(first, last, settings.inactive_on_battery_limit);
+        case settings_field::INACT_ON_CHARGER_LIMIT:
+            return parse_number(first, last, settings.inactive_on_charger_limit);
+        case settings_field::NAME_BATTERY:
+            settings.battery_name.assign(first, last);
+            return true;
+        case settings_field::NAME_CHARGER:
+            settings.charger_name.assign(first, last);
+            return true;
+        case settings_field::CMD_SLEEP:
+            settings.sleep_system_cmd.assign(first, last);
+            return true;
+        case settings_field::CMD_SHUTDOWN:
+            settings.shutdown_system_cmd.assign(first, last);
+            return true;
+        case settings_field::ENABLED_SLEEP:
+            return parse_bool(first, last, settings.sleep_enabled);
+        case settings_field::USE_LOGIND:
+            return parse_bool(first, last, settings.use_logind);
+        case settings_field::STATS_TARGET:
+            settings.stats_target.assign(first, last);
+            return true;
+        case settings_field::NET_SAMPLE_MIN_INTERVAL:
+            return parse_number(first, last, settings.net_sample_min_interval);
+        case settings_field::NET_SAMPLE_MAX_INTERVAL:
+            return parse_number(first, last, settings.net_sample_max_interval);
+        case settings_field::NET_ACTIVITY_WINDOW:
+            return parse_number(first, last, settings.net_activity_window);
+        case settings_field::NET_ACTIVITY_PERCENTILE:
+        {
+            int percentile;
+            if (!parse_number(first, last, percentile) || percentile < 0 || percentile > 100) {
+                return false;
+            }
+            settings.net_activity_percentile = percentile;
+            return true;
+        }
+        case settings_field::BAT_SHUTDOWN_LEAD:
+            return parse_number(first, last, settings.battery_shutdown_lead);
+    }
+    return false;
+}
+
+bool parse_config(const char *buf, size_t len, settings_t &settings, std::string &error) {
+    const char *const end = buf + len;
+    int line_number = 0;
+    for (const char *line = buf; line < end;) {
+        const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (!eol) {
+            eol = end;
+        }
+        ++line_number;
+        const char *first = skip_space(line, eol);
+        const char *last = trim_space(first, eol);
+        line = eol + 1;
+        if (first == last || *first == '#') {
+            continue;
+        }
+
+        const char *equal = static_cast<const char *>(memchr(first, '=', last - first));
+        if (!equal) {
+            error = "line " + std::to_string(line_number) + ": expected 'key = value'";
+            return false;
+        }
+        settings_field field;
+        if (!find_field(first, trim_space(first, equal), field)) {
+            error = "line " + std::to_string(line_number) + ": unknown key '" +
+                    std::string(first, trim_space(first, equal)) + "'";
+            return false;
+        }
+        if (!parse_setting_value(settings, field, equal + 1, last)) {
+            error = "line " + std::to_string(line_number) + ": invalid " + settings_field_name(field) +
+                    " '" + std::string(skip_space(equal + 1, last), last) + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool read_config_file(const std::string &path, settings_t &settings, std::string &error) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        error = strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        error = strerror(errno);
+        close(fd);
+        return false;
+    }
+    if (size_t(st.st_size) > max_config_size) {
+        error = "file too large";
+        close(fd);
+        return false;
+    }
+    // One read for the whole file, the size is only a hint
+    std::string content(size_t(st.st_size) + 1, '\0');
+    size_t len = 0;
+    for (;;) {
+        const ssize_t n = read(fd, &content[len], content.size() - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            error = strerror(errno);
+            close(fd);
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+        if (len == content.size()) {
+            if (len > max_config_size) {
+                error = "file too large";
+                close(fd);
+                return false;
+            }
+            content.resize(len * 2);
+        }
+    }
+    close(fd);
+    return parse_config(content.data(), len, settings, error);
+}
+
+
+ConfigWatcher::ConfigWatcher(EventLoop &loop, const std::string &path)
+: mLoop(loop)
+, mFD(-1)
+{
+    const size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        mDir = ".";
+        mName = path;
+    } else {
+        mDir = slash == 0 ? "/" : path.substr(0, slash);
+        mName = path.substr(slash + 1);
+    }
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (mFD != -1) {
+        mLoop.removeFd(mFD);
+        close(mFD);
+    }
+}
+
+bool
+ConfigWatcher::start(std::function<void()> changed) {
+    mChanged = std::move(changed);
+    mFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mFD == -1) {
+        LOG_ERROR("config: Failed to create inotify: '%s' (%d)", strerror(errno), errno);
+        return false;
+    }
+    // Editors and package managers replace the file, its directory is watched
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+    if (inotify_add_watch(mFD, mDir.c_str(), mask) == -1) {
+        LOG_ERROR("config: Failed to watch '%s': '%s' (%d)", mDir.c_str(), strerror(errno), errno);
+        close(mFD);
+        mFD = -1;
+        return false;
+    }
+    if (!mLoop.addFd(mFD, EPOLLIN, [this] (uint32_t) { handleEvents(); })) {
+        LOG_ERROR("config: Failed to add inotify to loop.");
+        close(mFD);
+        mFD = -1;
+        return false;
+    }
+    return true;
+}
+
+void
+ConfigWatcher::handleEvents() {
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+    for (;;) {
+        const ssize_t len = read(mFD, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < len;) {
+            const auto *event = reinterpret_cast<const struct inotify_event *>(buf + i);
+            if (event->len > 0 && mName == event->name) {
+                changed = true;
+            }
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    // A burst of events for one edit reloads once
+    if (changed) {
+        LOG_DEBUG("config: '%s/%s' changed", mDir.c_str(), mName.c_str());
+        mChanged();
+    }
+}
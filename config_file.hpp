@@ -0,0 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <stddef.h>
+
+#include "types.hpp"
+#include "event_loop.hpp"
+
+/*
+ * The config file, by default /etc/flir-activity-monitor.conf.
+ *
+ * One "key = value" per line, keys are the names of the settings_t fields.
+ * Lines starting with '#' are comments. Lists are separated by commas, bools
+ * are true/false, yes/no, on/off or 1/0, battery_monitor_mode is one of
+ * none, voltage, percentage or both. Strings run to the end of the line.
+ *
+ *   # Suspend after 30 minutes on battery
+ *   inactive_on_battery_limit = 1800
+ *   net_devices = wlan0, usb0
+ *   sleep_system_cmd = systemctl suspend
+ */
+
+// Key of the field in the config file, also used in log messages.
+const char *settings_field_name(settings_field field);
+
+// Parses [first, last) as the value of field into settings. False if it is
+// malformed, settings is unchanged then.
+bool parse_setting_value(settings_t &settings, settings_field field, const char *first, const char *last);
+
+// Applies the file content to settings in a single pass. On an unknown key
+// or a malformed value, error names the line and false is returned, some of
+// the fields may already be applied.
+bool parse_config(const char *buf, size_t len, settings_t &settings, std::string &error);
+
+// Reads path with read() and parses it. A missing file leaves settings
+// unchanged and is not an error.
+bool read_config_file(const std::string &path, settings_t &settings, std::string &error);
+
+/*
+ * Watches the directory of the config file with inotify, so a file replaced
+ * by rename() is noticed as well as one written in place. The callback runs
+ * on the loop once the file was written, replaced or removed.
+ */
+class ConfigWatcher {
+public:
+    ConfigWatcher(EventLoop &loop, const std::string &path);
+    ~ConfigWatcher();
+    ConfigWatcher(const ConfigWatcher &) = delete;
+    ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+    bool start(std::function<void()> changed);
+
+private:
+    void handleEvents();
+
+    EventLoop &mLoop;
+    std::string mDir;
+    std::string mName;
+    int mFD;
+    std::function<void()> mChanged;
+};
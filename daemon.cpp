@@ -0,0 +1,229 @@
+#include "daemon.hpp"
+
+#include <string.h>
+#include <errno.h>
+
+#include <chrono>
+
+#include "log.hpp"
+#include "flight_recorder.hpp"
+#include "trace_replay.hpp"
+#include "perf_counters.hpp"
+#include "utils.hpp"
+
+namespace {
+// Timeout after which a transition command is terminated
+const int transition_timeout_ms = 60000;
+// Rolling window of the last 10 battery uevents, sampled every 10 seconds
+// when the gauge does not emit change uevents, up to every 5 minutes
+// while the battery is far from its limits.
+const int battery_sample_period_ms = 10000;
+const int battery_max_sample_period_ms = 300000;
+}
+
+void dump_flight_recorder() {
+    g_flight_recorder.flushTrace();
+    if (!g_flight_recorder.dump()) {
+        LOG_ERROR("Failed to dump flight recorder: '%s' (%d)", strerror(errno), errno);
+    }
+}
+
+Daemon::Daemon(EventLoop &loop, settings_snapshot_t settings, LogindClient *logind)
+: mLoop(loop)
+, mSettings(std::move(settings))
+, mState(state_t::ACTIVE)
+, mEvaluateTimer(-1)
+, mStatusEvent(-1)
+, mInput(mSettings)
+, mNet(mSettings)
+, mBattery(mSettings, battery_sample_period_ms, battery_max_sample_period_ms)
+, mStats(loop, mSettings->stats_target)
+, mLauncher(loop)
+, mLogind(logind)
+{
+}
+
+Daemon::~Daemon() {
+    mLoop.removeTimer(mEvaluateTimer);
+    mLoop.removeEvent(mStatusEvent);
+}
+
+bool
+Daemon::start() {
+    mEvaluateTimer = mLoop.addTimer([this] (uint32_t) { evaluate(); });
+    mStatusEvent = mLoop.addEvent([this] (uint32_t) { evaluate(); });
+    if (mEvaluateTimer == -1 || mStatusEvent == -1) {
+        LOG_ERROR("Failed to start state evaluation.");
+        return false;
+    }
+    const int status_event = mStatusEvent;
+    const auto notify_status = [status_event] () { EventLoop::notify(status_event); };
+
+    mInput.setStatusListener(notify_status);
+    if (!mInput.start(mLoop)) {
+        LOG_ERROR("Failed to start input monitor.");
+        return false;
+    }
+
+    mNet.setStatusListener(notify_status);
+    if (!mNet.start(mLoop)) {
+        LOG_ERROR("Failed to start network monitor.");
+        return false;
+    }
+
+    mBattery.setStatusListener(notify_status);
+    mBattery.setChargerListener([this] (bool online) { mInput.chargerChanged(online); });
+    if (!mBattery.start(mLoop)) {
+        LOG_ERROR("Failed to start battery monitor.");
+        return false;
+    }
+
+    evaluate();
+    return true;
+}
+
+void
+Daemon::applySettings(settings_snapshot_t settings, settings_changes_t changes) {
+    mSettings = std::move(settings);
+    record_decision_settings(g_flight_recorder, *mSettings);
+    g_flight_recorder.record(flight_event::SETTINGS_CHANGE, changes);
+    // The monitors share the snapshot, nothing is copied
+    mInput.applySettings(mSettings, changes);
+    mNet.applySettings(mSettings, changes);
+    mBattery.applySettings(mSettings, changes);
+    if (changes & settings_change(settings_field::STATS_TARGET)) {
+        mStats.setTarget(mSettings->stats_target);
+    }
+    evaluate();
+}
+
+status_t
+Daemon::getStatus() {
+    status_t status {
+        .input = mInput.getStatus(),
+        .net = mNet.getStatus(),
+        .bat = mBattery.getStatus(),
+    };
+
+    return status;
+}
+
+void
+Daemon::evaluate() {
+    const auto status = getStatus();
+    const auto now = get_timestamp();
+    state_t new_state;
+    {
+        PerfTimer timer(g_perf.get_new_state_latency);
+        new_state = get_new_state(mState, *mSettings, status, now);
+    }
+
+    if (new_state != mState) {
+        const char *stat = nullptr;
+        if (new_state == state_t::SHUTDOWN) {
+            mBattery.printData();
+            stat = "low-battery-shutdown";
+        }
+        else if (new_state == state_t::SLEEP) {
+            stat = "auto-suspend";
+        }
+        g_flight_recorder.record(flight_event::STATE_TRANSITION, uint32_t(mState), int64_t(new_state));
+        mState = new_state;
+        if (stat) {
+            mStats.record(stat);
+            // Nothing is written after power off, a suspend leaves the
+            // batch to the flush timer.
+            if (new_state == state_t::SHUTDOWN) {
+                mStats.flushNow();
+                dump_flight_recorder();
+            }
+            requestTransition(new_state, [this, new_state] (int status) {
+                transitionDone(new_state, status);
+            });
+        }
+    }
+
+    const auto status_now = getStatus();
+    // Only an active system decides to sleep, the network sample is due by then
+    mNet.setIdleDeadline(mState == state_t::ACTIVE ? get_idle_deadline(*mSettings, status_now) : no_deadline);
+    const auto deadline = get_next_deadline(mState, *mSettings, status_now, get_timestamp());
+    mLoop.armTimerAt(mEvaluateTimer, deadline == no_deadline ? 0 : uint64_t(deadline) * 1000);
+}
+
+// Requests new_state from logind, or runs the configured command when
+// logind is disabled or fails. done gets 0 or the command's exit status.
+// Returns false if there is no way to enter the state.
+bool
+Daemon::requestTransition(state_t new_state, ProcessLauncher::ExitCallback done) {
+    if (new_state != state_t::SLEEP && new_state != state_t::SHUTDOWN) {
+        return false;
+    }
+    const bool sleep = new_state == state_t::SLEEP;
+    const std::string command = sleep ? mSettings->sleep_system_cmd : mSettings->shutdown_system_cmd;
+    // Decision to request latency, logged for comparing the two paths
+    const auto decided = std::chrono::steady_clock::now();
+    const auto elapsed_ms = [decided] () {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decided).count();
+    };
+
+    ProcessLauncher &launcher = mLauncher;
+    const auto run_command = [&launcher, command, sleep, elapsed_ms, done] () {
+        if (command.empty()) {
+            done(-1);
+            return;
+        }
+        if (sleep) {
+            LOG_INFO("Putting system to sleep using: '%s'", command.c_str());
+        } else {
+            LOG_INFO("Shutting down system using: '%s'", command.c_str());
+            logger_flush();
+        }
+        const pid_t pid = launcher.launch(command, transition_timeout_ms, done);
+        if (pid != -1) {
+            LOG_INFO("'%s' started %.1f ms after the decision.", command.c_str(), elapsed_ms());
+        }
+    };
+
+    if (mSettings->use_logind && mLogind) {
+        const char *method = sleep ? "Suspend" : "PowerOff";
+        LOG_INFO("Requesting %s from logind.", method);
+        if (!sleep) {
+            // Nothing logged later is guaranteed to reach the log
+            logger_flush();
+        }
+        const bool sent = mLogind->request(method, [method, elapsed_ms, run_command, done] (bool ok) {
+            if (!ok) {
+                run_command();
+                return;
+            }
+            LOG_INFO("logind accepted %s %.1f ms after the decision.", method, elapsed_ms());
+            done(0);
+        });
+        if (sent) {
+            return true;
+        }
+    }
+
+    if (command.empty()) {
+        return false;
+    }
+    run_command();
+    return true;
+}
+
+// A failed command is retried when the idle limit runs out again.
+void
+Daemon::transitionDone(state_t state, int status) {
+    if (status != 0) {
+        LOG_ERROR("Transition to %s failed.", state == state_t::SLEEP ? "sleep" : "shutdown");
+    }
+    if (mState == state) {
+        mState = state_t::ACTIVE;
+    }
+    mInput.reset();
+    mNet.reset();
+    mBattery.reset();
+    // After the resets, a replay evaluates on this record
+    g_flight_recorder.record(flight_event::TRANSITION_DONE, uint32_t(state), status);
+    evaluate();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.hpp"
+#include "event_loop.hpp"
+#include "state_handler.hpp"
+#include "input_monitor.hpp"
+#include "network_monitor.hpp"
+#include "battery_monitor.hpp"
+#include "process_launcher.hpp"
+#include "logind_client.hpp"
+#include "stats_sink.hpp"
+
+// Flushes the trace and writes the flight recorder dump, errors are logged.
+void dump_flight_recorder();
+
+/*
+ * The monitors and the state decision of the daemon.
+ *
+ * The state is re-evaluated at the next deadline computed from the idle
+ * limits, or earlier when a monitor reports a status change. Entering
+ * sleep or shutdown requests it from logind or runs the configured
+ * command, the monitors restart from a clean slate once that returned.
+ *
+ * main() adds D-Bus and the signals, tests run it on a VirtualClock below
+ * a filesystem root.
+ */
+class Daemon {
+public:
+    // Suspend and power off only run the commands without logind.
+    Daemon(EventLoop &loop, settings_snapshot_t settings, LogindClient *logind);
+    ~Daemon();
+    Daemon(const Daemon &) = delete;
+    Daemon &operator=(const Daemon &) = delete;
+
+    // Starts the monitors and evaluates the state once.
+    bool start();
+    // Applies only the changed settings, the monitors keep their devices
+    // and the idle time keeps counting.
+    void applySettings(settings_snapshot_t settings, settings_changes_t changes);
+
+    state_t state() const { return mState; }
+    StatsSink &stats() { return mStats; }
+
+private:
+    status_t getStatus();
+    void evaluate();
+    bool requestTransition(state_t new_state, ProcessLauncher::ExitCallback done);
+    void transitionDone(state_t state, int status);
+
+    EventLoop &mLoop;
+    settings_snapshot_t mSettings;
+    state_t mState;
+    int mEvaluateTimer;
+    int mStatusEvent;
+    InputMonitor mInput;
+    NetworkMonitor mNet;
+    BatteryMonitor mBattery;
+    StatsSink mStats;
+    // Commands run asynchronously, the loop keeps handling signals and
+    // status changes meanwhile.
+    ProcessLauncher mLauncher;
+    LogindClient *mLogind;
+};
@@ -0,0 +1,90 @@
+#include "discharge_trend.hpp"
+
+#include <math.h>
+
+namespace {
+// Weighted variance of the sample times, in s^2, below which the slope is
+// not trusted
+const double min_time_variance = 1.0;
+}
+
+constexpr double DischargeTrend::default_time_constant_sec;
+
+DischargeTrend::DischargeTrend(double time_constant_sec)
+: mTimeConstant(time_constant_sec)
+{
+    reset();
+}
+
+void
+DischargeTrend::reset() {
+    mLastUsec = 0;
+    mSamples = 0;
+    mW = mT = mTT = mY = mTY = 0;
+}
+
+void
+DischargeTrend::add(uint64_t time_usec, double value) {
+    if (mSamples > 0) {
+        if (time_usec < mLastUsec) {
+            return;
+        }
+        // Move the time origin to the new sample, then fade the old ones
+        const double d = double(time_usec - mLastUsec) / 1000000;
+        mTT = mTT - 2 * d * mT + d * d * mW;
+        mTY = mTY - d * mY;
+        mT = mT - d * mW;
+        const double fade = exp(-d / mTimeConstant);
+        mW *= fade;
+        mT *= fade;
+        mTT *= fade;
+        mY *= fade;
+        mTY *= fade;
+    }
+    // The new sample is at t = 0, only the sums of 1 and y change
+    mW += 1;
+    mY += value;
+    mLastUsec = time_usec;
+    ++mSamples;
+}
+
+bool
+DischargeTrend::valid() const {
+    if (mSamples < min_samples) {
+        return false;
+    }
+    const double det = mW * mTT - mT * mT;
+    return det > min_time_variance * mW * mW;
+}
+
+double
+DischargeTrend::slope() const {
+    if (!valid()) {
+        return 0;
+    }
+    return (mW * mTY - mT * mY) / (mW * mTT - mT * mT);
+}
+
+double
+DischargeTrend::level() const {
+    if (mSamples == 0) {
+        return 0;
+    }
+    return (mY - slope() * mT) / mW;
+}
+
+double
+DischargeTrend::secondsToLimit(double limit) const {
+    if (!valid()) {
+        return INFINITY;
+    }
+    const double value = level();
+    if (value <= limit) {
+        return 0;
+    }
+    const double rate = slope();
+    if (rate >= 0) {
+        return INFINITY;
+    }
+    return (value - limit) / -rate;
+}
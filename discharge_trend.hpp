@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Linear trend of a battery level, voltage or capacity, over time.
+ *
+ * The fit is a least squares line over all samples with exponentially
+ * fading weights, updated recursively from five running sums, so a sample
+ * costs O(1) and nothing is stored per sample. The weights fade with the
+ * time between samples rather than their count, the estimate means the
+ * same whether the samples come every few seconds or every few minutes.
+ * Sample times are kept relative to the last sample to keep the sums
+ * small.
+ */
+class DischargeTrend {
+public:
+    // Samples older than this weigh 1/e of the newest one
+    static constexpr double default_time_constant_sec = 300;
+    static constexpr unsigned min_samples = 3;
+
+    explicit DischargeTrend(double time_constant_sec = default_time_constant_sec);
+
+    // Samples older than the last one are ignored.
+    void add(uint64_t time_usec, double value);
+    void reset();
+
+    // True once enough samples spread over time were added.
+    bool valid() const;
+    // Change per second, 0 while not valid.
+    double slope() const;
+    // Fitted value at the last sample.
+    double level() const;
+    // Seconds from the last sample until the fitted line falls to limit, 0
+    // if it is there already and infinity if it is not falling or the
+    // trend is not valid.
+    double secondsToLimit(double limit) const;
+    uint64_t lastUsec() const { return mLastUsec; }
+
+private:
+    double mTimeConstant;
+    uint64_t mLastUsec;
+    unsigned mSamples;
+    // Weighted sums of 1, t, t^2, y and t*y, t in seconds before the last
+    // sample
+    double mW;
+    double mT;
+    double mTT;
+    double mY;
+    double mTY;
+};
@@ -0,0 +1,427 @@
+#include "event_loop.hpp"
+
+#include <algorithm>
+#include <future>
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "log.hpp"
+
+namespace {
+const int max_events = 16;
+}
+
+EventLoop::EventLoop()
+: mClock(get_clock())
+, mEpollFD(epoll_create1(EPOLL_CLOEXEC))
+, mWakeFD(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+, mStop(false)
+, mGeneration(0)
+, mWakeups(nullptr)
+{
+    if (mEpollFD == -1) {
+        LOG_ERROR("event_loop: epoll_create1: '%s' (%d)", strerror(errno), errno);
+        return;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = eventData(mWakeFD, 0);
+    if (epoll_ctl(mEpollFD, EPOLL_CTL_ADD, mWakeFD, &ev) == -1) {
+        LOG_ERROR("event_loop: epoll_ctl: wake fd: '%s' (%d)", strerror(errno), errno);
+    }
+}
+
+EventLoop::~EventLoop() {
+    for (const auto &s: mSources) {
+        if (s.second->timer) {
+            mClock.destroyTimer(s.first);
+        } else if (s.second->owned) {
+            close(s.first);
+        }
+    }
+    if (mWakeFD >= 0) {
+        close(mWakeFD);
+    }
+    if (mEpollFD >= 0) {
+        close(mEpollFD);
+    }
+}
+
+uint64_t
+EventLoop::eventData(int fd, uint32_t generation) {
+    return uint64_t(generation) << 32 | uint32_t(fd);
+}
+
+bool
+EventLoop::addFd(int fd, uint32_t events, Callback cb) {
+    // 0 is the wake fd's
+    if (++mGeneration == 0) {
+        ++mGeneration;
+    }
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = eventData(fd, mGeneration);
+    if (epoll_ctl(mEpollFD, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        LOG_ERROR("event_loop: epoll_ctl: add fd %d: '%s' (%d)", fd, strerror(errno), errno);
+        return false;
+    }
+    mSources[fd] = std::make_shared<Source>(Source{std::move(cb), false, false, mGeneration});
+    return true;
+}
+
+bool
+EventLoop::modifyFd(int fd, uint32_t events) {
+    const auto it = mSources.find(fd);
+    if (it == mSources.end()) {
+        LOG_ERROR("event_loop: modify unknown fd %d", fd);
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = eventData(fd, it->second->generation);
+    if (epoll_ctl(mEpollFD, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        LOG_ERROR("event_loop: epoll_ctl: modify fd %d: '%s' (%d)", fd, strerror(errno), errno);
+        return false;
+    }
+    return true;
+}
+
+void
+EventLoop::removeFd(int fd) {
+    if (mSources.erase(fd) == 0) {
+        return;
+    }
+    epoll_ctl(mEpollFD, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int
+EventLoop::addOwnedFd(int fd, Callback cb) {
+    if (!addFd(fd, EPOLLIN, std::move(cb))) {
+        close(fd);
+        return -1;
+    }
+    mSources[fd]->owned = true;
+    return fd;
+}
+
+void
+EventLoop::removeOwnedFd(int fd) {
+    const auto it = mSources.find(fd);
+    if (it == mSources.end() || !it->second->owned) {
+        return;
+    }
+    removeFd(fd);
+    close(fd);
+}
+
+int
+EventLoop::addTimer(Callback cb) {
+    const int fd = mClock.createTimer();
+    if (fd == -1) {
+        LOG_ERROR("event_loop: timer create: '%s' (%d)", strerror(errno), errno);
+        return -1;
+    }
+    if (!addFd(fd, EPOLLIN, std::move(cb))) {
+        mClock.destroyTimer(fd);
+        return -1;
+    }
+    mSources[fd]->owned = true;
+    mSources[fd]->timer = true;
+    return fd;
+}
+
+bool
+EventLoop::armTimer(int timer_fd, int initial_ms, int interval_ms) {
+    const uint64_t deadline_usec = initial_ms > 0 ? mClock.nowUsec() + uint64_t(initial_ms) * 1000 : 0;
+    return armClockTimer(timer_fd, deadline_usec, uint64_t(interval_ms) * 1000);
+}
+
+bool
+EventLoop::armTimerAt(int timer_fd, uint64_t monotonic_ms) {
+    return armClockTimer(timer_fd, monotonic_ms * 1000, 0);
+}
+
+bool
+EventLoop::armClockTimer(int timer_fd, uint64_t deadline_usec, uint64_t interval_usec) {
+    if (!mClock.armTimer(timer_fd, deadline_usec, interval_usec)) {
+        LOG_ERROR("event_loop: timer arm: '%s' (%d)", strerror(errno), errno);
+        return false;
+    }
+    return true;
+}
+
+void
+EventLoop::removeTimer(int timer_fd) {
+    const auto it = mSources.find(timer_fd);
+    if (it == mSources.end() || !it->second->timer) {
+        return;
+    }
+    removeFd(timer_fd);
+    mClock.destroyTimer(timer_fd);
+}
+
+int
+EventLoop::addEvent(Callback cb) {
+    const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        LOG_ERROR("event_loop: eventfd: '%s' (%d)", strerror(errno), errno);
+        return -1;
+    }
+    return addOwnedFd(fd, std::move(cb));
+}
+
+void
+EventLoop::notify(int event_fd) {
+    uint64_t v = 1;
+    write(event_fd, &v, sizeof(v));
+}
+
+void
+EventLoop::removeEvent(int event_fd) {
+    removeOwnedFd(event_fd);
+}
+
+bool
+EventLoop::run() {
+    if (mEpollFD == -1) {
+        return false;
+    }
+
+    while (!mStop) {
+        if (dispatch(-1) == -1) {
+            return false;
+        }
+    }
+    mStop = false;
+
+    return true;
+}
+
+int
+EventLoop::dispatch(int timeout_ms) {
+    struct epoll_event ep_events[max_events];
+    int nfds;
+    do {
+        nfds = epoll_wait(mEpollFD, ep_events, max_events, timeout_ms);
+    } while (nfds == -1 && errno == EINTR);
+    if (nfds == -1) {
+        LOG_ERROR("event_loop: epoll_wait: '%s' (%d)", strerror(errno), errno);
+        return -1;
+    }
+    if (mWakeups && nfds > 0) {
+        mWakeups->add();
+    }
+
+    int dispatched = 0;
+    for (int n = 0; n < nfds && !mStop; ++n) {
+        const int fd = int(uint32_t(ep_events[n].data.u64));
+        const uint32_t generation = uint32_t(ep_events[n].data.u64 >> 32);
+        if (generation == 0) {
+            uint64_t v;
+            read(mWakeFD, &v, sizeof(v));
+            runPosted();
+            ++dispatched;
+            continue;
+        }
+
+        // A previous callback in this batch may have removed the source,
+        // hold a reference so the callback may also remove itself. If it
+        // also closed the fd and a new source took the number, the event
+        // belongs to the old source.
+        const auto it = mSources.find(fd);
+        if (it == mSources.end() || it->second->generation != generation) {
+            continue;
+        }
+        const auto source = it->second;
+        if (source->owned) {
+            uint64_t count;
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                continue;
+            }
+        }
+        source->cb(ep_events[n].events);
+        ++dispatched;
+    }
+    return dispatched;
+}
+
+void
+EventLoop::stop() {
+    mStop = true;
+    uint64_t v = 1;
+    write(mWakeFD, &v, sizeof(v));
+}
+
+void
+EventLoop::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> l(mPostedMutex);
+        mPosted.push_back(std::move(fn));
+    }
+    uint64_t v = 1;
+    write(mWakeFD, &v, sizeof(v));
+}
+
+void
+EventLoop::setWakeupCounter(PerfCounter *counter) {
+    mWakeups = counter;
+}
+
+void
+EventLoop::runPosted() {
+    std::vector<std::function<void()>> posted;
+    {
+        std::lock_guard<std::mutex> l(mPostedMutex);
+        posted.swap(mPosted);
+    }
+    for (const auto &fn: posted) {
+        fn();
+    }
+}
+
+
+EventSourceGroup::EventSourceGroup(const char *name, PerfCounter *wakeups)
+: mName(name)
+, mWakeups(wakeups)
+, mLoop(nullptr)
+{
+}
+
+EventSourceGroup::~EventSourceGroup() {
+    stop();
+}
+
+void
+EventSourceGroup::attach(EventLoop &loop) {
+#ifdef FAM_PER_MONITOR_THREADS
+    (void)loop;
+    if (!mOwnLoop) {
+        mOwnLoop.reset(new EventLoop());
+        mOwnLoop->setWakeupCounter(mWakeups);
+    }
+    mLoop = mOwnLoop.get();
+#else
+    mLoop = &loop;
+#endif
+}
+
+bool
+EventSourceGroup::start() {
+#ifdef FAM_PER_MONITOR_THREADS
+    if (!mOwnLoop || mThread.joinable()) {
+        return false;
+    }
+    mThread = std::thread([this] () {
+        if (!mOwnLoop->run()) {
+            LOG_ERROR("%s: event loop failed.", mName);
+        }
+    });
+#endif
+    return true;
+}
+
+void
+EventSourceGroup::stop() {
+#ifdef FAM_PER_MONITOR_THREADS
+    if (mThread.joinable()) {
+        mOwnLoop->stop();
+        mThread.join();
+    }
+#endif
+    if (!mLoop) {
+        return;
+    }
+    for (const auto fd: mFds) {
+        mLoop->removeFd(fd);
+    }
+    for (const auto fd: mTimers) {
+        mLoop->removeTimer(fd);
+    }
+    mFds.clear();
+    mTimers.clear();
+}
+
+EventLoop::Callback
+EventSourceGroup::counted(EventLoop::Callback cb) {
+#ifdef FAM_PER_MONITOR_THREADS
+    // The private loop counts its own wakeups
+    return cb;
+#else
+    if (!mWakeups) {
+        return cb;
+    }
+    return [wakeups = mWakeups, cb = std::move(cb)] (uint32_t events) {
+        wakeups->add();
+        cb(events);
+    };
+#endif
+}
+
+bool
+EventSourceGroup::addFd(int fd, uint32_t events, EventLoop::Callback cb) {
+    if (!mLoop->addFd(fd, events, counted(std::move(cb)))) {
+        LOG_ERROR("%s: Failed to add fd %d to event loop.", mName, fd);
+        return false;
+    }
+    mFds.push_back(fd);
+    return true;
+}
+
+bool
+EventSourceGroup::modifyFd(int fd, uint32_t events) {
+    return mLoop->modifyFd(fd, events);
+}
+
+void
+EventSourceGroup::removeFd(int fd) {
+    mLoop->removeFd(fd);
+    mFds.erase(std::remove(mFds.begin(), mFds.end(), fd), mFds.end());
+}
+
+void
+EventSourceGroup::invoke(const std::function<void()> &fn) {
+#ifdef FAM_PER_MONITOR_THREADS
+    if (mThread.joinable() && mThread.get_id() != std::this_thread::get_id()) {
+        std::promise<void> done;
+        mOwnLoop->post([&fn, &done] () {
+            fn();
+            done.set_value();
+        });
+        done.get_future().wait();
+        return;
+    }
+#endif
+    fn();
+}
+
+int
+EventSourceGroup::addTimer(EventLoop::Callback cb) {
+    const int fd = mLoop->addTimer(counted(std::move(cb)));
+    if (fd == -1) {
+        LOG_ERROR("%s: Failed to add timer to event loop.", mName);
+        return -1;
+    }
+    mTimers.push_back(fd);
+    return fd;
+}
+
+bool
+EventSourceGroup::armTimer(int timer_fd, int initial_ms, int interval_ms) {
+    return mLoop->armTimer(timer_fd, initial_ms, interval_ms);
+}
+
+bool
+EventSourceGroup::armTimerAt(int timer_fd, uint64_t monotonic_ms) {
+    return mLoop->armTimerAt(timer_fd, monotonic_ms);
+}
+
+void
+EventSourceGroup::removeTimer(int timer_fd) {
+    mLoop->removeTimer(timer_fd);
+    mTimers.erase(std::remove(mTimers.begin(), mTimers.end(), timer_fd), mTimers.end());
+}
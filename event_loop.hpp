@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "clock.hpp"
+#include "perf_counters.hpp"
+
+/*
+ * Single-threaded epoll reactor.
+ *
+ * Monitors register file descriptors and timers as sources, the callbacks
+ * are dispatched from run() on the thread calling it. Only stop() and post()
+ * may be called from another thread. Timers follow the clock installed with
+ * set_clock() when the loop was created.
+ */
+class EventLoop {
+public:
+    using Callback = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    bool addFd(int fd, uint32_t events, Callback cb);
+    bool modifyFd(int fd, uint32_t events);
+    void removeFd(int fd);
+
+    // Timers are created by the loop's clock and owned by the loop, the
+    // returned fd identifies the timer. An initial_ms of 0 disarms it.
+    int addTimer(Callback cb);
+    bool armTimer(int timer_fd, int initial_ms, int interval_ms);
+    // Fires once at an absolute time of the clock, 0 disarms the timer.
+    bool armTimerAt(int timer_fd, uint64_t monotonic_ms);
+    void removeTimer(int timer_fd);
+
+    // Events are eventfds owned by the loop which any thread may signal with
+    // notify(). Several notifications before dispatch are coalesced.
+    int addEvent(Callback cb);
+    static void notify(int event_fd);
+    void removeEvent(int event_fd);
+
+    // Dispatches events until stop() is called. Returns false on epoll failure.
+    bool run();
+    // Waits up to timeout_ms (-1 forever) for ready sources and dispatches
+    // them once. Returns the number of sources dispatched, or -1 on epoll
+    // failure.
+    int dispatch(int timeout_ms);
+    void stop();
+    // Runs fn from run() on the loop's thread.
+    void post(std::function<void()> fn);
+    // Counts the returns of epoll_wait(), set before run().
+    void setWakeupCounter(PerfCounter *counter);
+
+private:
+    struct Source {
+        Callback cb;
+        // Timer or eventfd created by the loop, drained before dispatch
+        bool owned;
+        bool timer;
+        // Distinguishes a source from an earlier one on the same fd number
+        uint32_t generation;
+    };
+
+    int addOwnedFd(int fd, Callback cb);
+    bool armClockTimer(int timer_fd, uint64_t deadline_usec, uint64_t interval_usec);
+    void removeOwnedFd(int fd);
+    void runPosted();
+    static uint64_t eventData(int fd, uint32_t generation);
+
+    Clock &mClock;
+    int mEpollFD;
+    // Wakes run() for stop() and post()
+    int mWakeFD;
+    std::atomic<bool> mStop;
+    uint32_t mGeneration;
+    PerfCounter *mWakeups;
+    std::mutex mPostedMutex;
+    std::vector<std::function<void()>> mPosted;
+    std::unordered_map<int, std::shared_ptr<Source>> mSources;
+};
+
+
+/*
+ * The event sources owned by one component.
+ *
+ * Sources are registered on the shared loop given to attach(). When built
+ * with FAM_PER_MONITOR_THREADS the group instead runs a private loop on its
+ * own thread, which keeps the old thread-per-monitor layout available for
+ * comparison. In that build the owner must protect shared state itself.
+ */
+class EventSourceGroup {
+public:
+    // wakeups counts the group's epoll wakeups when it runs its own
+    // thread, otherwise the dispatches of its sources.
+    explicit EventSourceGroup(const char *name, PerfCounter *wakeups = nullptr);
+    ~EventSourceGroup();
+
+    void attach(EventLoop &loop);
+    // Starts the private thread, no-op when sharing the caller's loop.
+    bool start();
+    // Stops the private thread and removes all sources from the loop.
+    void stop();
+
+    bool addFd(int fd, uint32_t events, EventLoop::Callback cb);
+    bool modifyFd(int fd, uint32_t events);
+    void removeFd(int fd);
+    int addTimer(EventLoop::Callback cb);
+    bool armTimer(int timer_fd, int initial_ms, int interval_ms);
+    bool armTimerAt(int timer_fd, uint64_t monotonic_ms);
+    void removeTimer(int timer_fd);
+    // Runs fn on the thread dispatching the group's sources and waits for
+    // it, so the owner may change state used by its callbacks.
+    void invoke(const std::function<void()> &fn);
+
+private:
+    EventLoop::Callback counted(EventLoop::Callback cb);
+
+    const char *mName;
+    PerfCounter *mWakeups;
+    EventLoop *mLoop;
+#ifdef FAM_PER_MONITOR_THREADS
+    std::unique_ptr<EventLoop> mOwnLoop;
+    std::thread mThread;
+#endif
+    std::vector<int> mFds;
+    std::vector<int> mTimers;
+};
@@ -0,0 +1,276 @@
+#include "flight_recorder.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <thread>
+
+#include "clock.hpp"
+
+namespace {
+const size_t words = sizeof(flight_record_t) / sizeof(uint64_t);
+
+uint64_t realtime_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        const ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+}
+
+FlightRecorder g_flight_recorder;
+
+FlightRecorder::FlightRecorder()
+: mHead(0)
+, mTrace(nullptr)
+{
+    for (auto &slot: mSlots) {
+        slot.seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+FlightRecorder::~FlightRecorder() {
+    stopTrace();
+}
+
+void
+FlightRecorder::record(flight_event event, uint32_t a, int64_t value) {
+    const flight_record_t record = {
+        .time_usec = get_clock().nowUsec(),
+        .event = event,
+        .a = a,
+        .value = value,
+    };
+    uint64_t buf[words];
+    memcpy(buf, &record, sizeof(record));
+
+    // Odd while written, 2 * (index + 1) once complete
+    const uint64_t index = mHead.fetch_add(1, std::memory_order_relaxed);
+    slot_t &slot = mSlots[index & (capacity - 1)];
+    uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+    bool claimed = false;
+    // A writer a full ring ahead may already have taken the slot, this
+    // record is the older one then
+    while (!claimed && seq <= 2 * index) {
+        // Only while a writer a full ring behind still writes the slot
+        if (seq & 1) {
+            std::this_thread::yield();
+            seq = slot.seq.load(std::memory_order_relaxed);
+            continue;
+        }
+        claimed = slot.seq.compare_exchange_weak(seq, 2 * index + 1, std::memory_order_relaxed);
+    }
+    if (claimed) {
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < words; ++i) {
+            slot.words[i].store(buf[i], std::memory_order_relaxed);
+        }
+        slot.seq.store(2 * index + 2, std::memory_order_release);
+    }
+
+    if (mTrace.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> l(mTraceMutex);
+        if (FILE *trace = mTrace.load(std::memory_order_relaxed)) {
+            fwrite(&record, sizeof(record), 1, trace);
+        }
+    }
+}
+
+std::vector<flight_record_t>
+FlightRecorder::snapshot() const {
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    const uint64_t first = head > capacity ? head - capacity : 0;
+
+    std::vector<flight_record_t> records;
+    records.reserve(head - first);
+    for (uint64_t index = first; index < head; ++index) {
+        const slot_t &slot = mSlots[index & (capacity - 1)];
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * index + 2) {
+            // Still being written or already overwritten
+            continue;
+        }
+        uint64_t buf[words];
+        for (size_t i = 0; i < words; ++i) {
+            buf[i] = slot.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+        flight_record_t record;
+        memcpy(&record, buf, sizeof(record));
+        records.push_back(record);
+    }
+    return records;
+}
+
+void
+FlightRecorder::setDumpPath(const std::string &path) {
+    mDumpPath = path;
+}
+
+bool
+FlightRecorder::dump() {
+    if (mDumpPath.empty()) {
+        errno = EINVAL;
+        return false;
+    }
+    std::lock_guard<std::mutex> l(mDumpMutex);
+    const auto records = snapshot();
+
+    flight_dump_header_t header = {};
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.record_size = sizeof(flight_record_t);
+    header.count = records.size();
+    header.realtime_usec = realtime_usec();
+    header.monotonic_usec = get_clock().nowUsec();
+
+    std::string content(reinterpret_cast<const char *>(&header), sizeof(header));
+    content.append(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(flight_record_t));
+
+    // A dump interrupted by power loss must not replace the previous one
+    const std::string tmp_path = mDumpPath + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    const size_t slash = mDumpPath.rfind('/');
+    if (fd == -1 && errno == ENOENT && slash != std::string::npos && slash > 0) {
+        // The image does not ship the default directory below /var/log
+        if (mkdir(mDumpPath.substr(0, slash).c_str(), 0755) == -1 && errno != EEXIST) {
+            return false;
+        }
+        fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd == -1) {
+        return false;
+    }
+    if (!write_all(fd, content.data(), content.size()) || fsync(fd) == -1) {
+        const int err = errno;
+        close(fd);
+        unlink(tmp_path.c_str());
+        errno = err;
+        return false;
+    }
+    close(fd);
+    return rename(tmp_path.c_str(), mDumpPath.c_str()) == 0;
+}
+
+bool
+FlightRecorder::startTrace(const std::string &path) {
+    stopTrace();
+    FILE *trace = fopen(path.c_str(), "we");
+    if (!trace) {
+        return false;
+    }
+    flight_dump_header_t header = {};
+    memcpy(header.magic, trace_magic, sizeof(header.magic));
+    header.version = version;
+    header.record_size = sizeof(flight_record_t);
+    header.realtime_usec = realtime_usec();
+    header.monotonic_usec = get_clock().nowUsec();
+    if (fwrite(&header, sizeof(header), 1, trace) != 1) {
+        const int err = errno;
+        fclose(trace);
+        errno = err;
+        return false;
+    }
+    std::lock_guard<std::mutex> l(mTraceMutex);
+    mTrace.store(trace, std::memory_order_relaxed);
+    return true;
+}
+
+void
+FlightRecorder::flushTrace() {
+    std::lock_guard<std::mutex> l(mTraceMutex);
+    if (FILE *trace = mTrace.load(std::memory_order_relaxed)) {
+        fflush(trace);
+    }
+}
+
+void
+FlightRecorder::stopTrace() {
+    std::lock_guard<std::mutex> l(mTraceMutex);
+    if (FILE *trace = mTrace.exchange(nullptr, std::memory_order_relaxed)) {
+        fclose(trace);
+    }
+}
+
+const char *flight_event_name(flight_event event) {
+    switch (event) {
+        case flight_event::BATTERY_SAMPLE:
+            return "battery-sample";
+        case flight_event::CHARGER:
+            return "charger";
+        case flight_event::INPUT_ACTIVITY:
+            return "input-activity";
+        case flight_event::NET_RATE:
+            return "net-rate";
+        case flight_event::SETTINGS_CHANGE:
+            return "settings-change";
+        case flight_event::STATE_TRANSITION:
+            return "state-transition";
+        case flight_event::TRANSITION_DONE:
+            return "transition-done";
+        case flight_event::BATTERY_RESET:
+            return "battery-reset";
+        case flight_event::SETTING:
+            return "setting";
+        case flight_event::INPUT_RESET:
+            return "input-reset";
+        case flight_event::NET_WINDOW:
+            return "net-window";
+    }
+    return "unknown";
+}
+
+bool parse_flight_dump(const char *buf, size_t len, flight_dump_header_t &header,
+                       std::vector<flight_record_t> &records) {
+    if (len < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (memcmp(header.magic, FlightRecorder::magic, sizeof(header.magic)) != 0 ||
+        header.version != FlightRecorder::version ||
+        header.record_size != sizeof(flight_record_t) ||
+        header.count > (len - sizeof(header)) / sizeof(flight_record_t)) {
+        return false;
+    }
+    records.resize(header.count);
+    memcpy(records.data(), buf + sizeof(header), header.count * sizeof(flight_record_t));
+    return true;
+}
+
+bool parse_flight_trace(const char *buf, size_t len, flight_dump_header_t &header,
+                        std::vector<flight_record_t> &records) {
+    if (len < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (memcmp(header.magic, FlightRecorder::trace_magic, sizeof(header.magic)) != 0 ||
+        header.version != FlightRecorder::version ||
+        header.record_size != sizeof(flight_record_t)) {
+        return false;
+    }
+    header.count = (len - sizeof(header)) / sizeof(flight_record_t);
+    records.resize(header.count);
+    memcpy(records.data(), buf + sizeof(header), header.count * sizeof(flight_record_t));
+    return true;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum class flight_event : uint32_t {
+    // a: capacity in percent, value: voltage in uV
+    BATTERY_SAMPLE = 1,
+    // a: 1 if online
+    CHARGER,
+    // Input status after a change, a: charger online, value: event time
+    INPUT_ACTIVITY,
+    // a: milliseconds since the previous sample, value: packets per second
+    // of the busiest interface, in thousandths
+    NET_RATE,
+    // a: settings_changes_t of the applied change
+    SETTINGS_CHANGE,
+    // a: previous state_t, value: new state_t
+    STATE_TRANSITION,
+    // a: state_t transitioned to, value: exit status of the request
+    TRANSITION_DONE,
+    // The battery sample windows were cleared
+    BATTERY_RESET,
+    // Input status set by reset(), as INPUT_ACTIVITY
+    INPUT_RESET,
+    // a: settings_field, value: the setting scaled to an integer, see
+    // record_decision_settings()
+    SETTING,
+    // Before NET_RATE with a net_activity_window, a: busy buckets << 16 |
+    // completed buckets, value: mean packets per second in thousandths
+    NET_WINDOW,
+};
+
+typedef struct {
+    // get_clock(), CLOCK_MONOTONIC in the daemon
+    uint64_t time_usec;
+    flight_event event;
+    uint32_t a;
+    int64_t value;
+} flight_record_t;
+
+static_assert(sizeof(flight_record_t) == 24, "flight records are fixed width");
+
+// Header of a dump, followed by count records from oldest to newest. A
+// trace has the trace magic, count 0 and records up to the end of file.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    // Clocks at the time of the dump, to convert record times to wall time
+    uint64_t realtime_usec;
+    uint64_t monotonic_usec;
+} flight_dump_header_t;
+
+/*
+ * Always-on in-memory ring of the most recent fixed-width records.
+ *
+ * record() claims a slot with one fetch_add, so any monitor thread may
+ * record. It only waits if a writer a full ring behind still writes the
+ * same slot, and drops its record if a newer one already took it. Every
+ * slot is guarded by its own sequence counter; a dump taken while a slot
+ * is rewritten skips that slot instead of copying a torn record.
+ */
+class FlightRecorder {
+public:
+    static constexpr size_t capacity = 4096;
+    static constexpr char magic[8] = {'F', 'A', 'M', 'F', 'L', 'I', 'T', 'E'};
+    static constexpr char trace_magic[8] = {'F', 'A', 'M', 'T', 'R', 'A', 'C', 'E'};
+    static constexpr uint32_t version = 1;
+
+    FlightRecorder();
+    ~FlightRecorder();
+
+    void record(flight_event event, uint32_t a, int64_t value = 0);
+
+    // Records currently in the ring, oldest first.
+    std::vector<flight_record_t> snapshot() const;
+
+    // Where dump() writes, empty disables dumping.
+    void setDumpPath(const std::string &path);
+    // Writes the header and snapshot() to a temporary file synced and
+    // renamed over the dump path, whose directory is created if missing.
+    // Returns false and sets errno on failure. Concurrent dumps, such as a D-Bus request during shutdown, run one
+    // after the other.
+    bool dump();
+
+    // Recording mode: every record is also appended to a trace file,
+    // serialized on a mutex and buffered. Returns false and sets errno if
+    // the file can not be created.
+    bool startTrace(const std::string &path);
+    void flushTrace();
+    void stopTrace();
+
+private:
+    struct slot_t {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> words[sizeof(flight_record_t) / sizeof(uint64_t)];
+    };
+
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of 2");
+
+    alignas(64) std::atomic<uint64_t> mHead;
+    slot_t mSlots[capacity];
+    std::string mDumpPath;
+    // Dumps share the temporary file
+    std::mutex mDumpMutex;
+    std::atomic<FILE *> mTrace;
+    std::mutex mTraceMutex;
+};
+
+// The daemon's recorder, fed by the monitors and the state evaluation.
+extern FlightRecorder g_flight_recorder;
+
+const char *flight_event_name(flight_event event);
+
+// Validates a dump read from a file and returns its records, false if the
+// buffer is not a dump of this version.
+bool parse_flight_dump(const char *buf, size_t len, flight_dump_header_t &header,
+                       std::vector<flight_record_t> &records);
+// Same for a trace, a record cut short by a crash is ignored.
+bool parse_flight_trace(const char *buf, size_t len, flight_dump_header_t &header,
+                        std::vector<flight_record_t> &records);
@@ -1,9 +1,14 @@
 #include "input_monitor.hpp"
 
+#include <algorithm>
+
 #include <unistd.h>
 #include <string.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <time.h>
 #include <sys/epoll.h>
-#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <linux/input.h>
@@ -11,187 +16,512 @@
 #include <libudev.h>
 
 #include "utils.hpp"
+#include "flight_recorder.hpp"
+#include "perf_counters.hpp"
 #include "log.hpp"
 
+// Older headers without the 32-bit time64 layout of input_event
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#endif
 
-InputMonitor::InputMonitor(const settings_t &settings)
-    : mSettings(settings)
-{
+namespace {
+// Events read per read() call
+const size_t input_batch_size = 64;
+// Disarmed devices are re-armed after at least this long
+const int min_rearm_delay_ms = 1000;
+
+std::function<bool(int fd)> input_clock_probe;
+
+void record_input_status(const input_status_t &status, flight_event event = flight_event::INPUT_ACTIVITY) {
+    g_flight_recorder.record(event, status.charger_online, status.event_time);
 }
 
-bool
-InputMonitor::start() {
-    struct events_dev {
-        int fd;
-        struct libevdev *dev;
-    };
+bool monotonic_event_times(int fd) {
+    if (input_clock_probe) {
+        return input_clock_probe(fd);
+    }
+    // Event timestamps in the clock of get_timestamp()
+    int clock = CLOCK_MONOTONIC;
+    return ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+}
+}
 
-    const int num_events = mSettings.input_event_devices.size();
-    auto devices = std::vector<struct events_dev>(num_events);
-    int epollfd = epoll_create1(0);
-    if (epollfd == -1) {
-        LOG_ERROR("input_mon: epoll_create1: '%s' (%d)", strerror(errno), errno);
-        return false;
+void set_input_clock_probe(std::function<bool(int fd)> probe) {
+    input_clock_probe = std::move(probe);
+}
+
+ssize_t drain_input_events(int fd, timestamp_t &time) {
+    struct input_event events[input_batch_size];
+    ssize_t count = 0;
+    for (;;) {
+        const ssize_t len = read(fd, events, sizeof(events));
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? count : -1;
+        }
+        if (len == 0) {
+            return -1;
+        }
+        const size_t n = len / sizeof(struct input_event);
+        if (n > 0) {
+            time = events[n - 1].input_event_sec;
+            count += n;
+            g_perf.evdev_events.add(n);
+        }
+        // A short read emptied the queue, skip the read returning EAGAIN
+        if (size_t(len) < sizeof(events)) {
+            return count;
+        }
     }
+}
 
-    struct epoll_event ev;
-    mAbortFD = eventfd(0, 0);
-    ev.events = EPOLLIN;
-    ev.data.fd = mAbortFD;
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, mAbortFD, &ev) == -1) {
-        LOG_ERROR("input_mon: epoll_ctl: abort fd: '%s' (%d)", strerror(errno), errno);
+bool input_device_matches(const settings_t &settings, const char *devnode,
+                          const std::function<const char *(const char *key)> &property) {
+    const auto &patterns = settings.input_event_devices;
+    const bool node_matches = std::any_of(patterns.begin(), patterns.end(), [devnode] (const std::string &p) {
+        return fnmatch(p.c_str(), devnode, FNM_PATHNAME) == 0;
+    });
+    if (!node_matches) {
         return false;
     }
-    /* create udev object */
-    auto udev = udev_new();
-    if (!udev) {
-        fprintf(stderr, "input_mon: Can't create udev\n");
-        return false;
+    if (settings.input_device_properties.empty()) {
+        return true;
     }
 
-    auto mon = udev_monitor_new_from_netlink(udev, "udev");
-    udev_monitor_filter_add_match_subsystem_devtype(mon, "power_supply", NULL);
-    udev_monitor_enable_receiving(mon);
-    int udev_fd = udev_monitor_get_fd(mon);
-    ev.events = EPOLLIN;
-    ev.data.fd = udev_fd;
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, udev_fd, &ev) == -1) {
-        LOG_ERROR("input_mon: epoll_ctl: udev_fd: '%s' (%d)", strerror(errno), errno);
+    // An entry without '=' only requires the property to be set
+    for (const auto &match: settings.input_device_properties) {
+        const auto eq = match.find('=');
+        const std::string key = match.substr(0, eq);
+        const char *value = property(key.c_str());
+        if (value && (eq == std::string::npos || match.compare(eq + 1, std::string::npos, value) == 0)) {
+            return true;
+        }
     }
+    return false;
+}
 
+InputMonitor::InputMonitor(settings_snapshot_t settings)
+    : mSettings(std::move(settings))
+    , mSources("input_mon", &g_perf.input_wakeups)
+    , mChargerOnline(charger_online_path(*mSettings))
+    , mUdev(nullptr)
+    , mUdevMonitor(nullptr)
+    , mRearmTimer(-1)
+    , mRearmPending(false)
+{
+}
 
-    int i = 0;
-    for (const auto e: mSettings.input_event_devices) {
-        LOG_DEBUG("input_mon: Adding input event: %s", e.c_str());
-        int rc = 1;
-        auto &dev = devices[i++];
-        dev.fd = open(e.c_str(), O_RDONLY|O_NONBLOCK);
-        if (dev.fd < 0) {
-            LOG_ERROR("input_mon: Failed to open '%s' (%s)\n", e.c_str(), strerror(errno));
+bool
+InputMonitor::start(EventLoop &loop) {
+    mSources.attach(loop);
+
+    if (filesystem_root().empty()) {
+        mUdev = udev_new();
+        if (!mUdev) {
+            LOG_ERROR("input_mon: Can't create udev");
             return false;
         }
-        rc = libevdev_new_from_fd(dev.fd, &dev.dev);
-        if (rc < 0) {
-            LOG_ERROR("input_mon: Failed to init libevdev (%s)\n", strerror(-rc));
+        mUdevMonitor = udev_monitor_new_from_netlink(mUdev, "udev");
+        if (!mUdevMonitor) {
+            LOG_ERROR("input_mon: Can't create udev monitor");
             return false;
         }
-        struct epoll_event ev;
-        ev.events = EPOLLIN;
-        ev.data.fd = dev.fd;
-        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, dev.fd, &ev) == -1) {
-            LOG_ERROR("input_mon: epoll_ctl: adding event_device: '%s' (%d)", strerror(errno), errno);
+        udev_monitor_filter_add_match_subsystem_devtype(mUdevMonitor, "input", NULL);
+        udev_monitor_enable_receiving(mUdevMonitor);
+        const int udev_fd = udev_monitor_get_fd(mUdevMonitor);
+        if (!mSources.addFd(udev_fd, EPOLLIN, [this] (uint32_t) { handleUdev(); })) {
+            LOG_ERROR("input_mon: Failed to watch udev_fd.");
             return false;
         }
+    } else {
+        LOG_INFO("input_mon: Scanning devices below '%s' without hotplug.", filesystem_root().c_str());
+    }
 
+    mRearmTimer = mSources.addTimer([this] (uint32_t) {
+        mRearmPending = false;
+        rearmDevices();
+    });
+    if (mRearmTimer == -1) {
+        LOG_ERROR("input_mon: Failed to create re-arm timer.");
+        return false;
+    }
+
+    // Devices added between enabling the monitor and the scan are reported
+    // twice, openDevice() ignores the second one.
+    rescan();
+    if (mDevices.empty()) {
+        LOG_WARNING("input_mon: No matching input devices present.");
     }
 
     reset();
 
-    mThread = std::thread([this, epollfd, udev_fd, num_events, devices, udev, mon] () {
-    int rc = 1;
-    bool stop_thread = false;
-    do {
-        bool charger_online = false;
-        bool charger_online_changed = false;
-        bool activity = false;
-        struct epoll_event ep_events[num_events];
-        int nfds = epoll_wait(epollfd, ep_events, num_events, -1);
-        if (nfds == 0) {
-            continue;
+    return mSources.start();
+}
+
+bool
+InputMonitor::deviceMatches(struct udev_device *dev) {
+    const char *devnode = udev_device_get_devnode(dev);
+    if (!devnode) {
+        return false;
+    }
+    return input_device_matches(*mSettings, devnode, [dev] (const char *key) {
+        return udev_device_get_property_value(dev, key);
+    });
+}
+
+void
+InputMonitor::rescan() {
+    std::vector<std::string> found;
+    if (mUdev) {
+        enumerateUdev(found);
+    } else {
+        globDevices(found);
+    }
+
+    std::vector<std::string> stale;
+    for (const auto &dev: mDevices) {
+        if (std::find(found.begin(), found.end(), dev.path) == found.end()) {
+            stale.push_back(dev.path);
         }
-        if (nfds == -1) {
-            if (errno != EINTR) {
-                LOG_ERROR("input_mon: epoll_wait: '%s' (%d)", strerror(errno), errno);
-            }
+    }
+    for (const auto &path: stale) {
+        closeDevice(path);
+    }
+    for (const auto &path: found) {
+        openDevice(path);
+    }
+}
+
+void
+InputMonitor::enumerateUdev(std::vector<std::string> &found) {
+    const auto enumerate = udev_enumerate_new(mUdev);
+    if (!enumerate) {
+        LOG_ERROR("input_mon: Can't enumerate input devices");
+        return;
+    }
+    udev_enumerate_add_match_subsystem(enumerate, "input");
+    udev_enumerate_scan_devices(enumerate);
+    struct udev_list_entry *entry;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+        const auto dev = udev_device_new_from_syspath(mUdev, udev_list_entry_get_name(entry));
+        if (!dev) {
             continue;
         }
-
-        for (int n = 0; n < nfds; ++n) {
-            if (ep_events[n].data.fd == mAbortFD) {
-                stop_thread = true;
-                break;
-            }
-            if (ep_events[n].data.fd == udev_fd) {
-                const auto ps = udev_monitor_receive_device(mon);
-                std::string device_name = udev_device_get_sysname(ps);
-                if (device_name == mSettings.charger_name) {
-                    int online = atoi(udev_device_get_sysattr_value(ps, "online"));
-                    charger_online = (online == 1);
-                    charger_online_changed = true;
-                    // online state of power supply counts as activity as well
-                    activity = true;
-                    LOG_DEBUG("Power supply is %s.\n", charger_online?"ONLINE":"OFFLINE");
-                }
-            }
-            for (const auto dev: devices) {
-                if (dev.fd == ep_events[n].data.fd) {
-                    LOG_DEBUG("Got input event on: %d", ep_events[n].data.fd);
-                    activity = true;
-                    struct input_event ev;
-                    while((rc = libevdev_next_event(dev.dev, LIBEVDEV_READ_FLAG_NORMAL, &ev)) == 0) {
-                        // Empty evdev events for device.
-                    }
-                }
-            }
+        if (deviceMatches(dev)) {
+            found.push_back(udev_device_get_devnode(dev));
         }
+        udev_device_unref(dev);
+    }
+    udev_enumerate_unref(enumerate);
+}
 
-        if (stop_thread) {
-            break;
+void
+InputMonitor::globDevices(std::vector<std::string> &found) {
+    // There are no udev properties to match below the filesystem root
+    for (const auto &pattern: mSettings->input_event_devices) {
+        glob_t g;
+        if (glob(root_path(pattern).c_str(), 0, nullptr, &g) != 0) {
+            continue;
         }
+        for (size_t i = 0; i < g.gl_pathc; ++i) {
+            if (std::find(found.begin(), found.end(), g.gl_pathv[i]) == found.end()) {
+                found.push_back(g.gl_pathv[i]);
+            }
+        }
+        globfree(&g);
+    }
+}
 
-        if (activity) {
-            const auto timestamp = get_timestamp();
-            std::lock_guard<std::mutex> guard(mMutex);
-            mLastInputData.event_time = timestamp;
-            if (charger_online_changed) {
-                mLastInputData.charger_online = charger_online;
+void
+InputMonitor::handleUdev() {
+    const auto dev = udev_monitor_receive_device(mUdevMonitor);
+    if (!dev) {
+        return;
+    }
+    g_perf.udev_received.add();
+    const char *action = udev_device_get_action(dev);
+    const char *devnode = udev_device_get_devnode(dev);
+    bool handled = false;
+    if (action && devnode) {
+        if (strcmp(action, "add") == 0 && deviceMatches(dev)) {
+            // Plugging in a device is activity as well
+            if (openDevice(devnode)) {
+                updateStatus(false, false);
             }
+            handled = true;
+        } else if (strcmp(action, "remove") == 0) {
+            closeDevice(devnode);
+            handled = true;
         }
-    } while (true);
-    if (epollfd >= 0) {
-        close(epollfd);
     }
-    for (const auto dev: devices) {
-        if (dev.fd >= 0) {
+    if (!handled) {
+        g_perf.udev_filtered.add();
+    }
+    udev_device_unref(dev);
+}
+
+bool
+InputMonitor::openDevice(const std::string &path) {
+    const bool open = std::any_of(mDevices.begin(), mDevices.end(), [&path] (const events_dev &dev) {
+        return dev.path == path;
+    });
+    if (open) {
+        return false;
+    }
+
+    events_dev dev = { path, -1, nullptr, true, false };
+    dev.fd = ::open(path.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    if (dev.fd < 0) {
+        LOG_ERROR("input_mon: Failed to open '%s' (%s)", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (mSettings->input_coalescing) {
+        dev.kernel_clock = monotonic_event_times(dev.fd);
+    } else {
+        int rc = libevdev_new_from_fd(dev.fd, &dev.dev);
+        if (rc < 0) {
+            LOG_ERROR("input_mon: Failed to init libevdev (%s)", strerror(-rc));
             close(dev.fd);
+            return false;
         }
+    }
+    const int fd = dev.fd;
+    // Without event times in our clock activity found on re-arm could not
+    // be dated, such devices stay level-triggered.
+    const uint32_t events = dev.kernel_clock ? EPOLLIN | EPOLLONESHOT : EPOLLIN;
+    if (!mSources.addFd(fd, events, [this, fd] (uint32_t events) { handleInput(fd, events); })) {
+        LOG_ERROR("input_mon: Failed to watch event device '%s'.", path.c_str());
         if (dev.dev) {
             libevdev_free(dev.dev);
         }
+        close(dev.fd);
+        return false;
     }
-    if (mon) {
-        udev_monitor_unref(mon);
+    mDevices.push_back(dev);
+    LOG_INFO("input_mon: Monitoring input device '%s'.", path.c_str());
+    return true;
+}
+
+void
+InputMonitor::closeDevice(const std::string &path) {
+    const auto it = std::find_if(mDevices.begin(), mDevices.end(), [&path] (const events_dev &dev) {
+        return dev.path == path;
+    });
+    if (it == mDevices.end()) {
+        return;
     }
-    if(udev) {
-        udev_unref(udev);
+    LOG_INFO("input_mon: Removing input device '%s'.", path.c_str());
+    mSources.removeFd(it->fd);
+    if (it->dev) {
+        libevdev_free(it->dev);
     }
+    close(it->fd);
+    mDevices.erase(it);
+}
+
+void
+InputMonitor::applySettings(settings_snapshot_t settings, settings_changes_t changes) {
+    const settings_changes_t devices =
+        settings_change(settings_field::INPUT_DEVICES) |
+        settings_change(settings_field::INPUT_PROPERTIES);
+
+    const settings_changes_t limits =
+        settings_change(settings_field::INACT_ON_BAT_LIMIT) |
+        settings_change(settings_field::INACT_ON_CHARGER_LIMIT) |
+        settings_change(settings_field::ENABLED_SLEEP);
 
+    mSources.invoke([&] () {
+        mSettings = std::move(settings);
+        if (changes & settings_change(settings_field::NAME_CHARGER)) {
+            mChargerOnline.setPath(charger_online_path(*mSettings));
+        }
+        if (mRearmTimer == -1) {
+            // Not started
+            return;
+        }
+        if (changes & settings_change(settings_field::INPUT_COALESCING)) {
+            while (!mDevices.empty()) {
+                closeDevice(mDevices.back().path);
+            }
+        }
+        if (changes & (devices | settings_change(settings_field::INPUT_COALESCING))) {
+            rescan();
+        }
+        // Queued activity may matter for a shorter deadline, the state is
+        // evaluated right after this returns.
+        if (changes & limits) {
+            rearmDevices();
+        }
+    });
+}
+
+void
+InputMonitor::chargerChanged(bool online) {
+    // online state of power supply counts as activity as well
+    updateStatus(true, online);
+    if (mStatusListener) {
+        mStatusListener();
     }
-    );
+}
 
-    return true;
+void
+InputMonitor::handleInput(int fd, uint32_t events) {
+    const auto it = std::find_if(mDevices.begin(), mDevices.end(), [fd] (const events_dev &dev) {
+        return dev.fd == fd;
+    });
+    if (it == mDevices.end()) {
+        return;
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        // Unplugged, the udev remove event may still be queued
+        closeDevice(it->path);
+        return;
+    }
+
+    LOG_DEBUG("Got input event on: %d", fd);
+    if (!it->dev) {
+        drainDevice(*it);
+        return;
+    }
+    struct input_event ev;
+    while (libevdev_next_event(it->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev) == 0) {
+        // Empty evdev events for device.
+        g_perf.evdev_events.add();
+    }
+    updateStatus(false, false);
+}
+
+void
+InputMonitor::drainDevice(events_dev &dev) {
+    timestamp_t time = 0;
+    const ssize_t count = drain_input_events(dev.fd, time);
+    if (count == -1) {
+        closeDevice(dev.path);
+        return;
+    }
+    if (!dev.kernel_clock) {
+        // Level-triggered, the events were just read
+        if (count > 0) {
+            updateEventTime(get_timestamp());
+        }
+        return;
+    }
+    // EPOLLONESHOT disarmed the fd, it stays quiet until rearmDevices()
+    dev.armed = false;
+    if (count > 0) {
+        updateEventTime(time);
+    }
+    if (!mRearmPending) {
+        mRearmPending = mSources.armTimer(mRearmTimer, rearmDelayMs(), 0);
+    }
+}
+
+void
+InputMonitor::rearmDevices() {
+    std::vector<std::string> failed;
+    for (auto &dev: mDevices) {
+        if (dev.armed) {
+            continue;
+        }
+        // Activity while disarmed is waiting in the kernel queue. Events
+        // arriving after the drain make the modified fd ready at once.
+        timestamp_t time = 0;
+        const ssize_t count = drain_input_events(dev.fd, time);
+        if (count == -1) {
+            failed.push_back(dev.path);
+            continue;
+        }
+        if (count > 0) {
+            updateEventTime(time);
+        }
+        dev.armed = mSources.modifyFd(dev.fd, EPOLLIN | EPOLLONESHOT);
+    }
+    for (const auto &path: failed) {
+        closeDevice(path);
+    }
+}
+
+int
+InputMonitor::rearmDelayMs() const {
+    int limit = 0;
+    for (const int l: { mSettings->inactive_on_battery_limit, mSettings->inactive_on_charger_limit }) {
+        if (l > 0 && (limit == 0 || l < limit)) {
+            limit = l;
+        }
+    }
+    if (!mSettings->sleep_enabled || limit == 0) {
+        return min_rearm_delay_ms;
+    }
+    // The idle time is only needed at the deadline one second after the
+    // limit, re-arm a second before the limit to stay clear of rounding.
+    const int64_t rearm = int64_t(mLastInputData.load().event_time) + limit - 1;
+    const int64_t delay_ms = (rearm - int64_t(get_timestamp())) * 1000;
+    return int(std::max<int64_t>(delay_ms, min_rearm_delay_ms));
+}
+
+void
+InputMonitor::updateStatus(bool charger_online_changed, bool charger_online) {
+    const auto timestamp = get_timestamp();
+    input_status_t updated;
+    mLastInputData.update([&] (input_status_t &status) {
+        status.event_time = timestamp;
+        if (charger_online_changed) {
+            status.charger_online = charger_online;
+        }
+        updated = status;
+    });
+    // Outside the write section, readers would spin while it records
+    record_input_status(updated);
+}
+
+void
+InputMonitor::updateEventTime(timestamp_t timestamp) {
+    input_status_t updated;
+    mLastInputData.update([&] (input_status_t &status) {
+        // Queued events may predate a reset()
+        if (timestamp > status.event_time) {
+            status.event_time = timestamp;
+        }
+        updated = status;
+    });
+    record_input_status(updated);
 }
 
 InputMonitor::~InputMonitor() {
-    if (mAbortFD >= 0) {
-        uint64_t v = 1;
-        write(mAbortFD, &v, sizeof(v));
-        if (mThread.joinable()) {
-            mThread.join();
+    mSources.stop();
+    for (const auto &dev: mDevices) {
+        if (dev.dev) {
+            libevdev_free(dev.dev);
         }
-        close(mAbortFD);
+        close(dev.fd);
+    }
+    if (mUdevMonitor) {
+        udev_monitor_unref(mUdevMonitor);
+    }
+    if (mUdev) {
+        udev_unref(mUdev);
     }
 }
 
+void
+InputMonitor::setStatusListener(std::function<void()> listener) {
+    mStatusListener = std::move(listener);
+}
+
 input_status_t
 InputMonitor::getStatus() {
-    std::lock_guard<std::mutex> guard(mMutex);
-    return mLastInputData;
+    return mLastInputData.load();
 }
 
 void
 InputMonitor::reset() {
-    std::lock_guard<std::mutex> guard(mMutex);
-    mLastInputData.event_time = get_timestamp();
-    mLastInputData.charger_online = get_charger_online(mSettings);
+    const input_status_t status = {
+        .event_time = get_timestamp(),
+        .charger_online = mChargerOnline.readInt(-1) == 1,
+    };
+    mLastInputData.store(status);
+    record_input_status(status, flight_event::INPUT_RESET);
 }
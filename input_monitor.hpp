@@ -1,25 +1,103 @@
 #pragma once
 
-#include <thread>
-#include <mutex>
+#include <functional>
+#include <sys/types.h>
+#include <string>
 #include <vector>
 
 #include "types.hpp"
-#include "rolling_window.hpp"
+#include "event_loop.hpp"
+#include "seqlock.hpp"
+#include "sysfs_attribute.hpp"
 
+struct libevdev;
+struct udev;
+struct udev_monitor;
+struct udev_device;
 
+// True if devnode matches one of the input_event_devices patterns (globs
+// such as "/dev/input/event*") and, when input_device_properties is set,
+// property(KEY) equals VALUE for one of its "KEY=VALUE" entries.
+bool input_device_matches(const settings_t &settings, const char *devnode,
+                          const std::function<const char *(const char *key)> &property);
+
+// Reads all queued input_events of fd in large batches. Returns the number
+// of events read, or -1 if the device failed (e.g. was unplugged). time is
+// set to the timestamp (seconds) of the last event read.
+ssize_t drain_input_events(int fd, timestamp_t &time);
+
+// Decides whether the events read from a device fd are stamped in the
+// clock of get_timestamp(), which EPOLLONESHOT coalescing requires. The
+// default switches the device to CLOCK_MONOTONIC with EVIOCSCLOCKID. Tests
+// writing stamped events to FIFOs install their own, nullptr restores the
+// default. Set before the monitor opens its devices.
+void set_input_clock_probe(std::function<bool(int fd)> probe);
+
+/*
+ * Monitors activity on the input devices.
+ *
+ * Devices are discovered through udev in the input subsystem and added or
+ * removed as they are plugged, a configured device that is absent is
+ * simply not monitored until it appears. Below a filesystem root the
+ * patterns are globbed once instead, e.g. matching FIFOs which a test
+ * writes input_events to.
+ *
+ * With input_coalescing a device is armed with EPOLLONESHOT. After a burst
+ * it stays disarmed until shortly before the idle deadline, activity in
+ * between is found in the kernel queue on re-arm and timestamped with the
+ * monotonic time of the last event. Devices that cannot report monotonic
+ * event times stay level-triggered.
+ */
 class InputMonitor {
 public:
-    explicit InputMonitor(const settings_t &settings);
+    explicit InputMonitor(settings_snapshot_t settings);
     ~InputMonitor();
     input_status_t getStatus();
-    bool start();
+    bool start(EventLoop &loop);
     void reset();
+    // Applies changed settings, only devices that stop or start matching
+    // are closed or opened. The idle time is kept.
+    void applySettings(settings_snapshot_t settings, settings_changes_t changes);
+    // Called when the status changes in a way the state evaluation cannot
+    // predict from time alone. May be called from the monitor's own thread.
+    void setStatusListener(std::function<void()> listener);
+    // Charger online changes are reported by the battery monitor and count
+    // as activity as well.
+    void chargerChanged(bool online);
 
 private:
-    settings_t mSettings;
-    std::mutex mMutex;
-    std::thread mThread;
-    int mAbortFD;
-    input_status_t mLastInputData;
+    struct events_dev {
+        std::string path;
+        int fd;
+        // Only used without input_coalescing
+        struct libevdev *dev;
+        bool armed;
+        // Event times are CLOCK_MONOTONIC, required for EPOLLONESHOT
+        bool kernel_clock;
+    };
+
+    void rescan();
+    void enumerateUdev(std::vector<std::string> &found);
+    void globDevices(std::vector<std::string> &found);
+    bool deviceMatches(struct udev_device *dev);
+    bool openDevice(const std::string &path);
+    void closeDevice(const std::string &path);
+    void handleUdev();
+    void handleInput(int fd, uint32_t events);
+    void drainDevice(events_dev &dev);
+    void rearmDevices();
+    int rearmDelayMs() const;
+    void updateStatus(bool charger_online_changed, bool charger_online);
+    void updateEventTime(timestamp_t timestamp);
+
+    settings_snapshot_t mSettings;
+    std::function<void()> mStatusListener;
+    EventSourceGroup mSources;
+    SysfsAttribute mChargerOnline;
+    struct udev *mUdev;
+    struct udev_monitor *mUdevMonitor;
+    std::vector<events_dev> mDevices;
+    int mRearmTimer;
+    bool mRearmPending;
+    SeqLock<input_status_t> mLastInputData;
 };
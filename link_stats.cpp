@@ -0,0 +1,198 @@
+#include "link_stats.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <fnmatch.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+bool net_device_matches(const std::vector<std::string> &patterns, const char *name) {
+    for (const auto &p: patterns) {
+        if (fnmatch(p.c_str(), name, 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_link_message(const struct nlmsghdr *nlh, link_msg_t &link) {
+    if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK) {
+        return false;
+    }
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+        return false;
+    }
+
+    const auto ifi = static_cast<const struct ifinfomsg *>(NLMSG_DATA(nlh));
+    link.index = ifi->ifi_index;
+    link.name = nullptr;
+    link.has_stats = false;
+    link.tx_packets = 0;
+    link.rx_packets = 0;
+
+    bool has_stats64 = false;
+    int len = IFLA_PAYLOAD(nlh);
+    for (auto rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+        case IFLA_IFNAME:
+            if (strnlen(static_cast<const char *>(RTA_DATA(rta)), RTA_PAYLOAD(rta)) < RTA_PAYLOAD(rta)) {
+                link.name = static_cast<const char *>(RTA_DATA(rta));
+            }
+            break;
+        case IFLA_STATS64:
+            if (RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats64)) {
+                struct rtnl_link_stats64 stats;
+                memcpy(&stats, RTA_DATA(rta), sizeof(stats));
+                link.tx_packets = stats.tx_packets;
+                link.rx_packets = stats.rx_packets;
+                link.has_stats = true;
+                has_stats64 = true;
+            }
+            break;
+        case IFLA_STATS:
+            if (!has_stats64 && RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats)) {
+                struct rtnl_link_stats stats;
+                memcpy(&stats, RTA_DATA(rta), sizeof(stats));
+                link.tx_packets = stats.tx_packets;
+                link.rx_packets = stats.rx_packets;
+                link.has_stats = true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return link.name != nullptr;
+}
+
+LinkTable::LinkTable(const std::vector<std::string> &patterns)
+: mPatterns(patterns)
+, mWindowSec(0)
+, mBusyRate(0)
+{
+}
+
+void
+LinkTable::setWindow(int window_sec, double busy_rate) {
+    mWindowSec = window_sec;
+    mBusyRate = busy_rate;
+    for (auto &l: mLinks) {
+        l.second.history.setWindow(mWindowSec, mBusyRate);
+    }
+}
+
+void
+LinkTable::setPatterns(const std::vector<std::string> &patterns) {
+    mPatterns = patterns;
+    for (auto &l: mLinks) {
+        l.second.matched = net_device_matches(mPatterns, l.second.name.c_str());
+    }
+}
+
+void
+LinkTable::beginDump() {
+    for (auto &l: mLinks) {
+        l.second.seen = false;
+    }
+}
+
+void
+LinkTable::endDump() {
+    for (auto it = mLinks.begin(); it != mLinks.end();) {
+        if (!it->second.seen) {
+            it = mLinks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool
+LinkTable::update(const link_msg_t &link) {
+    const uint64_t packets = link.tx_packets + link.rx_packets;
+    auto it = mLinks.find(link.index);
+    if (it == mLinks.end()) {
+        // New interfaces start from their current counters
+        const bool matched = net_device_matches(mPatterns, link.name);
+        auto &entry = mLinks.emplace(link.index, link_entry_t{link.name, matched, true, packets, packets, {}})
+            .first->second;
+        entry.history.setWindow(mWindowSec, mBusyRate);
+        return matched;
+    }
+
+    auto &entry = it->second;
+    entry.seen = true;
+    if (link.has_stats) {
+        entry.packets = packets;
+    }
+    if (entry.name != link.name) {
+        entry.name = link.name;
+        const bool matched = entry.matched;
+        entry.matched = net_device_matches(mPatterns, link.name);
+        if (!matched && entry.matched) {
+            entry.prev_packets = entry.packets;
+            entry.history.clear();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+LinkTable::remove(int index) {
+    const auto it = mLinks.find(index);
+    if (it == mLinks.end()) {
+        return false;
+    }
+    const bool matched = it->second.matched;
+    mLinks.erase(it);
+    return matched;
+}
+
+uint64_t
+LinkTable::maxPacketsSinceLastSample(uint64_t start_usec, uint64_t end_usec) {
+    uint64_t max_packets = 0;
+    for (auto &l: mLinks) {
+        auto &entry = l.second;
+        if (!entry.matched) {
+            continue;
+        }
+        // Counters restart from zero if the driver resets them
+        const uint64_t diff = entry.packets >= entry.prev_packets ?
+            entry.packets - entry.prev_packets : entry.packets;
+        entry.prev_packets = entry.packets;
+        max_packets = std::max(max_packets, diff);
+        entry.history.add(start_usec, end_usec, diff);
+    }
+    return max_packets;
+}
+
+void
+LinkTable::windowStatus(network_status_t &status) const {
+    status.window_traffic = 0;
+    status.window_buckets = 0;
+    status.busy_buckets = 0;
+    for (const auto &l: mLinks) {
+        const auto &entry = l.second;
+        if (!entry.matched) {
+            continue;
+        }
+        const auto &history = entry.history;
+        status.window_traffic = std::max(status.window_traffic, history.meanRate());
+        // Largest busy share, compared without dividing
+        if (uint64_t(history.busyBuckets()) * std::max<uint32_t>(status.window_buckets, 1) >
+            uint64_t(status.busy_buckets) * std::max<uint32_t>(history.windowBuckets(), 1)) {
+            status.window_buckets = history.windowBuckets();
+            status.busy_buckets = history.busyBuckets();
+        }
+    }
+}
+
+size_t
+LinkTable::matchingLinks() const {
+    return std::count_if(mLinks.cbegin(), mLinks.cend(),
+            [](const std::pair<const int, link_entry_t> &l) { return l.second.matched; });
+}
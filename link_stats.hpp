@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.hpp"
+#include "activity_history.hpp"
+
+struct nlmsghdr;
+
+typedef struct {
+    int index;
+    const char *name;
+    bool has_stats;
+    uint64_t tx_packets;
+    uint64_t rx_packets;
+} link_msg_t;
+
+// True if name matches one of the net_devices entries, which may be glob
+// patterns such as "wlan*".
+bool net_device_matches(const std::vector<std::string> &patterns, const char *name);
+
+// Extracts ifindex, name and IFLA_STATS64 (or IFLA_STATS) packet counters from
+// an RTM_NEWLINK/RTM_DELLINK message. Returns false for other messages.
+bool parse_link_message(const struct nlmsghdr *nlh, link_msg_t &link);
+
+/*
+ * Packet counters of the interfaces matching the net_devices patterns,
+ * keyed by ifindex. Fed from RTM_GETLINK dumps and link notifications so
+ * interfaces may come and go at runtime. Every interface keeps an
+ * ActivityHistory of its samples.
+ */
+class LinkTable {
+public:
+    explicit LinkTable(const std::vector<std::string> &patterns);
+
+    void setPatterns(const std::vector<std::string> &patterns);
+
+    // Interfaces not updated between beginDump() and endDump() are dropped.
+    void beginDump();
+    void endDump();
+
+    // Returns true if the interface is new or renamed and matches a pattern.
+    bool update(const link_msg_t &link);
+    // Returns true if a matching interface was removed.
+    bool remove(int index);
+
+    // Window of the interfaces' histories, see ActivityHistory::setWindow().
+    void setWindow(int window_sec, double busy_rate);
+
+    // tx + rx packets of the busiest matching interface since the last call.
+    // With a span, every interface's packets are added to its history.
+    uint64_t maxPacketsSinceLastSample(uint64_t start_usec = 0, uint64_t end_usec = 0);
+    // Sets the window fields of status from the histories.
+    void windowStatus(network_status_t &status) const;
+
+    size_t matchingLinks() const;
+
+private:
+    struct link_entry_t {
+        std::string name;
+        bool matched;
+        bool seen;
+        uint64_t packets;
+        uint64_t prev_packets;
+        ActivityHistory history;
+    };
+
+    std::vector<std::string> mPatterns;
+    int mWindowSec;
+    double mBusyRate;
+    std::unordered_map<int, link_entry_t> mLinks;
+};
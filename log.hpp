@@ -2,27 +2,21 @@
 
 #include "logger.hpp"
 
-#define LOG_ERROR(...) \
-    do { \
-        logger_log(log_level_t::ERROR, __VA_ARGS__); \
-    } while(0)
-
-#define LOG_WARNING(...) \
-    do { \
-        logger_log(log_level_t::WARNING, __VA_ARGS__); \
-    } while(0)
+// Least severe level compiled in, see FAM_LOG_MIN_LEVEL in CMakeLists.txt.
+// Call sites above it are removed along with their arguments.
+#ifndef FAM_LOG_MIN_LEVEL
+#define FAM_LOG_MIN_LEVEL 5
+#endif
 
-#define LOG_NOTICE(...) \
+#define LOG_AT(level, ...) \
     do { \
-        logger_log(log_level_t::NOTICE, __VA_ARGS__); \
+        if (static_cast<int>(level) <= FAM_LOG_MIN_LEVEL && logger_enabled(level)) { \
+            logger_log(level, __VA_ARGS__); \
+        } \
     } while(0)
 
-#define LOG_INFO(...) \
-    do { \
-        logger_log(log_level_t::INFO, __VA_ARGS__); \
-    } while(0)
-
-#define LOG_DEBUG(...) \
-    do { \
-        logger_log(log_level_t::DEBUG, __VA_ARGS__); \
-    } while(0)
+#define LOG_ERROR(...) LOG_AT(log_level_t::ERROR, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(log_level_t::WARNING, __VA_ARGS__)
+#define LOG_NOTICE(...) LOG_AT(log_level_t::NOTICE, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(log_level_t::INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(log_level_t::DEBUG, __VA_ARGS__)
@@ -3,12 +3,49 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <cassert>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <systemd/sd-journal.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "mpsc_ring.hpp"
 
 namespace {
-    log_level_t g_log_level = log_level_t::INFO;
+    // Longer messages are truncated
+    const size_t max_message_size = 240;
+    const size_t ring_size = 256;
+    // Upper bound, a stuck syslog must not hang the shutdown path
+    const auto flush_timeout = std::chrono::seconds(2);
+
+    typedef struct {
+        log_level_t level;
+        pid_t tid;
+        uint64_t time_usec;
+        char message[max_message_size];
+    } log_record_t;
+
     log_type_t g_log_type = log_type_t::SYSLOG;
+    log_overflow_t g_overflow = log_overflow_t::DROP;
+
+    MpscRing<log_record_t, ring_size> g_ring;
+    std::atomic<bool> g_running(false);
+    std::atomic<bool> g_stop(false);
+    std::atomic<bool> g_consumer_sleeping(false);
+    std::atomic<uint64_t> g_dropped(0);
+    std::mutex g_mutex;
+    std::condition_variable g_consumer_cv;
+    std::condition_variable g_flushed_cv;
+    std::thread g_consumer;
 
     int log_level_to_syslog(log_level_t log_level) {
         switch(log_level) {
@@ -35,47 +72,206 @@ namespace {
         assert(false);
         return -1;
     }
+
+    pid_t current_tid() {
+        static thread_local const pid_t tid = syscall(SYS_gettid);
+        return tid;
+    }
+
+    uint64_t realtime_usec() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    void format_record(log_record_t &record, log_level_t log_level, const char *fmt, va_list ap) {
+        record.level = log_level;
+        record.tid = current_tid();
+        record.time_usec = realtime_usec();
+        vsnprintf(record.message, sizeof(record.message), fmt, ap);
+    }
+
+    void write_record(const log_record_t &record) {
+        switch (g_log_type) {
+            case log_type_t::SYSLOG:
+                syslog(log_level_to_syslog(record.level), "%s", record.message);
+            break;
+            case log_type_t::PRINTF:
+                fputs(record.message, stdout);
+                fputc('\n', stdout);
+            break;
+            case log_type_t::JOURNAL:
+                // The time of the call, the journal's own timestamp is the
+                // time the backend wrote it.
+                sd_journal_send("MESSAGE=%s", record.message,
+                                "PRIORITY=%d", log_level_to_syslog(record.level),
+                                "SYSLOG_IDENTIFIER=flir-activity-monitor",
+                                "TID=%d", int(record.tid),
+                                "FAM_LOG_TIME_USEC=%llu", static_cast<unsigned long long>(record.time_usec),
+                                NULL);
+            break;
+        }
+    }
+
+    void wake_consumer() {
+        // Pairs with the fence in consume(), either the consumer sees the
+        // new record or we see it sleeping.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (g_consumer_sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> l(g_mutex);
+            g_consumer_cv.notify_one();
+        }
+    }
+
+    void consume() {
+        for (;;) {
+            while (g_ring.tryPop(write_record)) {
+            }
+            const uint64_t dropped = g_dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped) {
+                log_record_t record = {};
+                record.level = log_level_t::WARNING;
+                record.tid = current_tid();
+                record.time_usec = realtime_usec();
+                snprintf(record.message, sizeof(record.message),
+                         "logger: %llu messages dropped", static_cast<unsigned long long>(dropped));
+                write_record(record);
+            }
+            if (g_log_type == log_type_t::PRINTF) {
+                fflush(stdout);
+            }
+
+            std::unique_lock<std::mutex> l(g_mutex);
+            g_flushed_cv.notify_all();
+            if (g_stop && !g_ring.readable()) {
+                return;
+            }
+            g_consumer_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // No timeout, wake_consumer() notifies once it sees us sleeping
+            g_consumer_cv.wait(l, [] () { return g_ring.readable() || g_stop; });
+            g_consumer_sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
 };
 
 
-void logger_setup(log_type_t type, log_level_t level) {
+std::atomic<log_level_t> g_logger_level(log_level_t::INFO);
+
+void logger_set_level(log_level_t level) {
+    g_logger_level.store(level, std::memory_order_relaxed);
+}
+
+bool parse_log_type(const char *name, log_type_t &type) {
+    static const struct {
+        const char *name;
+        log_type_t type;
+    } types[] = {
+        {"syslog", log_type_t::SYSLOG},
+        {"printf", log_type_t::PRINTF},
+        {"stdout", log_type_t::PRINTF},
+        {"journal", log_type_t::JOURNAL},
+    };
+    for (const auto &t: types) {
+        if (strcasecmp(name, t.name) == 0) {
+            type = t.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_log_level(const char *name, log_level_t &level) {
+    static const struct {
+        const char *name;
+        log_level_t level;
+    } levels[] = {
+        {"fatal", log_level_t::FATAL},
+        {"error", log_level_t::ERROR},
+        {"warning", log_level_t::WARNING},
+        {"notice", log_level_t::NOTICE},
+        {"info", log_level_t::INFO},
+        {"debug", log_level_t::DEBUG},
+    };
+    for (const auto &l: levels) {
+        if (strcasecmp(name, l.name) == 0) {
+            level = l.level;
+            return true;
+        }
+    }
+    return false;
+}
+
+void logger_setup(log_type_t type, log_level_t level, log_overflow_t overflow) {
+    static bool registered = false;
+    if (!registered) {
+        // Joins the backend on every exit path of the program
+        atexit(logger_shutdown);
+        registered = true;
+    }
+    logger_shutdown();
     g_log_type = type;
-    g_log_level = level;
+    logger_set_level(level);
+    g_overflow = overflow;
+    g_stop = false;
+    g_consumer = std::thread(consume);
+    g_running = true;
 }
 
 void logger_log(log_level_t log_level, const char *fmt, ...) {
-    if (log_level > g_log_level) {
+    if (!logger_enabled(log_level)) {
         return;
     }
 
-    switch (g_log_type) {
-        case log_type_t::SYSLOG:
-        {
-            va_list ap;
-            va_start(ap, fmt);
-            vsyslog(log_level_to_syslog(log_level), fmt, ap);
-            va_end(ap);
+    va_list ap;
+    va_start(ap, fmt);
+    if (!g_running.load(std::memory_order_acquire)) {
+        // No backend thread (yet), e.g. in tests and tools
+        log_record_t record;
+        format_record(record, log_level, fmt, ap);
+        write_record(record);
+        if (g_log_type == log_type_t::PRINTF) {
+            fflush(stdout);
         }
-        break;
-        case log_type_t::PRINTF:
-        {
-            va_list ap;
-            va_start(ap, fmt);
-            const int len = strlen(fmt);
-            char fmt_newline[len + 2];
-            memcpy(fmt_newline, fmt, len);
-            memcpy(fmt_newline + len, "\n", 2);
-            vprintf(fmt_newline, ap);
+        va_end(ap);
+        return;
+    }
+
+    const auto fill = [&] (log_record_t &record) { format_record(record, log_level, fmt, ap); };
+    while (!g_ring.tryPush(fill)) {
+        if (g_overflow == log_overflow_t::DROP) {
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
             va_end(ap);
+            return;
         }
-        break;
+        wake_consumer();
+        std::this_thread::yield();
     }
+    va_end(ap);
+    wake_consumer();
 }
 
-// Log data-collection statistics
-void logger_stat(const char *eventid)
-{
-    char buff[256];
-    snprintf(buff, sizeof(buff), "/usr/bin/collect-statistics --event-id %s --field event-source=flir-activity-monitor --field event-type=info", eventid);
-    system(buff);
+void logger_flush() {
+    if (!g_running.load(std::memory_order_acquire)) {
+        return;
+    }
+    const size_t target = g_ring.pushed();
+    {
+        std::lock_guard<std::mutex> l(g_mutex);
+        g_consumer_cv.notify_one();
+    }
+    std::unique_lock<std::mutex> l(g_mutex);
+    g_flushed_cv.wait_for(l, flush_timeout, [target] () { return g_ring.popped() >= target; });
+}
+
+void logger_shutdown() {
+    if (!g_running.exchange(false)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l(g_mutex);
+        g_stop = true;
+        g_consumer_cv.notify_one();
+    }
+    g_consumer.join();
 }
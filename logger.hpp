@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 typedef enum class log_level {
     FATAL,
     ERROR,
@@ -13,10 +15,37 @@ typedef enum class log_level {
 typedef enum class log_type {
     SYSLOG,
     PRINTF,
+    JOURNAL,
 } log_type_t;
 
 
-void logger_setup(log_type_t type, log_level_t level);
-void logger_log(log_level_t log_level, const char *fmt, ...);
-void logger_stat(const char *eventid);
+// What logging does while the backend's ring buffer is full
+typedef enum class log_overflow {
+    DROP,
+    BLOCK,
+} log_overflow_t;
+
+
+// Level threshold read by the LOG_* macros before formatting anything.
+extern std::atomic<log_level_t> g_logger_level;
 
+inline bool logger_enabled(log_level_t level) {
+    return level <= g_logger_level.load(std::memory_order_relaxed);
+}
+
+void logger_set_level(log_level_t level);
+
+// Parse the names accepted on the command line and in FAM_LOG_TYPE and
+// FAM_LOG_LEVEL, case insensitive ("journal", "debug").
+bool parse_log_type(const char *name, log_type_t &type);
+bool parse_log_level(const char *name, log_level_t &level);
+
+// Starts the backend thread, from then on logger_log() only formats the
+// message into a ring buffer and the backend writes it out.
+void logger_setup(log_type_t type, log_level_t level,
+                  log_overflow_t overflow = log_overflow_t::DROP);
+void logger_log(log_level_t log_level, const char *fmt, ...);
+// Waits until everything logged before the call has been written.
+void logger_flush();
+// Flushes and stops the backend thread, logging is synchronous afterwards.
+void logger_shutdown();
@@ -0,0 +1,75 @@
+#include "logind_client.hpp"
+
+#include <string>
+
+#include <string.h>
+#include <errno.h>
+#include <systemd/sd-bus.h>
+
+#include "log.hpp"
+
+namespace {
+struct request_t {
+    EventLoop *loop;
+    std::string method;
+    LogindClient::Callback done;
+};
+
+// Runs on the thread processing the bus, the result is handed to the loop.
+int on_reply(sd_bus_message *m, void *userdata, sd_bus_error *) {
+    auto request = static_cast<request_t *>(userdata);
+    bool ok = true;
+    if (sd_bus_message_is_method_error(m, nullptr)) {
+        const sd_bus_error *error = sd_bus_message_get_error(m);
+        LOG_ERROR("logind: %s failed: %s", request->method.c_str(),
+                  error && error->message ? error->message : "unknown error");
+        ok = false;
+    }
+    auto done = std::move(request->done);
+    request->loop->post([done, ok] () { done(ok); });
+    return 0;
+}
+
+// Called when the slot goes away, after the reply or when the bus is
+// closed before one arrived. done is not called in the latter case, the
+// daemon is shutting down.
+void destroy_request(void *userdata) {
+    delete static_cast<request_t *>(userdata);
+}
+}
+
+LogindClient::LogindClient(SettingsHandler &settings_handler, EventLoop &loop)
+: mSettingsHandler(settings_handler)
+, mLoop(loop)
+{
+}
+
+bool
+LogindClient::request(const char *method, Callback done) {
+    auto request = new request_t{ &mLoop, method, std::move(done) };
+    int r = -ENOTCONN;
+    mSettingsHandler.withBus([&] (sd_bus *bus) {
+        sd_bus_slot *slot = nullptr;
+        r = sd_bus_call_method_async(bus,
+                &slot,
+                "org.freedesktop.login1",
+                "/org/freedesktop/login1",
+                "org.freedesktop.login1.Manager",
+                method,
+                on_reply,
+                request,
+                "b", 0);
+        if (r >= 0) {
+            // The request now belongs to the slot, which the bus owns
+            sd_bus_slot_set_destroy_callback(slot, destroy_request);
+            sd_bus_slot_set_floating(slot, 1);
+            sd_bus_slot_unref(slot);
+        }
+    });
+    if (r < 0) {
+        LOG_ERROR("logind: Failed to call %s: %s", method, strerror(-r));
+        delete request;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <functional>
+
+#include "event_loop.hpp"
+#include "settings_handler.hpp"
+
+/*
+ * Power actions of systemd-logind, requested on the system bus connection
+ * of the settings handler instead of spawning systemctl.
+ */
+class LogindClient {
+public:
+    // Called from the loop, ok is false if logind refused or did not answer.
+    using Callback = std::function<void(bool ok)>;
+
+    LogindClient(SettingsHandler &settings_handler, EventLoop &loop);
+
+    // Calls org.freedesktop.login1.Manager.<method>(interactive=false), such
+    // as Suspend or PowerOff, without waiting for the reply. Returns false
+    // if the call could not be sent, done is not called then.
+    bool request(const char *method, Callback done);
+
+private:
+    SettingsHandler &mSettingsHandler;
+    EventLoop &mLoop;
+};
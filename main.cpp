@@ -1,57 +1,115 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/signalfd.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
 
 #include "log.hpp"
-#include "state_handler.hpp"
+#include "event_loop.hpp"
 #include "settings_handler.hpp"
-#include "input_monitor.hpp"
-#include "network_monitor.hpp"
-#include "battery_monitor.hpp"
+#include "config_file.hpp"
+#include "logind_client.hpp"
+#include "daemon.hpp"
+#include "flight_recorder.hpp"
+#include "trace_replay.hpp"
+#include "perf_counters.hpp"
 #include "utils.hpp"
 
-status_t get_status(InputMonitor &input, NetworkMonitor &net, BatteryMonitor &bat) {
-    status_t status {
-        .input = input.getStatus(),
-        .net = net.getStatus(),
-        .bat = bat.getStatus(),
-    };
-
-    return status;
+const char *const default_config_path = "/etc/flir-activity-monitor.conf";
+const char *const default_flight_recorder_path = "/var/log/flir-activity-monitor/flight-recorder.bin";
+
+void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-c path] [-t syslog|printf|journal] [-l error|warning|notice|info|debug] [-r path] [-T path] [-R dir]\n"
+            "  -c, --config           config file, reloaded when it changes, default %s\n"
+            "  -t, --log-type         where to log, default FAM_LOG_TYPE or syslog\n"
+            "  -l, --log-level        least severe level logged, default FAM_LOG_LEVEL or info\n"
+            "  -r, --flight-recorder  dump file of the flight recorder, default %s\n"
+            "  -T, --trace            record a trace for fam-replay to this file\n"
+            "  -R, --root             read sysfs and input devices below this directory, for testing\n",
+            name, default_config_path, default_flight_recorder_path);
 }
 
-bool handle_transition( const settings_t &settings,
-                       const state_t &old_state,
-                       const state_t &new_state ) {
-    if (new_state == old_state) {
-        return 0;
+// Environment first, the command line overrides it.
+bool parse_options(int argc, char *argv[], log_type_t &type, log_level_t &level,
+                   std::string &config_path, std::string &recorder_path, std::string &trace_path,
+                   std::string &root) {
+    const char *env = getenv("FAM_LOG_TYPE");
+    if (env && !parse_log_type(env, type)) {
+        fprintf(stderr, "Unknown FAM_LOG_TYPE '%s'\n", env);
+        return false;
     }
-
-    if (new_state == state_t::SLEEP) {
-        if (!settings.sleep_system_cmd.empty()) {
-            LOG_INFO("Putting system to sleep using: '%s'",
-                    settings.sleep_system_cmd.c_str());
-            system(settings.sleep_system_cmd.c_str());
-            return true;
-        }
+    env = getenv("FAM_LOG_LEVEL");
+    if (env && !parse_log_level(env, level)) {
+        fprintf(stderr, "Unknown FAM_LOG_LEVEL '%s'\n", env);
+        return false;
     }
 
-    if (new_state == state_t::SHUTDOWN) {
-        if (!settings.shutdown_system_cmd.empty()) {
-            LOG_INFO("Shutting down system using: '%s'",
-                    settings.shutdown_system_cmd.c_str());
-            system(settings.shutdown_system_cmd.c_str());
-            return true;
+    static const struct option options[] = {
+        {"config", required_argument, nullptr, 'c'},
+        {"log-type", required_argument, nullptr, 't'},
+        {"log-level", required_argument, nullptr, 'l'},
+        {"flight-recorder", required_argument, nullptr, 'r'},
+        {"trace", required_argument, nullptr, 'T'},
+        {"root", required_argument, nullptr, 'R'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:t:l:r:T:R:h", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'c':
+                config_path = optarg;
+                break;
+            case 't':
+                if (!parse_log_type(optarg, type)) {
+                    fprintf(stderr, "Unknown log type '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'l':
+                if (!parse_log_level(optarg, level)) {
+                    fprintf(stderr, "Unknown log level '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'r':
+                recorder_path = optarg;
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 'R':
+                root = optarg;
+                break;
+            default:
+                return false;
         }
     }
-
-    return false;
+    if (optind < argc) {
+        fprintf(stderr, "Unexpected argument '%s'\n", argv[optind]);
+        return false;
+    }
+    return true;
 }
 
 
 int main(int argc, char *argv[]) {
+    log_type_t log_type = log_type_t::SYSLOG;
+    log_level_t log_level = log_level_t::INFO;
+    std::string config_path = default_config_path;
+    std::string recorder_path = default_flight_recorder_path;
+    std::string trace_path;
+    std::string root;
+    if (!parse_options(argc, argv, log_type, log_level, config_path, recorder_path, trace_path, root)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
     /* Enable breaking and signalling to loop */
     sigset_t sigset;
     sigemptyset(&sigset);
@@ -59,106 +117,106 @@ int main(int argc, char *argv[]) {
     sigaddset(&sigset, SIGTERM);
     sigaddset(&sigset, SIGQUIT);
     sigaddset(&sigset, SIGHUP);
+    sigaddset(&sigset, SIGUSR1);
     sigprocmask(SIG_BLOCK, &sigset, NULL);
 
-    const int signal_fd = signalfd(-1, &sigset, 0);
+    const int signal_fd = signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC);
 
-    logger_setup(log_type_t::SYSLOG, log_level_t::INFO);
-
-    SettingsHandler settings_handler;
-
-    if (!settings_handler.startDbusThread()) {
-        LOG_ERROR("Failed to start Dbus thread.");
+    logger_setup(log_type, log_level);
+    g_flight_recorder.setDumpPath(recorder_path);
+    if (!trace_path.empty() && !g_flight_recorder.startTrace(trace_path)) {
+        LOG_ERROR("Failed to record trace to '%s': '%s' (%d)", trace_path.c_str(), strerror(errno), errno);
         return EXIT_FAILURE;
     }
 
-    state_t current_state = state_t::ACTIVE;
+    // All monitors, the dbus handler and the state evaluation share this
+    // loop unless built with FAM_PER_MONITOR_THREADS.
+    EventLoop loop;
+    loop.setWakeupCounter(&g_perf.main_wakeups);
 
-    int count = 0;
-    bool stop_application = false;
+    SettingsHandler settings_handler;
 
-    do {
+    if (!settings_handler.startDbus(loop)) {
+        LOG_ERROR("Failed to start Dbus.");
+        return EXIT_FAILURE;
+    }
 
-        if (!settings_handler.generateSettings()) {
-            return EXIT_FAILURE;
-        }
-        const auto settings = settings_handler.getSettings();
+    // A broken file is logged, the daemon still starts with the defaults
+    settings_handler.loadConfigFile(config_path);
+    if (!settings_handler.generateSettings()) {
+        return EXIT_FAILURE;
+    }
+    const settings_snapshot_t settings = settings_handler.getSettings();
+    record_decision_settings(g_flight_recorder, *settings);
+    set_filesystem_root(root);
 
-        InputMonitor input_mon(settings);
-        if (!input_mon.start()) {
-            LOG_ERROR("Failed to start input monitor.");
-            return EXIT_FAILURE;
-        }
+    LogindClient logind(settings_handler, loop);
+    Daemon daemon(loop, settings, &logind);
+    if (!daemon.start()) {
+        return EXIT_FAILURE;
+    }
 
-        NetworkMonitor net_mon(settings);
-        if (!net_mon.start()) {
-            LOG_ERROR("Failed to start network monitor.");
-            return EXIT_FAILURE;
+    // SIGHUP (sent by the dbus setters) and edits of the config file apply
+    // only the changed settings.
+    const auto reconfigure = [&settings_handler, &daemon] () {
+        settings_changes_t changes = 0;
+        if (!settings_handler.generateSettings(&changes)) {
+            LOG_ERROR("Failed to regenerate settings.");
+            return;
         }
-
-        // Rolling window of 10 samples taken 3 seconds a part
-        BatteryMonitor bat_mon(settings, 10, 3000);
-        if (!bat_mon.start()) {
-            LOG_ERROR("Failed to start battery monitor.");
-            return EXIT_FAILURE;
+        if (!changes) {
+            return;
         }
+        LOG_INFO("Applying changed settings (0x%x).", changes);
+        daemon.applySettings(settings_handler.getSettings(), changes);
+    };
 
-        do {
-            struct pollfd fd = {.fd = signal_fd, .events = POLL_IN, .revents = 0};
-            int r = poll(&fd, 1, 1000);
-
-            // Got signal
-            if (r > 0) {
-                struct signalfd_siginfo fdsi;
-                read(fd.fd, &fdsi, sizeof(struct signalfd_siginfo));
-
-                switch(fdsi.ssi_signo) {
-                case SIGINT:
-                case SIGTERM:
-                case SIGQUIT:
-                    stop_application = true;
-                    break;
-                default:
-                    // Will break inner loop and reinitialize.
-                    break;
-                }
-                break;
+    ConfigWatcher config_watcher(loop, config_path);
+    if (!config_watcher.start([&settings_handler, &reconfigure, &config_path] () {
+            if (settings_handler.loadConfigFile(config_path)) {
+                reconfigure();
             }
+        })) {
+        LOG_WARNING("Changes of '%s' apply after a restart.", config_path.c_str());
+    }
 
-            if (r < 0) {
-                LOG_ERROR("Main thread poll failed: '%s' (%d).", strerror(errno), errno);
-                break;
-            }
+    loop.addFd(signal_fd, EPOLLIN, [&loop, &reconfigure, signal_fd] (uint32_t) {
+        struct signalfd_siginfo fdsi;
+        if (read(signal_fd, &fdsi, sizeof(struct signalfd_siginfo)) != sizeof(struct signalfd_siginfo)) {
+            return;
+        }
 
-            const auto status = get_status(input_mon, net_mon, bat_mon);
-            const auto now = get_timestamp();
-            const auto new_state = get_new_state(current_state,
-                                                 settings,
-                                                 status,
-                                                 now);
-
-            if (new_state != current_state) {
-                if (new_state == state_t::SHUTDOWN) {
-                    bat_mon.printData();
-                    logger_stat("low-battery-shutdown");
-                    usleep(100000); // Sleep to let log messages have time to print
-                }
-                else if (new_state == state_t::SLEEP) {
-                    logger_stat("auto-suspend");
-                }
-                const bool should_reset = handle_transition(settings, current_state, new_state);
-                current_state = new_state;
-                if (should_reset) {
-                    input_mon.reset();
-                    net_mon.reset();
-                    bat_mon.reset();
-                }
-            }
-        } while (true);
-    } while (!stop_application);
+        switch(fdsi.ssi_signo) {
+        case SIGINT:
+        case SIGTERM:
+        case SIGQUIT:
+            loop.stop();
+            break;
+        case SIGHUP:
+            reconfigure();
+            break;
+        case SIGUSR1:
+            dump_flight_recorder();
+            break;
+        default:
+            break;
+        }
+    });
 
+    if (!loop.run()) {
+        LOG_ERROR("Main event loop failed.");
+        return EXIT_FAILURE;
+    }
 
-    LOG_INFO("Shutting down application.");
+    StatsSink &stats = daemon.stats();
+    stats.flushNow();
+    dump_flight_recorder();
+    g_flight_recorder.stopTrace();
+    LOG_INFO("Shutting down application (statistics: %llu flushed, %llu dropped, %zu pending).",
+             static_cast<unsigned long long>(stats.flushed()),
+             static_cast<unsigned long long>(stats.dropped()),
+             stats.pending());
+    logger_shutdown();
 
 
     return 0;
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded lock-free multi-producer single-consumer ring.
+ *
+ * Every cell carries a sequence number telling producers whether it is
+ * free and the consumer whether it is published. Producers claim cells
+ * with a CAS on the enqueue position and fill them in place, so large
+ * records are written only once. N must be a power of two.
+ */
+template <typename T, size_t N>
+class MpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    MpscRing()
+    : mEnqueuePos(0)
+    , mDequeuePos(0)
+    {
+        for (size_t i = 0; i < N; ++i) {
+            mCells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Claims a cell and calls fill(T &) on it. Returns false if full.
+    template <typename F>
+    bool tryPush(F fill) {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = mCells[pos & (N - 1)];
+            const size_t seq = cell.seq.load(std::memory_order_acquire);
+            const intptr_t dif = intptr_t(seq) - intptr_t(pos);
+            if (dif == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(cell.value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only. Calls consume(const T &) on the oldest published
+    // value and frees its cell. Returns false if there is none.
+    template <typename F>
+    bool tryPop(F consume) {
+        const size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Cell &cell = mCells[pos & (N - 1)];
+        if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        consume(static_cast<const T &>(cell.value));
+        cell.seq.store(pos + N, std::memory_order_release);
+        mDequeuePos.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. True if the oldest value is published.
+    bool readable() const {
+        const size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        return mCells[pos & (N - 1)].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // Number of values claimed by producers so far
+    size_t pushed() const { return mEnqueuePos.load(std::memory_order_acquire); }
+    // Number of values consumed so far
+    size_t popped() const { return mDequeuePos.load(std::memory_order_acquire); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    alignas(64) std::atomic<size_t> mEnqueuePos;
+    alignas(64) std::atomic<size_t> mDequeuePos;
+    Cell mCells[N];
+};
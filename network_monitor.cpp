@@ -2,131 +2,361 @@
 
 #include <algorithm>
 #include <memory>
-#include <atomic>
-#include <thread>
-#include <mutex>
 
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <glob.h>
 #include <sys/epoll.h>
-#include <sys/eventfd.h>
-
-#include <sstream>
-#include <fstream>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include "utils.hpp"
+#include "state_handler.hpp"
+#include "sysfs_attribute.hpp"
+#include "flight_recorder.hpp"
 #include "log.hpp"
 
 namespace {
 
-double max_net_activity;
-
-std::vector<uint64_t> get_net_stat(const settings_t &settings, const std::string &stats_file) {
-    std::vector<uint64_t> data(settings.net_devices.size());
-
-    int idx = 0;
-    for (const auto &d:settings.net_devices) {
-        std::stringstream ss;
-        ss << "/sys/class/net/" << d << "/statistics/" << stats_file;
-        std::ifstream f(ss.str());
-        if (!f.is_open()) {
-            //LOG_ERROR("Failed to open statistics: '%s'", ss.str().c_str());
-            data[idx++] = 0;
-        } else {
-            uint64_t v;
-            f >> v;
-            data[idx++] = v;
-        }
+// Large enough for the biggest netlink skb of a dump (NLMSG_GOODSIZE).
+const size_t netlink_buffer_size = 32 * 1024;
+// The sample due by the idle deadline is taken this much earlier, so the
+// state evaluation at the deadline already sees it.
+const uint64_t deadline_lead_ms = 1000;
+
+int open_rtnl_socket(uint32_t groups, int flags) {
+    const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | flags, NETLINK_ROUTE);
+    if (fd == -1) {
+        LOG_ERROR("net_mon: netlink socket: '%s' (%d)", strerror(errno), errno);
+        return -1;
     }
-    return data;
+
+    struct sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        LOG_ERROR("net_mon: netlink bind: '%s' (%d)", strerror(errno), errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool request_link_dump(int fd, uint32_t seq) {
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+    } req = {};
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nlh.nlmsg_type = RTM_GETLINK;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = seq;
+    req.ifi.ifi_family = AF_UNSPEC;
+
+    if (send(fd, &req, req.nlh.nlmsg_len, MSG_DONTWAIT) == -1) {
+        LOG_ERROR("net_mon: RTM_GETLINK: '%s' (%d)", strerror(errno), errno);
+        return false;
+    }
+    return true;
 }
 
-uint64_t max_net_stat(std::vector<uint64_t> prev_tx, std::vector<uint64_t> prev_rx,
-                      std::vector<uint64_t> curr_tx, std::vector<uint64_t> curr_rx) {
-    std::vector<uint64_t> diff_tx(prev_tx.size());
-    std::vector<uint64_t> diff_rx(prev_tx.size());
-    std::vector<uint64_t> sum(prev_tx.size());
-    std::transform(curr_tx.begin(), curr_tx.end(), prev_tx.begin(), diff_tx.begin(), std::minus<uint64_t>());
-    std::transform(curr_rx.begin(), curr_rx.end(), prev_rx.begin(), diff_rx.begin(), std::minus<uint64_t>());
-    std::transform(diff_tx.begin(), diff_tx.end(), diff_rx.begin(), sum.begin(), std::plus<uint64_t>());
-    return *std::max_element(sum.begin(), sum.end());
+// Settings in seconds, a maximum below the minimum is raised to it.
+int min_interval_ms(const settings_t &settings) {
+    return std::max(settings.net_sample_min_interval, 1) * 1000;
+}
+
+int max_interval_ms(const settings_t &settings) {
+    return std::max(settings.net_sample_max_interval * 1000, min_interval_ms(settings));
 }
 };
 
+int next_sample_interval_ms(double traffic, double limit, int previous_ms, int min_ms, int max_ms) {
+    // A limit of 0 never lets the system sleep, the rate does not matter
+    if (limit > 0 && traffic >= limit / 2) {
+        return min_ms;
+    }
+    return std::clamp(previous_ms * 2, min_ms, max_ms);
+}
+
+NetworkMonitor::NetworkMonitor(settings_snapshot_t settings)
+    : mSettings(std::move(settings))
+    , mSources("net_mon", &g_perf.net_wakeups)
+    , mLinks(mSettings->net_devices)
+    , mBuffer(netlink_buffer_size)
+    , mNotifyFD(-1)
+    , mDumpSeq(0)
+    , mDumpPending(false)
+    , mHaveBaseline(false)
+    , mSampleTimer(-1)
+    , mIntervalMs(min_interval_ms(*mSettings))
+    , mLastSampleUsec(0)
+    , mIdleDeadline(no_deadline)
+{
+    mLinks.setWindow(mSettings->net_activity_window, mSettings->net_activity_limit);
+}
+
+NetworkMonitor::~NetworkMonitor() {
+    mSources.stop();
+    if (mNotifyFD >= 0) {
+        close(mNotifyFD);
+    }
+}
+
 bool
-NetworkMonitor::start() {
-    int epollfd = epoll_create1(0);
-    if (epollfd == -1) {
-        LOG_ERROR("net_mon: epoll_create1: '%s' (%d)", strerror(errno), errno);
+NetworkMonitor::start(EventLoop &loop) {
+    mSources.attach(loop);
+
+    if (filesystem_root().empty()) {
+        mNotifyFD = open_rtnl_socket(RTMGRP_LINK, SOCK_NONBLOCK);
+        if (mNotifyFD == -1) {
+            return false;
+        }
+        if (!mSources.addFd(mNotifyFD, EPOLLIN, [this] (uint32_t) { handleLinkNotifications(); })) {
+            return false;
+        }
+    }
+
+    mSampleTimer = mSources.addTimer([this] (uint32_t) { sample(); });
+    if (mSampleTimer == -1) {
+        LOG_ERROR("net_mon: Failed to start sample timer.");
+        return false;
+    }
+    // The first sample takes the baseline counters of the interfaces present
+    sample();
+
+    return mSources.start();
+}
+
+bool
+NetworkMonitor::requestDump() {
+    // A dump still pending lost its reply, the new one replaces it
+    if (mDumpPending) {
+        LOG_WARNING("net_mon: RTM_GETLINK dump %u unanswered.", mDumpSeq);
+    }
+    mDumpPending = false;
+    // 0 is the sequence number of notifications
+    if (++mDumpSeq == 0) {
+        ++mDumpSeq;
+    }
+    if (!request_link_dump(mNotifyFD, mDumpSeq)) {
+        return false;
+    }
+    mLinks.beginDump();
+    mDumpPending = true;
+    return true;
+}
+
+bool
+NetworkMonitor::handleDumpReply(const struct nlmsghdr *nlh) {
+    if (!mDumpPending || nlh->nlmsg_seq != mDumpSeq) {
+        return false;
+    }
+    if (nlh->nlmsg_type == NLMSG_DONE) {
+        mLinks.endDump();
+        mDumpPending = false;
+        return true;
+    }
+    if (nlh->nlmsg_type == NLMSG_ERROR) {
+        // The retry armed by sample() requests the next one
+        LOG_ERROR("net_mon: RTM_GETLINK dump failed.");
+        mDumpPending = false;
         return false;
     }
+    link_msg_t link;
+    if (parse_link_message(nlh, link)) {
+        mLinks.update(link);
+    }
+    return false;
+}
 
-    struct epoll_event ev;
-    mAbortFD = eventfd(0, 0);
-    ev.events = EPOLLIN;
-    ev.data.fd = mAbortFD;
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, mAbortFD, &ev) == -1) {
-        LOG_ERROR("net_mon: epoll_ctl: abort fd: '%s' (%d)", strerror(errno), errno);
+bool
+NetworkMonitor::scanSysfsLinks() {
+    glob_t g;
+    const int rc = glob(root_path("/sys/class/net/*").c_str(), 0, nullptr, &g);
+    if (rc != 0 && rc != GLOB_NOMATCH) {
+        LOG_ERROR("net_mon: Can't scan '%s'.", root_path("/sys/class/net").c_str());
         return false;
     }
 
+    mLinks.beginDump();
+    for (size_t i = 0; rc == 0 && i < g.gl_pathc; ++i) {
+        const std::string dir = g.gl_pathv[i];
+        const std::string name = dir.substr(dir.rfind('/') + 1);
+        const int64_t tx = read_sysfs_int(dir + "/statistics/tx_packets", -1);
+        const int64_t rx = read_sysfs_int(dir + "/statistics/rx_packets", -1);
+        const link_msg_t link = {
+            .index = int(read_sysfs_int(dir + "/ifindex", -1)),
+            .name = name.c_str(),
+            .has_stats = tx >= 0 && rx >= 0,
+            .tx_packets = uint64_t(std::max<int64_t>(tx, 0)),
+            .rx_packets = uint64_t(std::max<int64_t>(rx, 0)),
+        };
+        if (link.index >= 0) {
+            mLinks.update(link);
+        }
+    }
+    mLinks.endDump();
+    if (rc == 0) {
+        globfree(&g);
+    }
+    return true;
+}
 
-    mThread = std::thread([this, epollfd] () {
-    auto prev_tx_data = get_net_stat(mSettings, "tx_packets");
-    auto prev_rx_data = get_net_stat(mSettings, "rx_packets");
-    do {
-        struct epoll_event ep_event;
-        int nfds = epoll_wait(epollfd, &ep_event, 1, 10*1000);
-        if (nfds == -1) {
-            if (errno != EINTR) {
-                LOG_ERROR("net_mon: epoll_wait: '%s' (%d)", strerror(errno), errno);
+void
+NetworkMonitor::handleLinkNotifications() {
+    bool dumped = false;
+    for (;;) {
+        const ssize_t len = recv(mNotifyFD, mBuffer.data(), mBuffer.size(), 0);
+        if (len == -1) {
+            // ENOBUFS means notifications were lost, the next dump resyncs.
+            if (errno == EINTR || errno == ENOBUFS) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                LOG_ERROR("net_mon: link notification: '%s' (%d)", strerror(errno), errno);
             }
-            continue;
-        }
-        if (nfds > 0) {
             break;
         }
 
-        auto curr_tx_data = get_net_stat(mSettings, "tx_packets");
-        auto curr_rx_data = get_net_stat(mSettings, "rx_packets");
-        uint64_t max_net = max_net_stat(prev_tx_data, prev_rx_data, curr_tx_data, curr_rx_data);
+        int remaining = len;
+        for (auto nlh = reinterpret_cast<const struct nlmsghdr *>(mBuffer.data());
+             NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining)) {
+            // Notifications carry no sequence number, dump replies ours
+            if (nlh->nlmsg_seq != 0) {
+                dumped = handleDumpReply(nlh) || dumped;
+                continue;
+            }
+            link_msg_t link;
+            if (!parse_link_message(nlh, link)) {
+                continue;
+            }
+            if (nlh->nlmsg_type == RTM_DELLINK) {
+                if (mLinks.remove(link.index)) {
+                    LOG_INFO("net_mon: Interface '%s' removed.", link.name);
+                }
+            } else if (mLinks.update(link)) {
+                LOG_INFO("net_mon: Monitoring interface '%s'.", link.name);
+            }
+        }
+    }
+    if (dumped) {
+        finishSample();
+    }
+}
 
-        std::swap(prev_tx_data, curr_tx_data);
-        std::swap(prev_rx_data, curr_rx_data);
+void
+NetworkMonitor::sample() {
+    const bool requested = mNotifyFD == -1 ? scanSysfsLinks() : requestDump();
+    // The counters keep their baseline, the rate covers the retry too. A
+    // netlink dump ends in handleLinkNotifications(), this also retries a
+    // dump whose reply was lost.
+    mSources.armTimer(mSampleTimer, min_interval_ms(*mSettings), 0);
+    if (requested && mNotifyFD == -1) {
+        finishSample();
+    }
+}
 
-        std::lock_guard<std::mutex> guard(mMutex);
-        mLastMaxTraffic = double(max_net)/10;
+void
+NetworkMonitor::finishSample() {
+    const uint64_t now_usec = get_clock().nowUsec();
+    if (!mHaveBaseline) {
+        mLinks.maxPacketsSinceLastSample();
+        mLastSampleUsec = now_usec;
+        mHaveBaseline = true;
+        LOG_INFO("net_mon: Monitoring %zu interfaces.", mLinks.matchingLinks());
+        armSample();
+        return;
+    }
+    // The timer may fire late, the rate is over the time actually elapsed
+    const uint64_t elapsed_usec = std::max<uint64_t>(now_usec - mLastSampleUsec, 1);
+    const uint64_t max_net = mLinks.maxPacketsSinceLastSample(mLastSampleUsec, now_usec);
+    mLastSampleUsec = now_usec;
 
-    } while (true);
-    if (epollfd >= 0) {
-        close(epollfd);
+    const double traffic = double(max_net) * 1000000 / elapsed_usec;
+    network_status_t status{};
+    status.max_traffic_last_period = traffic;
+    if (mSettings->net_activity_window > 0) {
+        mLinks.windowStatus(status);
+        g_flight_recorder.record(flight_event::NET_WINDOW, status.busy_buckets << 16 | status.window_buckets,
+                                 llround(status.window_traffic * 1000));
     }
+    g_flight_recorder.record(flight_event::NET_RATE, uint32_t(elapsed_usec / 1000), llround(traffic * 1000));
+    const bool crossed_limit =
+        network_is_active(*mSettings, mStatus.load()) != network_is_active(*mSettings, status);
+    mStatus.store(status);
+
+    if (crossed_limit && mStatusListener) {
+        mStatusListener();
     }
-    );
 
-    return true;
+    mIntervalMs = next_sample_interval_ms(traffic, mSettings->net_activity_limit, mIntervalMs,
+                                          min_interval_ms(*mSettings), max_interval_ms(*mSettings));
+    armSample();
 }
 
-NetworkMonitor::NetworkMonitor(const settings_t &settings)
-    : mSettings(settings)
-{
+void
+NetworkMonitor::armSample() {
+    // Armed once the dump ends
+    if (mDumpPending) {
+        return;
+    }
+    const uint64_t last_ms = mLastSampleUsec / 1000;
+    uint64_t next_ms = last_ms + mIntervalMs;
+    const timestamp_t deadline = mIdleDeadline.load(std::memory_order_relaxed);
+    if (deadline != no_deadline) {
+        // Not sooner than the minimum interval, a rate over a few
+        // milliseconds would be mostly noise
+        const uint64_t deadline_ms = std::max<uint64_t>(uint64_t(deadline) * 1000 - deadline_lead_ms,
+                                                        last_ms + min_interval_ms(*mSettings));
+        next_ms = std::min(next_ms, deadline_ms);
+    }
+    mSources.armTimerAt(mSampleTimer, next_ms);
 }
 
-NetworkMonitor::~NetworkMonitor() {
-    if (mAbortFD >= 0) {
-        uint64_t v = 1;
-        write(mAbortFD, &v, sizeof(v));
-        if (mThread.joinable()) {
-            mThread.join();
-        }
-        close(mAbortFD);
+void
+NetworkMonitor::setIdleDeadline(timestamp_t deadline) {
+    const timestamp_t previous = mIdleDeadline.exchange(deadline, std::memory_order_relaxed);
+    // A later deadline only needs the sample already planned
+    if (deadline < previous && mSampleTimer != -1) {
+        mSources.invoke([this] () { armSample(); });
     }
 }
 
+void
+NetworkMonitor::applySettings(settings_snapshot_t settings, settings_changes_t changes) {
+    mSources.invoke([&] () {
+        mSettings = std::move(settings);
+        if (changes & settings_change(settings_field::NET_DEVICES)) {
+            mLinks.setPatterns(mSettings->net_devices);
+            LOG_INFO("net_mon: Monitoring %zu interfaces.", mLinks.matchingLinks());
+        }
+        if (changes & (settings_change(settings_field::NET_ACTIVITY_WINDOW) |
+                       settings_change(settings_field::NET_ACTIVITY_LIMIT))) {
+            // The history is kept, only the window aggregates are rebuilt
+            mLinks.setWindow(mSettings->net_activity_window, mSettings->net_activity_limit);
+            network_status_t status = mStatus.load();
+            mLinks.windowStatus(status);
+            mStatus.store(status);
+        }
+        if ((changes & (settings_change(settings_field::NET_SAMPLE_MIN_INTERVAL) |
+                        settings_change(settings_field::NET_SAMPLE_MAX_INTERVAL))) && mSampleTimer != -1) {
+            mIntervalMs = std::clamp(mIntervalMs, min_interval_ms(*mSettings), max_interval_ms(*mSettings));
+            armSample();
+        }
+    });
+}
+
+void
+NetworkMonitor::setStatusListener(std::function<void()> listener) {
+    mStatusListener = std::move(listener);
+}
+
 network_status_t
 NetworkMonitor::getStatus() {
-    std::lock_guard<std::mutex> guard(mMutex);
-    return { .max_traffic_last_period = mLastMaxTraffic };
+    return mStatus.load();
 }
 
 void
@@ -1,24 +1,80 @@
 #pragma once
 
-#include <thread>
-#include <mutex>
+#include <atomic>
+#include <functional>
 #include <vector>
 
 #include "types.hpp"
+#include "event_loop.hpp"
+#include "link_stats.hpp"
+#include "seqlock.hpp"
 
+struct nlmsghdr;
 
+// Interval until the next sample: min_ms once the traffic reaches half of a
+// positive limit, otherwise twice the previous interval up to max_ms.
+int next_sample_interval_ms(double traffic, double limit, int previous_ms, int min_ms, int max_ms);
+
+/*
+ * Samples the packet counters of the matching interfaces, the status is the
+ * highest rate of one interface over the measured time since the previous
+ * sample.
+ *
+ * The interval adapts between the configured minimum and maximum: it backs
+ * off while the traffic is far below net_activity_limit, and is at its
+ * minimum near the limit. A sample is also due by the idle deadline, so the
+ * sleep decision sees a fresh rate.
+ *
+ * With a net_activity_window, the samples also feed the interfaces'
+ * ActivityHistory and the status carries the window of the busiest one.
+ *
+ * The counters come from an RTM_GETLINK dump requested on the link
+ * notification socket. The loop is not blocked for the reply, the sample
+ * completes when the dump's end is read with the notifications.
+ */
 class NetworkMonitor {
 public:
-    explicit NetworkMonitor(const settings_t &settings);
+    explicit NetworkMonitor(settings_snapshot_t settings);
     ~NetworkMonitor();
     network_status_t getStatus();
-    bool start();
+    bool start(EventLoop &loop);
     void reset();
+    // Time at which the idle limit runs out, see get_idle_deadline().
+    // May be called from any thread.
+    void setIdleDeadline(timestamp_t deadline);
+    // Applies changed settings, the counters of the interfaces are kept.
+    void applySettings(settings_snapshot_t settings, settings_changes_t changes);
+    // Called when the status changes in a way the state evaluation cannot
+    // predict from time alone. May be called from the monitor's own thread.
+    void setStatusListener(std::function<void()> listener);
 
 private:
-    settings_t mSettings;
-    std::mutex mMutex;
-    std::thread mThread;
-    double mLastMaxTraffic;
-    int mAbortFD;
+    void sample();
+    // Computes the rate from the counters read by sample()
+    void finishSample();
+    // Arms the sample timer mIntervalMs after the last sample, or earlier
+    // for the idle deadline.
+    void armSample();
+    bool requestDump();
+    // Returns true when the reply ends the pending dump
+    bool handleDumpReply(const struct nlmsghdr *nlh);
+    // Reads the counters below the filesystem root instead of netlink
+    bool scanSysfsLinks();
+    void handleLinkNotifications();
+
+    settings_snapshot_t mSettings;
+    std::function<void()> mStatusListener;
+    EventSourceGroup mSources;
+    LinkTable mLinks;
+    std::vector<char> mBuffer;
+    int mNotifyFD;
+    uint32_t mDumpSeq;
+    bool mDumpPending;
+    // The first sample only takes the counters
+    bool mHaveBaseline;
+    int mSampleTimer;
+    int mIntervalMs;
+    uint64_t mLastSampleUsec;
+    std::atomic<timestamp_t> mIdleDeadline;
+    SeqLock<network_status_t> mStatus;
 };
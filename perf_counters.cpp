@@ -0,0 +1,35 @@
+#include "perf_counters.hpp"
+
+perf_counters_t g_perf;
+
+void
+PerfHistogram::record(uint64_t usec) {
+    size_t i = 0;
+    while (i < buckets - 1 && (uint64_t(1) << i) <= usec) {
+        ++i;
+    }
+    mBuckets[i].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSumUsec.fetch_add(usec, std::memory_order_relaxed);
+    uint64_t max = mMaxUsec.load(std::memory_order_relaxed);
+    while (usec > max && !mMaxUsec.compare_exchange_weak(max, usec, std::memory_order_relaxed)) {
+    }
+}
+
+void perf_for_each_counter(const std::function<void(const char *name, uint64_t value)> &fn) {
+    fn("MainWakeups", g_perf.main_wakeups.value());
+    fn("InputWakeups", g_perf.input_wakeups.value());
+    fn("NetworkWakeups", g_perf.net_wakeups.value());
+    fn("BatteryWakeups", g_perf.battery_wakeups.value());
+    fn("SettingsWakeups", g_perf.settings_wakeups.value());
+    fn("EvdevEvents", g_perf.evdev_events.value());
+    fn("SysfsReads", g_perf.sysfs_reads.value());
+    fn("UdevReceived", g_perf.udev_received.value());
+    fn("UdevFiltered", g_perf.udev_filtered.value());
+    fn("DbusMessages", g_perf.dbus_messages.value());
+}
+
+void perf_for_each_histogram(const std::function<void(const char *name, const PerfHistogram &histogram)> &fn) {
+    fn("SysfsReadLatency", g_perf.sysfs_read_latency);
+    fn("GetNewStateLatency", g_perf.get_new_state_latency);
+}
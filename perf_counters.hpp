@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+// Monotonic event count, any thread may add.
+class PerfCounter {
+public:
+    void add(uint64_t n = 1) { mValue.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> mValue{0};
+};
+
+/*
+ * Latency histogram with power of 2 microsecond buckets.
+ *
+ * Bucket 0 counts durations below 1 us, bucket i durations in
+ * [2^(i-1), 2^i) us and the last bucket everything longer. The fields are
+ * updated independently, a reader may see a sample in count but not yet in
+ * its bucket.
+ */
+class PerfHistogram {
+public:
+    static constexpr size_t buckets = 16;
+
+    void record(uint64_t usec);
+
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+    uint64_t sumUsec() const { return mSumUsec.load(std::memory_order_relaxed); }
+    uint64_t maxUsec() const { return mMaxUsec.load(std::memory_order_relaxed); }
+    uint64_t bucket(size_t i) const { return mBuckets[i].load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> mCount{0};
+    std::atomic<uint64_t> mSumUsec{0};
+    std::atomic<uint64_t> mMaxUsec{0};
+    std::atomic<uint64_t> mBuckets[buckets] = {};
+};
+
+// Records the lifetime of the scope into a histogram.
+class PerfTimer {
+public:
+    explicit PerfTimer(PerfHistogram &histogram)
+    : mHistogram(histogram)
+    , mStart(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~PerfTimer() {
+        const auto elapsed = std::chrono::steady_clock::now() - mStart;
+        mHistogram.record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+    PerfTimer(const PerfTimer &) = delete;
+    PerfTimer &operator=(const PerfTimer &) = delete;
+
+private:
+    PerfHistogram &mHistogram;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+typedef struct {
+    // epoll wakeups of the main loop and of the monitor threads. With the
+    // shared loop the monitor counters count the dispatches of their sources.
+    PerfCounter main_wakeups;
+    PerfCounter input_wakeups;
+    PerfCounter net_wakeups;
+    PerfCounter battery_wakeups;
+    PerfCounter settings_wakeups;
+    PerfCounter evdev_events;
+    PerfCounter sysfs_reads;
+    PerfHistogram sysfs_read_latency;
+    PerfCounter udev_received;
+    // Received but not for a monitored device
+    PerfCounter udev_filtered;
+    PerfCounter dbus_messages;
+    PerfHistogram get_new_state_latency;
+} perf_counters_t;
+
+extern perf_counters_t g_perf;
+
+// Visit the counters and histograms of g_perf with their D-Bus names.
+void perf_for_each_counter(const std::function<void(const char *name, uint64_t value)> &fn);
+void perf_for_each_histogram(const std::function<void(const char *name, const PerfHistogram &histogram)> &fn);
@@ -0,0 +1,224 @@
+#include "process_launcher.hpp"
+
+#include <spawn.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "log.hpp"
+
+extern char **environ;
+
+namespace {
+const int waitpid_poll_ms = 100;
+// Special to the shell outside of quotes, except $, ` and \ which are
+// special within double quotes as well
+const char shell_chars[] = "|&;<>()*?[]{}~#!\n";
+
+int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+}
+
+std::vector<std::string> split_command(const std::string &command) {
+    std::vector<std::string> args;
+    std::string arg;
+    bool in_arg = false;
+    char quote = 0;
+    for (const char c: command) {
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            } else {
+                arg += c;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            in_arg = true;
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            if (in_arg) {
+                args.push_back(std::move(arg));
+                arg.clear();
+                in_arg = false;
+            }
+        } else {
+            arg += c;
+            in_arg = true;
+        }
+    }
+    if (in_arg) {
+        args.push_back(std::move(arg));
+    }
+    return args;
+}
+
+bool command_needs_shell(const std::string &command) {
+    char quote = 0;
+    bool first_word = true;
+    bool in_arg = false;
+    for (const char c: command) {
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = 0;
+            }
+            continue;
+        }
+        if (c == '$' || c == '`' || c == '\\') {
+            return true;
+        }
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            in_arg = true;
+        } else if (c == ' ' || c == '\t') {
+            first_word = first_word && !in_arg;
+            in_arg = false;
+        } else if ((c == '=' && first_word) || (c != '\0' && strchr(shell_chars, c))) {
+            return true;
+        } else {
+            in_arg = true;
+        }
+    }
+    return false;
+}
+
+ProcessLauncher::ProcessLauncher(EventLoop &loop)
+: mLoop(loop)
+{
+}
+
+ProcessLauncher::~ProcessLauncher() {
+    // Commands such as poweroff are left running, only stop tracking them.
+    for (auto &c: mChildren) {
+        release(c.second);
+    }
+}
+
+pid_t
+ProcessLauncher::launch(const std::string &command, int timeout_ms, ExitCallback done) {
+    const bool shell = command_needs_shell(command);
+    const auto args = shell ? std::vector<std::string>({ "/bin/sh", "-c", command }) : split_command(command);
+    if (args.empty()) {
+        LOG_ERROR("process_launcher: Empty command.");
+        mLoop.post([done] () { done(-1); });
+        return -1;
+    }
+    std::vector<char *> argv;
+    for (const auto &a: args) {
+        argv.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    // The signals handled through signalfd are blocked in this process,
+    // the child starts with an empty mask.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    const int r = posix_spawnp(&pid, argv[0], nullptr, &attr, argv.data(), environ);
+    posix_spawnattr_destroy(&attr);
+    if (r != 0) {
+        LOG_ERROR("process_launcher: Failed to start '%s': '%s' (%d)", command.c_str(), strerror(r), r);
+        mLoop.post([done] () { done(-1); });
+        return -1;
+    }
+
+    child_t &child = mChildren[pid];
+    child.name = shell ? command : args[0];
+    child.pidfd = pidfd_open(pid);
+    child.poll_timer = -1;
+    child.timeout_timer = -1;
+    child.terminated = false;
+    child.done = std::move(done);
+
+    if (child.pidfd >= 0) {
+        mLoop.addFd(child.pidfd, EPOLLIN, [this, pid] (uint32_t) { reap(pid); });
+    } else {
+        child.poll_timer = mLoop.addTimer([this, pid] (uint32_t) { reap(pid); });
+        mLoop.armTimer(child.poll_timer, waitpid_poll_ms, waitpid_poll_ms);
+    }
+    if (timeout_ms > 0) {
+        child.timeout_timer = mLoop.addTimer([this, pid] (uint32_t) { timeout(pid); });
+        mLoop.armTimer(child.timeout_timer, timeout_ms, 0);
+    }
+
+    LOG_DEBUG("process_launcher: Started '%s' (%d)", command.c_str(), pid);
+    return pid;
+}
+
+void
+ProcessLauncher::reap(pid_t pid) {
+    int status;
+    const pid_t r = waitpid(pid, &status, WNOHANG);
+    if (r == 0 || (r == -1 && errno == EINTR)) {
+        return;
+    }
+    const auto it = mChildren.find(pid);
+    if (it == mChildren.end()) {
+        return;
+    }
+    if (r == -1) {
+        LOG_ERROR("process_launcher: waitpid '%s': '%s' (%d)", it->second.name.c_str(), strerror(errno), errno);
+        status = -1;
+    } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        LOG_ERROR("process_launcher: '%s' exited with %d", it->second.name.c_str(), WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        LOG_ERROR("process_launcher: '%s' killed by signal %d", it->second.name.c_str(), WTERMSIG(status));
+    }
+
+    const auto done = std::move(it->second.done);
+    release(it->second);
+    mChildren.erase(it);
+    if (done) {
+        done(status);
+    }
+}
+
+void
+ProcessLauncher::timeout(pid_t pid) {
+    const auto it = mChildren.find(pid);
+    if (it == mChildren.end()) {
+        return;
+    }
+    child_t &child = it->second;
+    if (!child.terminated) {
+        LOG_WARNING("process_launcher: '%s' timed out, terminating.", child.name.c_str());
+        kill(pid, SIGTERM);
+        child.terminated = true;
+        mLoop.armTimer(child.timeout_timer, kill_grace_ms, 0);
+    } else {
+        LOG_WARNING("process_launcher: '%s' ignored SIGTERM, killing.", child.name.c_str());
+        kill(pid, SIGKILL);
+    }
+}
+
+void
+ProcessLauncher::release(child_t &child) {
+    if (child.pidfd >= 0) {
+        mLoop.removeFd(child.pidfd);
+        close(child.pidfd);
+    }
+    if (child.poll_timer >= 0) {
+        mLoop.removeTimer(child.poll_timer);
+    }
+    if (child.timeout_timer >= 0) {
+        mLoop.removeTimer(child.timeout_timer);
+    }
+}
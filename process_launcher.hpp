@@ -0,0 +1,64 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#include "event_loop.hpp"
+
+// Splits a command line into arguments at blanks. Single or double quotes
+// group blanks into one argument, there is no other shell syntax.
+std::vector<std::string> split_command(const std::string &command);
+// True if command uses shell syntax beyond split_command(): pipes, lists,
+// redirection, expansions, globs, escapes or leading variable assignments.
+bool command_needs_shell(const std::string &command);
+
+/*
+ * Runs commands without blocking the event loop.
+ *
+ * Plain commands are split with split_command() and run without a shell,
+ * commands for which command_needs_shell() is true run with /bin/sh -c as
+ * the configured commands did before. Children are spawned with
+ * posix_spawnp() and tracked with a pidfd in the
+ * loop, or by polling waitpid() on kernels without pidfd_open(). A child
+ * still running after its timeout gets SIGTERM, and SIGKILL if it ignores
+ * that for kill_grace_ms.
+ */
+class ProcessLauncher {
+public:
+    // Called from the loop with the waitpid() status of the command, or -1
+    // if it could not be started.
+    using ExitCallback = std::function<void(int status)>;
+
+    static const int kill_grace_ms = 2000;
+
+    explicit ProcessLauncher(EventLoop &loop);
+    ~ProcessLauncher();
+    ProcessLauncher(const ProcessLauncher &) = delete;
+    ProcessLauncher &operator=(const ProcessLauncher &) = delete;
+
+    // Returns the pid of the started command, or -1. done is called in
+    // either case. A timeout_ms of 0 waits forever.
+    pid_t launch(const std::string &command, int timeout_ms, ExitCallback done);
+    size_t running() const { return mChildren.size(); }
+
+private:
+    struct child_t {
+        std::string name;
+        int pidfd;
+        // waitpid() poll timer when there is no pidfd
+        int poll_timer;
+        int timeout_timer;
+        bool terminated;
+        ExitCallback done;
+    };
+
+    void reap(pid_t pid);
+    void timeout(pid_t pid);
+    void release(child_t &child);
+
+    EventLoop &mLoop;
+    std::unordered_map<pid_t, child_t> mChildren;
+};
@@ -1,12 +1,158 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 #include <mutex>
 #include <sstream>
+#include <stdint.h>
 
-template <typename T>
+#include "seqlock.hpp"
+
+/*
+ * Rolling window over the last N values.
+ *
+ * RollingWindow<T, N> has its capacity fixed at compile time. Readers never
+ * block: state is published under a sequence counter (seqlock) and readers
+ * retry if a write was in progress. The running min and max are kept with
+ * monotonic deques so the threshold queries are O(1). Writers are
+ * serialized on the sequence counter, normally there is only one.
+ *
+ * RollingWindow<T> is the runtime sized, mutex protected variant.
+ */
+template <typename T, size_t N = 0>
 class RollingWindow {
+    static_assert(std::atomic<T>::is_always_lock_free, "T must be lock-free atomic");
+
+public:
+    RollingWindow()
+    : _count(0)
+    , _nextIdx(0)
+    , _min(T())
+    , _max(T())
+    , _total(0)
+    , _minHead(0)
+    , _minLen(0)
+    , _maxHead(0)
+    , _maxLen(0)
+    {
+        for (auto &d: _data) {
+            d.store(T(), std::memory_order_relaxed);
+        }
+    };
+
+    void reset() {
+        const size_t seq = _seq.beginWrite();
+        _total = 0;
+        _minHead = _minLen = 0;
+        _maxHead = _maxLen = 0;
+        _count.store(0, std::memory_order_relaxed);
+        _nextIdx.store(0, std::memory_order_relaxed);
+        _seq.endWrite(seq);
+    }
+    void addValue(T value) {
+        const size_t seq = _seq.beginWrite();
+        const uint64_t k = _total++;
+        _data[k % N].store(value, std::memory_order_relaxed);
+
+        // Drop samples leaving the window, then those that can never be the
+        // extreme again while value is in the window.
+        if (_maxLen && _maxIdx[_maxHead] + N <= k) {
+            _maxHead = (_maxHead + 1) % N;
+            _maxLen--;
+        }
+        while (_maxLen && valueAt(_maxIdx[(_maxHead + _maxLen - 1) % N]) <= value) {
+            _maxLen--;
+        }
+        _maxIdx[(_maxHead + _maxLen) % N] = k;
+        _maxLen++;
+
+        if (_minLen && _minIdx[_minHead] + N <= k) {
+            _minHead = (_minHead + 1) % N;
+            _minLen--;
+        }
+        while (_minLen && valueAt(_minIdx[(_minHead + _minLen - 1) % N]) >= value) {
+            _minLen--;
+        }
+        _minIdx[(_minHead + _minLen) % N] = k;
+        _minLen++;
+
+        _count.store(std::min<uint64_t>(_total, N), std::memory_order_relaxed);
+        _nextIdx.store(_total % N, std::memory_order_relaxed);
+        _max.store(valueAt(_maxIdx[_maxHead]), std::memory_order_relaxed);
+        _min.store(valueAt(_minIdx[_minHead]), std::memory_order_relaxed);
+        _seq.endWrite(seq);
+    };
+    bool isFullyPopulated() const {
+        size_t count;
+        _seq.read([&] { count = _count.load(std::memory_order_relaxed); });
+        return count == N;
+    };
+    bool allValuesAreBelow(T limit) const {
+        size_t count;
+        T max;
+        _seq.read([&] {
+            count = _count.load(std::memory_order_relaxed);
+            max = _max.load(std::memory_order_relaxed);
+        });
+        return count == 0 || max < limit;
+    };
+    bool allValuesAreAbove(T limit) const {
+        size_t count;
+        T min;
+        _seq.read([&] {
+            count = _count.load(std::memory_order_relaxed);
+            min = _min.load(std::memory_order_relaxed);
+        });
+        return count == 0 || min > limit;
+    };
+    std::string getDataAsString() const {
+        T data[N];
+        size_t count;
+        size_t next_idx;
+        _seq.read([&] {
+            count = _count.load(std::memory_order_relaxed);
+            next_idx = _nextIdx.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < count; ++i) {
+                data[i] = _data[i].load(std::memory_order_relaxed);
+            }
+        });
+
+        std::stringstream ss;
+        size_t curr_idx = (next_idx == 0)? count - 1: next_idx - 1;
+        for (size_t idx = 0; idx < count; ++idx) {
+            if (idx == curr_idx) {
+                ss << "[ " << data[idx] << " ] ";
+            } else {
+                ss << data[idx] << " ";
+            }
+        }
+        return ss.str();
+    }
+private:
+    T valueAt(uint64_t k) const {
+        return _data[k % N].load(std::memory_order_relaxed);
+    }
+
+    // Published to readers
+    SeqCount _seq;
+    std::atomic<T> _data[N];
+    std::atomic<size_t> _count;
+    std::atomic<size_t> _nextIdx;
+    std::atomic<T> _min;
+    std::atomic<T> _max;
+    // Writer side state, sample numbers of the monotonic deques
+    uint64_t _total;
+    uint64_t _minIdx[N];
+    size_t _minHead;
+    size_t _minLen;
+    uint64_t _maxIdx[N];
+    size_t _maxHead;
+    size_t _maxLen;
+};
+
+template <typename T>
+class RollingWindow<T, 0> {
 public:
     explicit RollingWindow(size_t window_size)
     : _data()
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Sequence counter of a seqlock.
+ *
+ * The counter is odd while a write is in progress. Readers never block,
+ * they retry when the counter was odd or changed during their read. Writers
+ * serialize on the counter itself, so occasional extra writers (reset from
+ * another thread) are safe. Data guarded by the counter must be atomics
+ * accessed with relaxed ordering.
+ */
+class SeqCount {
+public:
+    SeqCount()
+    : mSeq(0)
+    {
+    }
+
+    size_t beginWrite() {
+        size_t seq = mSeq.load(std::memory_order_relaxed);
+        while ((seq & 1) || !mSeq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+            seq = mSeq.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return seq;
+    }
+
+    void endWrite(size_t seq) {
+        mSeq.store(seq + 2, std::memory_order_release);
+    }
+
+    template <typename F>
+    void read(F f) const {
+        size_t seq;
+        do {
+            seq = mSeq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue;
+            }
+            f();
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != mSeq.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<size_t> mSeq;
+};
+
+/*
+ * A trivially copyable value published through a seqlock.
+ *
+ * load() never blocks the writer and never sees a torn value.
+ */
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+    SeqLock() {
+        store(T{});
+    }
+
+    explicit SeqLock(const T &value) {
+        store(value);
+    }
+
+    T load() const {
+        uint64_t buf[words];
+        mSeq.read([&] {
+            for (size_t i = 0; i < words; ++i) {
+                buf[i] = mWords[i].load(std::memory_order_relaxed);
+            }
+        });
+        T value;
+        memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+
+    void store(const T &value) {
+        const size_t seq = mSeq.beginWrite();
+        write(value);
+        mSeq.endWrite(seq);
+    }
+
+    // Read-modify-write of the value, serialized with other writers. Readers
+    // retry while f runs, it should only modify the value.
+    template <typename F>
+    void update(F f) {
+        const size_t seq = mSeq.beginWrite();
+        uint64_t buf[words];
+        for (size_t i = 0; i < words; ++i) {
+            buf[i] = mWords[i].load(std::memory_order_relaxed);
+        }
+        T value;
+        memcpy(&value, buf, sizeof(T));
+        f(value);
+        write(value);
+        mSeq.endWrite(seq);
+    }
+
+private:
+    static const size_t words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    void write(const T &value) {
+        uint64_t buf[words] = {};
+        memcpy(buf, &value, sizeof(T));
+        for (size_t i = 0; i < words; ++i) {
+            mWords[i].store(buf[i], std::memory_order_relaxed);
+        }
+    }
+
+    SeqCount mSeq;
+    std::atomic<uint64_t> mWords[words];
+};
@@ -7,9 +7,11 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
-#include <sys/eventfd.h>
 #include <sys/epoll.h>
 
+#include "config_file.hpp"
+#include "flight_recorder.hpp"
+#include "perf_counters.hpp"
 #include "log.hpp"
 
 namespace {
@@ -40,7 +42,7 @@ static int method_get_on_battery_idle_limit(sd_bus_message *m, void *userdata, s
     const auto settings = settings_handler->getSettings();
 
     /* Reply with the response */
-    return sd_bus_reply_method_return(m, "i", settings.inactive_on_battery_limit);
+    return sd_bus_reply_method_return(m, "i", settings->inactive_on_battery_limit);
 }
 
 static int method_set_on_charger_idle_limit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
@@ -69,7 +71,7 @@ static int method_get_on_charger_idle_limit(sd_bus_message *m, void *userdata, s
     const auto settings = settings_handler->getSettings();
 
     /* Reply with the response */
-    return sd_bus_reply_method_return(m, "i", settings.inactive_on_charger_limit);
+    return sd_bus_reply_method_return(m, "i", settings->inactive_on_charger_limit);
 }
 
 static int method_set_sleep_enabled(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
@@ -96,7 +98,67 @@ static int method_get_sleep_enabled(sd_bus_message *m, void *userdata, sd_bus_er
     const auto settings = settings_handler->getSettings();
 
     /* Reply with the response */
-    return sd_bus_reply_method_return(m, "b", settings.sleep_enabled?1:0);
+    return sd_bus_reply_method_return(m, "b", settings->sleep_enabled?1:0);
+}
+
+static int method_dump_flight_recorder(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const bool dumped = g_flight_recorder.dump();
+    if (!dumped) {
+        LOG_ERROR("Failed to dump flight recorder: '%s' (%d)", strerror(errno), errno);
+    }
+
+    /* Reply with the response */
+    return sd_bus_reply_method_return(m, "b", dumped?1:0);
+}
+
+// a{st}: counter name to value
+static int append_perf_counters(sd_bus_message *m) {
+    int r = sd_bus_message_open_container(m, 'a', "{st}");
+    perf_for_each_counter([m, &r] (const char *name, uint64_t value) {
+        if (r >= 0) {
+            r = sd_bus_message_append(m, "{st}", name, value);
+        }
+    });
+    return r < 0 ? r : sd_bus_message_close_container(m);
+}
+
+// a{sat}: histogram name to count, sum and max in us, then the buckets
+static int append_perf_histograms(sd_bus_message *m) {
+    int r = sd_bus_message_open_container(m, 'a', "{sat}");
+    perf_for_each_histogram([m, &r] (const char *name, const PerfHistogram &h) {
+        uint64_t values[3 + PerfHistogram::buckets] = { h.count(), h.sumUsec(), h.maxUsec() };
+        for (size_t i = 0; i < PerfHistogram::buckets; ++i) {
+            values[3 + i] = h.bucket(i);
+        }
+        if (r >= 0) r = sd_bus_message_open_container(m, 'e', "sat");
+        if (r >= 0) r = sd_bus_message_append(m, "s", name);
+        if (r >= 0) r = sd_bus_message_append_array(m, 't', values, sizeof(values));
+        if (r >= 0) r = sd_bus_message_close_container(m);
+    });
+    return r < 0 ? r : sd_bus_message_close_container(m);
+}
+
+static int property_get_perf_counters(sd_bus *bus, const char *path, const char *interface,
+        const char *property, sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    return append_perf_counters(reply);
+}
+
+static int property_get_perf_histograms(sd_bus *bus, const char *path, const char *interface,
+        const char *property, sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    return append_perf_histograms(reply);
+}
+
+static int method_get_perf_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    sd_bus_message *reply = nullptr;
+    int r = sd_bus_message_new_method_return(m, &reply);
+    if (r >= 0) r = append_perf_counters(reply);
+    if (r >= 0) r = append_perf_histograms(reply);
+    if (r >= 0) r = sd_bus_send(nullptr, reply, nullptr);
+    sd_bus_message_unref(reply);
+    if (r < 0) {
+        LOG_ERROR("Failed to reply perf stats: %s", strerror(-r));
+    }
+    return r;
 }
 
 static const sd_bus_vtable settings_vtable[] = {
@@ -107,15 +169,79 @@ static const sd_bus_vtable settings_vtable[] = {
     SD_BUS_METHOD("GetOnACTimeToSleep", nullptr, "i", method_get_on_charger_idle_limit, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("SetSleepEnabled", "b", nullptr, method_set_sleep_enabled, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("GetSleepEnabled", nullptr, "b", method_get_sleep_enabled, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("DumpFlightRecorder", nullptr, "b", method_dump_flight_recorder, 0),
+    SD_BUS_METHOD("GetPerfStats", nullptr, "a{st}a{sat}", method_get_perf_stats, SD_BUS_VTABLE_UNPRIVILEGED),
+    // Read on every Get, the counters change too often to emit signals
+    SD_BUS_PROPERTY("PerfCounters", "a{st}", property_get_perf_counters, 0, 0),
+    SD_BUS_PROPERTY("PerfHistograms", "a{sat}", property_get_perf_histograms, 0, 0),
     SD_BUS_VTABLE_END
 };
 };
 
+settings_changes_t diff_settings(const settings_t &old_settings, const settings_t &new_settings) {
+    settings_changes_t changes = 0;
+    const auto check = [&changes] (bool changed, settings_field field) {
+        if (changed) {
+            changes |= settings_change(field);
+        }
+    };
+    check(old_settings.battery_monitor_mode != new_settings.battery_monitor_mode,
+          settings_field::BAT_MONITOR_MODE);
+    check(old_settings.battery_voltage_limit != new_settings.battery_voltage_limit,
+          settings_field::BAT_VOLTAGE_LIMIT);
+    check(old_settings.battery_capacity_limit != new_settings.battery_capacity_limit,
+          settings_field::BAT_PERCENTAGE_LIMIT);
+    check(old_settings.net_devices != new_settings.net_devices,
+          settings_field::NET_DEVICES);
+    check(old_settings.net_activity_limit != new_settings.net_activity_limit,
+          settings_field::NET_ACTIVITY_LIMIT);
+    check(old_settings.input_event_devices != new_settings.input_event_devices,
+          settings_field::INPUT_DEVICES);
+    check(old_settings.input_device_properties != new_settings.input_device_properties,
+          settings_field::INPUT_PROPERTIES);
+    check(old_settings.input_coalescing != new_settings.input_coalescing,
+          settings_field::INPUT_COALESCING);
+    check(old_settings.inactive_on_battery_limit != new_settings.inactive_on_battery_limit,
+          settings_field::INACT_ON_BAT_LIMIT);
+    check(old_settings.inactive_on_charger_limit != new_settings.inactive_on_charger_limit,
+          settings_field::INACT_ON_CHARGER_LIMIT);
+    check(old_settings.battery_name != new_settings.battery_name,
+          settings_field::NAME_BATTERY);
+    check(old_settings.charger_name != new_settings.charger_name,
+          settings_field::NAME_CHARGER);
+    check(old_settings.sleep_system_cmd != new_settings.sleep_system_cmd,
+          settings_field::CMD_SLEEP);
+    check(old_settings.shutdown_system_cmd != new_settings.shutdown_system_cmd,
+          settings_field::CMD_SHUTDOWN);
+    check(old_settings.sleep_enabled != new_settings.sleep_enabled,
+          settings_field::ENABLED_SLEEP);
+    check(old_settings.use_logind != new_settings.use_logind,
+          settings_field::USE_LOGIND);
+    check(old_settings.stats_target != new_settings.stats_target,
+          settings_field::STATS_TARGET);
+    check(old_settings.net_sample_min_interval != new_settings.net_sample_min_interval,
+          settings_field::NET_SAMPLE_MIN_INTERVAL);
+    check(old_settings.net_sample_max_interval != new_settings.net_sample_max_interval,
+          settings_field::NET_SAMPLE_MAX_INTERVAL);
+    check(old_settings.net_activity_window != new_settings.net_activity_window,
+          settings_field::NET_ACTIVITY_WINDOW);
+    check(old_settings.net_activity_percentile != new_settings.net_activity_percentile,
+          settings_field::NET_ACTIVITY_PERCENTILE);
+    check(old_settings.battery_shutdown_lead != new_settings.battery_shutdown_lead,
+          settings_field::BAT_SHUTDOWN_LEAD);
+    return changes;
+}
+
 SettingsHandler::SettingsHandler()
-: mDefaultSettings{}
-, mSettings{}
-, mAbortFD(-1)
+: mSources("settings", &g_perf.settings_wakeups)
+, mBus(nullptr)
+, mSlot(nullptr)
+, mBusFD(-1)
+, mBusTimer(-1)
+, mDefaultSettings{}
 {
+    // Matched against the device nodes of the udev input subsystem, so glob
+    // patterns such as "/dev/input/event*" may be used.
     mDefaultSettings.input_event_devices = {
         "/dev/input/event0",
         "/dev/input/event1",
@@ -123,49 +249,55 @@ SettingsHandler::SettingsHandler()
         "/dev/input/event3",
         "/dev/input/event4",
     };
+    mDefaultSettings.input_coalescing = true;
     mDefaultSettings.inactive_on_battery_limit = 0;
     mDefaultSettings.inactive_on_charger_limit = 0;
     mDefaultSettings.battery_voltage_limit = 3.2;
     mDefaultSettings.battery_capacity_limit = 5;
     mDefaultSettings.battery_monitor_mode = battery_monitor_mode_t::VOLTAGE;
+    mDefaultSettings.battery_shutdown_lead = 0;
     mDefaultSettings.net_activity_limit = 100;
     mDefaultSettings.net_devices = {
         "wlan0",
         "usb0",
         "p2p0",
     };
+    mDefaultSettings.net_sample_min_interval = 5;
+    mDefaultSettings.net_sample_max_interval = 60;
+    mDefaultSettings.net_activity_window = 0;
+    mDefaultSettings.net_activity_percentile = 0;
     mDefaultSettings.sleep_system_cmd = "systemctl suspend";
     mDefaultSettings.shutdown_system_cmd = "systemctl poweroff";
     mDefaultSettings.charger_name = "pf1550-charger";
     mDefaultSettings.battery_name = "battery";
     mDefaultSettings.sleep_enabled = true;
+    mDefaultSettings.use_logind = true;
+    mDefaultSettings.stats_target = "exec:/usr/bin/collect-statistics";
 
-    mSettings = mDefaultSettings;
+    mFileSettings = mDefaultSettings;
+    mSettings = std::make_shared<const settings_t>(mDefaultSettings);
 }
 
 SettingsHandler::~SettingsHandler()
 {
-    if (mAbortFD >= 0) {
-        uint64_t v = 1;
-        write(mAbortFD, &v, sizeof(v));
-        if (mDbusThread.joinable()) {
-            mDbusThread.join();
-        }
-        close(mAbortFD);
+    mSources.stop();
+    if (mSlot) {
+        sd_bus_slot_unref(mSlot);
+    }
+    if (mBus) {
+        sd_bus_unref(mBus);
     }
 }
 
 
-settings_t
-SettingsHandler::getSettings() {
-    LOG_DEBUG("Getting settings");
-    std::lock_guard<std::mutex> l(mMutex);
-    return mSettings;
+settings_snapshot_t
+SettingsHandler::getSettings() const {
+    return std::atomic_load_explicit(&mSettings, std::memory_order_acquire);
 }
 
 
 bool
-SettingsHandler::startDbusThread() {
+SettingsHandler::startDbus(EventLoop &loop) {
     sd_bus_slot *slot = NULL;
     sd_bus *bus = NULL;
     int r;
@@ -201,121 +333,106 @@ SettingsHandler::startDbusThread() {
         return false;
     }
 
-    int epollfd = epoll_create1(0);
-    struct epoll_event ev;
-    mAbortFD = eventfd(0, 0);
-    ev.events = EPOLLIN;
-    ev.data.fd = mAbortFD;
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, mAbortFD, &ev) == -1) {
-        LOG_ERROR("settings: epoll_ctl: sd_bus fd: '%s' (%d)", strerror(errno), errno);
+    mBus = bus;
+    mSlot = slot;
+
+    mSources.attach(loop);
+    mBusFD = sd_bus_get_fd(bus);
+    if (!mSources.addFd(mBusFD, EPOLLIN, [this] (uint32_t) { processDbus(); })) {
+        LOG_ERROR("settings: Failed to watch sd_bus fd.");
         return false;
     }
-    int bus_fd = sd_bus_get_fd(bus);
-    ev.events = EPOLLIN;
-    ev.data.fd = bus_fd;
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, bus_fd, &ev) == -1) {
-        LOG_ERROR("settings: epoll_ctl: sd_bus fd: '%s' (%d)", strerror(errno), errno);
+    mBusTimer = mSources.addTimer([this] (uint32_t) { processDbus(); });
+    if (mBusTimer == -1) {
+        LOG_ERROR("settings: Failed to create sd_bus timer.");
         return false;
     }
-    //uint64_t wait_usec;
-    //sd_bus_get_timeout(bus, &wait_usec);
-    //int wait = (wait_usec == uint64_t(-1))?-1:(wait_usec * 999)/1000;
-
-    mDbusThread = std::thread([bus, slot, abortfd = mAbortFD, epollfd]()
-    {
-        bool stop_thread = false;
-        for (;;) {
-            struct epoll_event ep_events[2];
-            int nfds = epoll_wait(epollfd, ep_events, 2, -1);
-            if (nfds == -1) {
-                if (errno != EINTR) {
-                    LOG_ERROR("settings: epoll_wait: '%s' (%d)", strerror(errno), errno);
-                }
-                continue;
-            }
-            for (int n = 0; n < nfds; ++n) {
-                if (ep_events[n].data.fd == abortfd) {
-                    stop_thread = true;
-                    break;
-                }
-            }
-            if (stop_thread) {
-                break;
-            }
-
-            /* Process requests */
-            int r = 0;
-            while((r = sd_bus_process(bus, NULL)) > 0);
-
-            if (r < 0) {
-                LOG_ERROR("settings: Failed to process bus: %s", strerror(-r));
-            }
-        }
-        sd_bus_slot_unref(slot);
-        sd_bus_unref(bus);
-        if (epollfd >= 0) {
-            close(epollfd);
-        }
-    });
 
+    return mSources.start();
+}
+
+void
+SettingsHandler::processDbus() {
+    /* Process requests */
+    int r = 0;
+    while((r = sd_bus_process(mBus, NULL)) > 0) {
+        g_perf.dbus_messages.add();
+    }
+
+    if (r < 0) {
+        LOG_ERROR("settings: Failed to process bus: %s", strerror(-r));
+    }
+    updateBusEvents();
+}
+
+void
+SettingsHandler::updateBusEvents() {
+    // Outgoing messages may be queued, and pending method calls time out.
+    const int events = sd_bus_get_events(mBus);
+    if (events >= 0) {
+        mSources.modifyFd(mBusFD, events);
+    }
+    uint64_t timeout_usec;
+    if (sd_bus_get_timeout(mBus, &timeout_usec) >= 0) {
+        // An absolute time in the past fires at once
+        const uint64_t timeout_ms = timeout_usec == UINT64_MAX ? 0 :
+            std::max<uint64_t>((timeout_usec + 999) / 1000, 1);
+        mSources.armTimerAt(mBusTimer, timeout_ms);
+    }
+}
+
+bool
+SettingsHandler::withBus(const std::function<void(sd_bus *bus)> &fn) {
+    if (!mBus) {
+        return false;
+    }
+    mSources.invoke([&] () {
+        fn(mBus);
+        updateBusEvents();
+    });
     return true;
 }
 
 bool
-SettingsHandler::generateSettings()
+SettingsHandler::generateSettings(settings_changes_t *changes)
 {
     LOG_DEBUG("Generating settings");
+    // Serializes the writers, readers only load the published snapshot
     std::lock_guard<std::mutex> l(mMutex);
+    const settings_snapshot_t old_settings = std::atomic_load_explicit(&mSettings, std::memory_order_acquire);
+    settings_t settings = mFileSettings;
     for (const auto &f :mDbusSettings) {
-        switch (f.first) {
-//            case settings_field::BAT_MONITOR_MODE:
-//            case settings_field::BAT_VOLTAGE_LIMIT:
-//            case settings_field::BAT_PERCENTAGE_LIMIT:
-//            case settings_field::NET_DEVICES:
-//            case settings_field::NET_ACTIVITY_LIMIT:
-//            case settings_field::INPUT_DEVICES:
-            case settings_field::INACT_ON_BAT_LIMIT:
-            {
-                std::stringstream ss(f.second);
-                int limit = -1;
-                ss >> limit;
-                mSettings.inactive_on_battery_limit = limit;
-                LOG_INFO("Applying on battery limit from dbus: '%s', %d",
-                        f.second.c_str(), mSettings.inactive_on_battery_limit);
-            }
-            break;
-
-            case settings_field::INACT_ON_CHARGER_LIMIT:
-            {
-                std::stringstream ss(f.second);
-                int limit = -1;
-                ss >> limit;
-                mSettings.inactive_on_charger_limit = limit;
-                LOG_INFO("Applying on charger limit from dbus: '%s', %d",
-                        f.second.c_str(), mSettings.inactive_on_charger_limit);
-            }
-            break;
-
-//            case settings_field::NAME_BATTERY:
-//            case settings_field::NAME_CHARGER:
-//            case settings_field::CMD_SLEEP:
-//            case settings_field::CMD_SHUTDOWN:
-            case settings_field::ENABLED_SLEEP:
-            {
-                auto enabled = f.second;
-                std::transform(enabled.begin(), enabled.end(), enabled.begin(),
-                    [](unsigned char c){ return std::tolower(c); });
-                mSettings.sleep_enabled = (enabled == "true");
-                LOG_INFO("Applying enabled sleep setting from dbus: '%s', %d",
-                        f.second.c_str(), mSettings.sleep_enabled);
-            }
-            break;
-
-            default:
-                LOG_ERROR("Generate settings, settings field not handled.");
+        const std::string &value = f.second;
+        if (!parse_setting_value(settings, f.first, value.data(), value.data() + value.size())) {
+            LOG_ERROR("Ignoring invalid %s from dbus: '%s'", settings_field_name(f.first), value.c_str());
+            continue;
         }
+        LOG_INFO("Applying %s from dbus: '%s'", settings_field_name(f.first), value.c_str());
     }
 
+    const settings_changes_t diff = diff_settings(*old_settings, settings);
+    if (diff) {
+        std::atomic_store_explicit(&mSettings, std::make_shared<const settings_t>(std::move(settings)),
+                                   std::memory_order_release);
+    }
+    if (changes) {
+        *changes = diff;
+    }
+    return true;
+}
+
+bool
+SettingsHandler::loadConfigFile(const std::string &path)
+{
+    settings_t settings = mDefaultSettings;
+    std::string error;
+    if (!read_config_file(path, settings, error)) {
+        LOG_ERROR("settings: Ignoring config file '%s': %s", path.c_str(), error.c_str());
+        return false;
+    }
+    LOG_DEBUG("settings: Read config file '%s'", path.c_str());
+    std::lock_guard<std::mutex> l(mMutex);
+    mFileSettings = std::move(settings);
     return true;
 }
 
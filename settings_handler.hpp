@@ -1,44 +1,57 @@
 #pragma once
+#include <functional>
 #include <string>
 #include <unordered_map>
-#include <thread>
 #include <mutex>
 
 #include "types.hpp"
+#include "event_loop.hpp"
 
-enum class settings_field {
-    BAT_MONITOR_MODE,
-    BAT_VOLTAGE_LIMIT,
-    BAT_PERCENTAGE_LIMIT,
-    NET_DEVICES,
-    NET_ACTIVITY_LIMIT,
-    INPUT_DEVICES,
-    INACT_ON_BAT_LIMIT,
-    INACT_ON_CHARGER_LIMIT,
-    NAME_BATTERY,
-    NAME_CHARGER,
-    CMD_SLEEP,
-    CMD_SHUTDOWN,
-    ENABLED_SLEEP,
-};
+struct sd_bus;
+struct sd_bus_slot;
+
+// Bit set of the fields that differ between two settings.
+settings_changes_t diff_settings(const settings_t &old_settings, const settings_t &new_settings);
 
 class SettingsHandler {
 public:
     SettingsHandler();
     ~SettingsHandler();
 
-    settings_t getSettings();
-    bool generateSettings();
-    bool startDbusThread();
+    // The current snapshot, without locking or copying the settings. May be
+    // called from any thread.
+    settings_snapshot_t getSettings() const;
+    // Reads the config file layered over the defaults, generateSettings()
+    // applies it. A file which fails to parse is logged and the previous
+    // values are kept.
+    bool loadConfigFile(const std::string &path);
+    // Rebuilds the settings from the defaults, the config file and the
+    // D-Bus overrides, in that order, and publishes a new snapshot if any
+    // field changed. changes is set to the fields that differ.
+    bool generateSettings(settings_changes_t *changes = nullptr);
+    bool startDbus(EventLoop &loop);
 
     void addDbusSetting(settings_field field, const std::string &content);
 
+    // Runs fn with the system bus on the thread processing it, so other
+    // components may share the connection. False if D-Bus is not started.
+    bool withBus(const std::function<void(sd_bus *bus)> &fn);
+
 private:
+    void processDbus();
+    void updateBusEvents();
+
     std::mutex mMutex;
-    std::thread mDbusThread;
+    EventSourceGroup mSources;
+    sd_bus *mBus;
+    sd_bus_slot *mSlot;
+    int mBusFD;
+    // Fires at the sd-bus timeout, e.g. of a pending method call
+    int mBusTimer;
     settings_t mDefaultSettings;
-    settings_t mSettings;
-    int mAbortFD;
+    // The defaults with the config file applied
+    settings_t mFileSettings;
+    // Only accessed with std::atomic_load() and std::atomic_store()
+    settings_snapshot_t mSettings;
     std::unordered_map<settings_field, std::string> mDbusSettings;
-    std::unordered_map<settings_field, std::string> mConfigFilesettings;
 };
@@ -1,11 +1,25 @@
 #include "state_handler.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 
 #include "log.hpp"
 
 
+bool network_is_active(const settings_t &settings, const network_status_t &net) {
+    if (settings.net_activity_window <= 0) {
+        return net.max_traffic_last_period >= settings.net_activity_limit;
+    }
+    if (settings.net_activity_percentile <= 0) {
+        return net.window_traffic >= settings.net_activity_limit;
+    }
+    // The nearest-rank percentile of the bucket rates reaches the limit
+    // when more than (100 - percentile)% of the buckets do
+    return uint64_t(net.busy_buckets) * 100 >
+           uint64_t(net.window_buckets) * (100 - std::min(settings.net_activity_percentile, 100));
+}
+
 state_t get_new_state(const state_t current_state,
         const settings_t &settings,
         const status_t &status,
@@ -29,7 +43,14 @@ state_t get_new_state(const state_t current_state,
         }
     }
 
-    if (settings.sleep_enabled && status.net.max_traffic_last_period < settings.net_activity_limit &&
+    const timestamp_t battery_deadline = get_battery_deadline(settings, status.bat);
+    if (battery_deadline != no_deadline && now >= battery_deadline) {
+        LOG_WARNING("Battery predicted to reach its limit in %lld seconds, will perform shutdown command.",
+                (long long)battery_deadline + settings.battery_shutdown_lead - now);
+        return state_t::SHUTDOWN;
+    }
+
+    if (settings.sleep_enabled && !network_is_active(settings, status.net) &&
             ((!status.input.charger_online && settings.inactive_on_battery_limit > 0 &&
              now > (status.input.event_time + settings.inactive_on_battery_limit)) ||
              (status.input.charger_online && settings.inactive_on_charger_limit > 0 &&
@@ -43,3 +64,63 @@ state_t get_new_state(const state_t current_state,
 
     return state_t::ACTIVE;
 }
+
+timestamp_t get_battery_deadline(const settings_t &settings, const battery_status_t &bat) {
+    if (settings.battery_shutdown_lead <= 0) {
+        return no_deadline;
+    }
+    timestamp_t limit_time = no_deadline;
+    if (settings.battery_monitor_mode == battery_monitor_mode_t::BOTH ||
+        settings.battery_monitor_mode == battery_monitor_mode_t::VOLTAGE) {
+        limit_time = std::min(limit_time, bat.voltage_limit_time);
+    }
+    if (settings.battery_monitor_mode == battery_monitor_mode_t::BOTH ||
+        settings.battery_monitor_mode == battery_monitor_mode_t::PERCENTAGE) {
+        limit_time = std::min(limit_time, bat.capacity_limit_time);
+    }
+    if (limit_time == no_deadline) {
+        return no_deadline;
+    }
+    const timestamp_t lead = timestamp_t(settings.battery_shutdown_lead);
+    return limit_time > lead ? limit_time - lead : 0;
+}
+
+timestamp_t get_idle_deadline(const settings_t &settings, const status_t &status) {
+    if (!settings.sleep_enabled) {
+        return no_deadline;
+    }
+    const int limit = status.input.charger_online ?
+        settings.inactive_on_charger_limit : settings.inactive_on_battery_limit;
+    if (limit <= 0) {
+        return no_deadline;
+    }
+    // get_new_state() requires now > event_time + limit
+    return status.input.event_time + limit + 1;
+}
+
+timestamp_t get_next_deadline(const state_t current_state,
+        const settings_t &settings,
+        const status_t &status,
+        const timestamp_t &now) {
+    // Leaving SLEEP or SHUTDOWN depends on any new input activity, which
+    // the input monitor does not notify about, keep re-evaluating each second.
+    if (current_state != state_t::ACTIVE) {
+        return now + 1;
+    }
+
+    // Battery and network decisions only change with new samples, the
+    // monitors notify about those. Only the idle limit and the predicted
+    // battery limits depend on time.
+    timestamp_t deadline = get_battery_deadline(settings, status.bat);
+    if (deadline <= now) {
+        deadline = no_deadline;
+    }
+    if (!network_is_active(settings, status.net)) {
+        const timestamp_t idle_deadline = get_idle_deadline(settings, status);
+        if (idle_deadline != no_deadline && idle_deadline > now) {
+            deadline = std::min(deadline, idle_deadline);
+        }
+    }
+
+    return deadline;
+}
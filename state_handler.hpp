@@ -1,4 +1,6 @@
 #pragma once
+#include <stdint.h>
+
 #include "types.hpp"
 
 typedef enum class state {
@@ -7,7 +9,30 @@ typedef enum class state {
     SHUTDOWN,
 } state_t;
 
+// True if the network traffic keeps the system awake, judged on the last
+// sample or on the net_activity_window.
+bool network_is_active(const settings_t &settings, const network_status_t &net);
+
 state_t get_new_state(const state_t current_state,
         const settings_t &settings,
         const status_t &status,
         const timestamp_t &now);
+
+// Returned by get_next_deadline() when only a status change can alter the state.
+const timestamp_t no_deadline = UINT32_MAX;
+
+// Time at which the idle limit runs out, whatever the network traffic, or
+// no_deadline if sleep is disabled. May be in the past.
+timestamp_t get_idle_deadline(const settings_t &settings, const status_t &status);
+
+// Time from which get_new_state() shuts down because a monitored battery
+// value is predicted to reach its limit within battery_shutdown_lead, or
+// no_deadline without a lead or a falling trend.
+timestamp_t get_battery_deadline(const settings_t &settings, const battery_status_t &bat);
+
+// Earliest time at which get_new_state() could return a different state if
+// the status stays unchanged.
+timestamp_t get_next_deadline(const state_t current_state,
+        const settings_t &settings,
+        const status_t &status,
+        const timestamp_t &now);
@@ -0,0 +1,175 @@
+#include "stats_sink.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "log.hpp"
+
+namespace {
+const char unix_prefix[] = "unix:";
+const char exec_prefix[] = "exec:";
+
+bool has_prefix(const std::string &target, const char *prefix, size_t len) {
+    return target.compare(0, len, prefix) == 0;
+}
+
+std::string shell_quote(const char *arg) {
+    std::string quoted = "'";
+    for (const char *c = arg; *c; ++c) {
+        if (*c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += *c;
+        }
+    }
+    return quoted + "'";
+}
+
+int open_target(const std::string &target) {
+    if (!has_prefix(target, unix_prefix, sizeof(unix_prefix) - 1)) {
+        return open(target.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    }
+
+    const std::string path = target.substr(sizeof(unix_prefix) - 1);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+}
+
+StatsSink::StatsSink(EventLoop &loop, const std::string &target)
+: mLoop(loop)
+, mLauncher(loop)
+, mTarget(target)
+, mFlushTimer(-1)
+, mFlushPending(false)
+, mFlushed(0)
+, mDropped(0)
+{
+    mQueue.reserve(capacity);
+    mFlushTimer = mLoop.addTimer([this] (uint32_t) {
+        mFlushPending = false;
+        if (!flushNow()) {
+            mFlushPending = mLoop.armTimer(mFlushTimer, flush_delay_ms, 0);
+        }
+    });
+}
+
+StatsSink::~StatsSink() {
+    flushNow();
+    if (mFlushTimer >= 0) {
+        mLoop.removeTimer(mFlushTimer);
+    }
+}
+
+void
+StatsSink::setTarget(const std::string &target) {
+    mTarget = target;
+}
+
+void
+StatsSink::record(const char *event_id) {
+    if (mQueue.size() >= capacity) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    event_t event;
+    event.time = ::time(nullptr);
+    snprintf(event.id, sizeof(event.id), "%s", event_id);
+    mQueue.push_back(event);
+
+    if (mQueue.size() >= batch_size) {
+        mLoop.armTimer(mFlushTimer, 1, 0);
+        mFlushPending = true;
+    } else if (!mFlushPending) {
+        mFlushPending = mLoop.armTimer(mFlushTimer, flush_delay_ms, 0);
+    }
+}
+
+bool
+StatsSink::flushNow() {
+    if (mQueue.empty()) {
+        return true;
+    }
+    if (has_prefix(mTarget, exec_prefix, sizeof(exec_prefix) - 1)) {
+        if (!runCollector(mTarget.substr(sizeof(exec_prefix) - 1))) {
+            return false;
+        }
+        mFlushed.fetch_add(mQueue.size(), std::memory_order_relaxed);
+        mQueue.clear();
+        return true;
+    }
+
+    // Same fields as the collect-statistics command line
+    std::string batch;
+    batch.reserve(mQueue.size() * 96);
+    char line[128];
+    for (const auto &e: mQueue) {
+        snprintf(line, sizeof(line), "%lld event-id=%s event-source=flir-activity-monitor event-type=info\n",
+                 static_cast<long long>(e.time), e.id);
+        batch += line;
+    }
+    if (!writeBatch(batch)) {
+        return false;
+    }
+
+    mFlushed.fetch_add(mQueue.size(), std::memory_order_relaxed);
+    LOG_DEBUG("stats: Flushed %zu events (%llu flushed, %llu dropped in total).", mQueue.size(),
+              static_cast<unsigned long long>(flushed()), static_cast<unsigned long long>(dropped()));
+    mQueue.clear();
+    return true;
+}
+
+bool
+StatsSink::writeBatch(const std::string &batch) {
+    const int fd = open_target(mTarget);
+    if (fd == -1) {
+        LOG_WARNING("stats: Can't open '%s': '%s' (%d)", mTarget.c_str(), strerror(errno), errno);
+        return false;
+    }
+    // One write() keeps the batch in one piece in the spool file or datagram
+    const ssize_t len = write(fd, batch.data(), batch.size());
+    const int err = errno;
+    close(fd);
+    if (len != ssize_t(batch.size())) {
+        LOG_WARNING("stats: Failed to write '%s': '%s' (%d)", mTarget.c_str(),
+                    len == -1 ? strerror(err) : "short write", len == -1 ? err : 0);
+        return false;
+    }
+    return true;
+}
+
+bool
+StatsSink::runCollector(const std::string &collector) {
+    const std::string command = shell_quote(collector.c_str());
+    std::string script;
+    for (const auto &e: mQueue) {
+        if (!script.empty()) {
+            script += "; ";
+        }
+        script += command + " --event-id " + shell_quote(e.id) +
+            " --field event-source=flir-activity-monitor --field event-type=info";
+    }
+    return mLauncher.launch(script, collector_timeout_ms, [] (int) {}) != -1;
+}
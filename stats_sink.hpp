@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "event_loop.hpp"
+#include "process_launcher.hpp"
+
+/*
+ * Usage statistics events, replacing a collect-statistics run per event.
+ *
+ * record() only appends to a bounded in-memory queue. The loop writes the
+ * queue in one batch to a spool file, or as one datagram to a collector's
+ * Unix socket, once batch_size events are pending or flush_delay_ms after
+ * the first one. flushNow() writes synchronously, e.g. before shutdown.
+ * Events are kept for the next flush if the target is unavailable, and
+ * dropped when the queue is full.
+ *
+ * An "exec:" target keeps the collect-statistics command line contract:
+ * a flush starts one shell running the collector once per event, with the
+ * arguments the daemon used to pass it, and does not wait for it.
+ */
+class StatsSink {
+public:
+    static constexpr size_t capacity = 64;
+    static constexpr size_t batch_size = 16;
+    static constexpr int flush_delay_ms = 60000;
+
+    // Collector runs still going after this long are terminated
+    static constexpr int collector_timeout_ms = 60000;
+
+    // target is a spool file path, "unix:" followed by a socket path or
+    // "exec:" followed by the collector's path.
+    StatsSink(EventLoop &loop, const std::string &target);
+    ~StatsSink();
+    StatsSink(const StatsSink &) = delete;
+    StatsSink &operator=(const StatsSink &) = delete;
+
+    void setTarget(const std::string &target);
+    void record(const char *event_id);
+    // Returns true if the queue is empty afterwards.
+    bool flushNow();
+
+    size_t pending() const { return mQueue.size(); }
+    uint64_t flushed() const { return mFlushed.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    struct event_t {
+        int64_t time;
+        char id[48];
+    };
+
+    bool writeBatch(const std::string &batch);
+    bool runCollector(const std::string &collector);
+
+    EventLoop &mLoop;
+    ProcessLauncher mLauncher;
+    std::string mTarget;
+    std::vector<event_t> mQueue;
+    int mFlushTimer;
+    bool mFlushPending;
+    std::atomic<uint64_t> mFlushed;
+    std::atomic<uint64_t> mDropped;
+};
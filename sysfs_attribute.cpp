@@ -0,0 +1,171 @@
+#include "sysfs_attribute.hpp"
+
+#include <charconv>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "perf_counters.hpp"
+
+namespace {
+// sysfs attributes are at most one page.
+const size_t max_attribute_size = 4096;
+const size_t max_value_size = 32;
+
+bool match_key(const char *line, const char *eol, const char *key, size_t key_len, const char **value) {
+    if (size_t(eol - line) <= key_len || memcmp(line, key, key_len) != 0 || line[key_len] != '=') {
+        return false;
+    }
+    *value = line + key_len + 1;
+    return true;
+}
+}
+
+bool parse_sysfs_int(const char *first, const char *last, int64_t &value) {
+    while (first < last && (*first == ' ' || *first == '\t')) {
+        ++first;
+    }
+    const auto result = std::from_chars(first, last, value);
+    return result.ec == std::errc() && result.ptr != first;
+}
+
+SysfsAttribute::SysfsAttribute()
+: mFD(-1)
+{
+}
+
+SysfsAttribute::SysfsAttribute(const std::string &path)
+: mPath(path)
+, mFD(-1)
+{
+    reopen();
+}
+
+SysfsAttribute::SysfsAttribute(SysfsAttribute &&other)
+: mPath(std::move(other.mPath))
+, mFD(other.mFD)
+{
+    other.mFD = -1;
+}
+
+SysfsAttribute &
+SysfsAttribute::operator=(SysfsAttribute &&other) {
+    if (this != &other) {
+        close();
+        mPath = std::move(other.mPath);
+        mFD = other.mFD;
+        other.mFD = -1;
+    }
+    return *this;
+}
+
+SysfsAttribute::~SysfsAttribute() {
+    close();
+}
+
+void
+SysfsAttribute::setPath(const std::string &path) {
+    close();
+    mPath = path;
+    reopen();
+}
+
+bool
+SysfsAttribute::reopen() {
+    if (mFD >= 0) {
+        return true;
+    }
+    if (mPath.empty()) {
+        return false;
+    }
+    mFD = open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+    return mFD >= 0;
+}
+
+void
+SysfsAttribute::close() {
+    if (mFD >= 0) {
+        ::close(mFD);
+        mFD = -1;
+    }
+}
+
+ssize_t
+SysfsAttribute::readRaw(char *buf, size_t size) {
+    if (!reopen()) {
+        return -1;
+    }
+    g_perf.sysfs_reads.add();
+    PerfTimer timer(g_perf.sysfs_read_latency);
+    const ssize_t len = pread(mFD, buf, size, 0);
+    if (len < 0) {
+        close();
+    }
+    return len;
+}
+
+int64_t
+SysfsAttribute::readInt(int64_t failed_value) {
+    char buf[max_value_size];
+    const ssize_t len = readRaw(buf, sizeof(buf));
+    int64_t value;
+    if (len <= 0 || !parse_sysfs_int(buf, buf + len, value)) {
+        return failed_value;
+    }
+    return value;
+}
+
+power_supply_values_t power_supply_failed_values() {
+    return {
+        .voltage_now = -1000000,
+        .capacity = -1,
+        .online = -1,
+    };
+}
+
+void parse_power_supply_uevent(const char *buf, size_t len, power_supply_values_t &values) {
+    static const char voltage_key[] = "POWER_SUPPLY_VOLTAGE_NOW";
+    static const char capacity_key[] = "POWER_SUPPLY_CAPACITY";
+    static const char online_key[] = "POWER_SUPPLY_ONLINE";
+
+    const char *end = buf + len;
+    const char *line = buf;
+    while (line < end) {
+        const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (!eol) {
+            eol = end;
+        }
+        const char *value;
+        int64_t v;
+        if (match_key(line, eol, voltage_key, sizeof(voltage_key) - 1, &value)) {
+            if (parse_sysfs_int(value, eol, v)) {
+                values.voltage_now = v;
+            }
+        } else if (match_key(line, eol, capacity_key, sizeof(capacity_key) - 1, &value)) {
+            if (parse_sysfs_int(value, eol, v)) {
+                values.capacity = v;
+            }
+        } else if (match_key(line, eol, online_key, sizeof(online_key) - 1, &value)) {
+            if (parse_sysfs_int(value, eol, v)) {
+                values.online = v;
+            }
+        }
+        line = eol + 1;
+    }
+}
+
+power_supply_values_t read_power_supply(SysfsAttribute &uevent) {
+    auto values = power_supply_failed_values();
+    char buf[max_attribute_size];
+    const ssize_t len = uevent.readRaw(buf, sizeof(buf));
+    if (len > 0) {
+        parse_power_supply_uevent(buf, len, values);
+    }
+    return values;
+}
+
+int64_t read_sysfs_int(const std::string &path, int64_t failed_value) {
+    SysfsAttribute attribute(path);
+    return attribute.readInt(failed_value);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A sysfs attribute kept open between samples.
+ *
+ * Every read is a single pread() at offset 0 into a stack buffer, parsed
+ * with std::from_chars. If a read fails the fd is dropped and the next read
+ * reopens the path, so attributes of re-probed devices recover.
+ */
+class SysfsAttribute {
+public:
+    SysfsAttribute();
+    explicit SysfsAttribute(const std::string &path);
+    SysfsAttribute(SysfsAttribute &&other);
+    SysfsAttribute &operator=(SysfsAttribute &&other);
+    SysfsAttribute(const SysfsAttribute &) = delete;
+    SysfsAttribute &operator=(const SysfsAttribute &) = delete;
+    ~SysfsAttribute();
+
+    void setPath(const std::string &path);
+    const std::string &path() const { return mPath; }
+
+    // Integer value of the attribute, failed_value if it can not be read.
+    int64_t readInt(int64_t failed_value);
+    // Raw content, returns the number of bytes read or -1.
+    ssize_t readRaw(char *buf, size_t size);
+
+private:
+    bool reopen();
+    void close();
+
+    std::string mPath;
+    int mFD;
+};
+
+// Parses a sysfs integer, leading blanks and trailing text are ignored.
+bool parse_sysfs_int(const char *first, const char *last, int64_t &value);
+
+// Values of a power_supply uevent file, fields missing in the file keep
+// the failed values used by the single attribute readers.
+typedef struct {
+    int64_t voltage_now;
+    int64_t capacity;
+    int64_t online;
+} power_supply_values_t;
+
+power_supply_values_t power_supply_failed_values();
+
+// Parses POWER_SUPPLY_* lines from the content of a power_supply uevent file.
+void parse_power_supply_uevent(const char *buf, size_t len, power_supply_values_t &values);
+
+// Reads voltage_now, capacity and online with a single read of the uevent file.
+power_supply_values_t read_power_supply(SysfsAttribute &uevent);
+
+// One-shot read for attributes sampled too rarely to keep open.
+int64_t read_sysfs_int(const std::string &path, int64_t failed_value);
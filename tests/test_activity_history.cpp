@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+
+#include "../activity_history.hpp"
+
+namespace {
+const uint64_t second_usec = 1000000;
+}
+
+TEST(ActivityHistory, SpreadsSamplesOverTheBuckets) {
+    ActivityHistory history;
+    // 100 packets over 10 s, then 7 packets over the next 5 s
+    history.add(100 * second_usec, 110 * second_usec, 100);
+    history.add(110 * second_usec, 115 * second_usec, 7);
+
+    for (size_t age = 1; age <= 5; ++age) {
+        EXPECT_EQ(history.bucket(0, age + 5), 10u) << age;
+    }
+    uint64_t total = 0;
+    for (size_t age = 1; age <= 4; ++age) {
+        total += history.bucket(0, age);
+    }
+    // The last second of the second sample is still filling
+    EXPECT_EQ(total, 5u);
+    EXPECT_EQ(history.bucket(1, 1), 100u);
+    EXPECT_EQ(history.bucket(1, 2), 0u);
+}
+
+TEST(ActivityHistory, MeanRateOverTheWindow) {
+    ActivityHistory history;
+    history.setWindow(30, 10);
+    EXPECT_EQ(history.meanRate(), 0);
+
+    history.add(0, 10 * second_usec, 600);
+    EXPECT_EQ(history.windowBuckets(), 9u);
+    EXPECT_DOUBLE_EQ(history.meanRate(), 60);
+
+    // The busy seconds leave the 30 s window
+    history.add(10 * second_usec, 60 * second_usec, 0);
+    EXPECT_EQ(history.windowBuckets(), 30u);
+    EXPECT_DOUBLE_EQ(history.meanRate(), 0);
+    EXPECT_EQ(history.busyBuckets(), 0u);
+}
+
+TEST(ActivityHistory, CountsBusyBuckets) {
+    ActivityHistory history;
+    history.setWindow(60, 5);
+    // One second burst, then a trickle of 2 packets/s
+    history.add(0, second_usec, 500);
+    history.add(second_usec, 61 * second_usec, 120);
+    history.add(61 * second_usec, 62 * second_usec, 2);
+    EXPECT_EQ(history.windowBuckets(), 60u);
+    EXPECT_EQ(history.busyBuckets(), 0u);
+    EXPECT_DOUBLE_EQ(history.meanRate(), 2);
+
+    // Changing the window keeps the history, past 60 s it moves to the 10 s
+    // buckets where the burst still is
+    history.setWindow(62, 5);
+    EXPECT_EQ(history.windowBuckets(), 6u);
+    EXPECT_EQ(history.busyBuckets(), 1u);
+}
+
+TEST(ActivityHistory, LongWindowsUseCoarserBuckets) {
+    ActivityHistory history;
+    history.setWindow(600, 1);
+    for (uint64_t t = 0; t < 1260; t += 60) {
+        history.add(t * second_usec, (t + 60) * second_usec, t < 600 ? 6000 : 0);
+    }
+    // 10 s buckets, the last 600 s are quiet
+    EXPECT_EQ(history.windowBuckets(), 60u);
+    EXPECT_DOUBLE_EQ(history.meanRate(), 0);
+
+    // Clamped to an hour of 60 s buckets
+    history.setWindow(ActivityHistory::max_window_sec * 2, 1);
+    EXPECT_EQ(history.windowBuckets(), 20u);
+    EXPECT_EQ(history.busyBuckets(), 10u);
+    EXPECT_DOUBLE_EQ(history.meanRate(), 60000.0 / 1200);
+}
+
+TEST(ActivityHistory, GapsAreEmptyBuckets) {
+    ActivityHistory history;
+    history.setWindow(10, 1);
+    history.add(0, 10 * second_usec, 1000);
+    EXPECT_EQ(history.busyBuckets(), 9u);
+    // Far longer than the rings
+    history.add(100000 * second_usec, 100001 * second_usec, 0);
+    EXPECT_EQ(history.windowBuckets(), 10u);
+    EXPECT_EQ(history.busyBuckets(), 0u);
+    EXPECT_EQ(history.meanRate(), 0);
+}
@@ -0,0 +1,44 @@
+#include "gtest/gtest.h"
+
+#include <math.h>
+
+#include "../battery_monitor.hpp"
+#include "../state_handler.hpp"
+
+namespace {
+const uint64_t second_usec = 1000000;
+}
+
+TEST(BatteryMonitor, SampleIntervalFollowsThePrediction) {
+    // Unknown, or at the limit already
+    EXPECT_EQ(next_battery_sample_ms(0, 10000, 300000), 10000);
+    // A full window of samples before the limit
+    EXPECT_EQ(next_battery_sample_ms(1000, 10000, 300000), 100000);
+    EXPECT_EQ(next_battery_sample_ms(50, 10000, 300000), 10000);
+    EXPECT_EQ(next_battery_sample_ms(36000, 10000, 300000), 300000);
+    EXPECT_EQ(next_battery_sample_ms(INFINITY, 10000, 300000), 300000);
+}
+
+TEST(BatteryMonitor, TrendsPredictTheLimitTimes) {
+    settings_t settings = {};
+    settings.battery_voltage_limit = 3.3;
+    settings.battery_capacity_limit = 5;
+    battery_window_t voltage;
+    battery_window_t capacity;
+    DischargeTrend voltage_trend;
+    DischargeTrend capacity_trend;
+
+    // Voltage falls 1 mV/s from 3.8 V, the capacity read fails
+    auto values = power_supply_failed_values();
+    for (uint64_t t = 0; t <= 100; t += 10) {
+        values.voltage_now = 3800000 - 1000 * t;
+        add_battery_trend_sample(voltage_trend, capacity_trend, (1000 + t) * second_usec, values);
+    }
+    EXPECT_TRUE(voltage_trend.valid());
+    EXPECT_FALSE(capacity_trend.valid());
+
+    const auto status = evaluate_battery_windows(voltage, capacity, voltage_trend, capacity_trend, settings);
+    EXPECT_FALSE(status.valid);
+    EXPECT_NEAR(status.voltage_limit_time, 1100 + 400, 1);
+    EXPECT_EQ(status.capacity_limit_time, no_deadline);
+}
@@ -0,0 +1,167 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../config_file.hpp"
+
+namespace {
+bool parse(const std::string &content, settings_t &settings, std::string &error) {
+    return parse_config(content.data(), content.size(), settings, error);
+}
+
+void write_file(const std::string &path, const std::string &content) {
+    std::ofstream f(path, std::ios::trunc);
+    f << content;
+}
+}
+
+TEST(ConfigFile, ParsesEveryField) {
+    const std::string content =
+        "battery_monitor_mode = both\n"
+        "battery_voltage_limit = 3.4\n"
+        "battery_capacity_limit = 7\n"
+        "battery_shutdown_lead = 900\n"
+        "net_devices = wlan0, usb0\n"
+        "net_activity_limit = 12.5\n"
+        "net_sample_min_interval = 2\n"
+        "net_sample_max_interval = 120\n"
+        "net_activity_window = 600\n"
+        "net_activity_percentile = 90\n"
+        "input_event_devices = /dev/input/event*\n"
+        "input_device_properties = ID_INPUT_KEY,ID_INPUT_TOUCHSCREEN\n"
+        "input_coalescing = off\n"
+        "inactive_on_battery_limit = 1800\n"
+        "inactive_on_charger_limit = -1\n"
+        "battery_name = bq27441\n"
+        "charger_name = ac\n"
+        "sleep_system_cmd = echo mem > /sys/power/state\n"
+        "shutdown_system_cmd = poweroff -f\n"
+        "sleep_enabled = no\n"
+        "use_logind = false\n"
+        "stats_target = unix:/run/stats.sock\n";
+    settings_t settings = {};
+    std::string error;
+    ASSERT_TRUE(parse(content, settings, error)) << error;
+
+    EXPECT_EQ(settings.battery_monitor_mode, battery_monitor_mode_t::BOTH);
+    EXPECT_DOUBLE_EQ(settings.battery_voltage_limit, 3.4);
+    EXPECT_DOUBLE_EQ(settings.battery_capacity_limit, 7);
+    EXPECT_EQ(settings.battery_shutdown_lead, 900);
+    EXPECT_EQ(settings.net_devices, (std::vector<std::string>{ "wlan0", "usb0" }));
+    EXPECT_DOUBLE_EQ(settings.net_activity_limit, 12.5);
+    EXPECT_EQ(settings.net_sample_min_interval, 2);
+    EXPECT_EQ(settings.net_sample_max_interval, 120);
+    EXPECT_EQ(settings.net_activity_window, 600);
+    EXPECT_EQ(settings.net_activity_percentile, 90);
+    EXPECT_EQ(settings.input_event_devices, std::vector<std::string>{ "/dev/input/event*" });
+    EXPECT_EQ(settings.input_device_properties,
+              (std::vector<std::string>{ "ID_INPUT_KEY", "ID_INPUT_TOUCHSCREEN" }));
+    EXPECT_FALSE(settings.input_coalescing);
+    EXPECT_EQ(settings.inactive_on_battery_limit, 1800);
+    EXPECT_EQ(settings.inactive_on_charger_limit, -1);
+    EXPECT_EQ(settings.battery_name, "bq27441");
+    EXPECT_EQ(settings.charger_name, "ac");
+    EXPECT_EQ(settings.sleep_system_cmd, "echo mem > /sys/power/state");
+    EXPECT_EQ(settings.shutdown_system_cmd, "poweroff -f");
+    EXPECT_FALSE(settings.sleep_enabled);
+    EXPECT_FALSE(settings.use_logind);
+    EXPECT_EQ(settings.stats_target, "unix:/run/stats.sock");
+}
+
+TEST(ConfigFile, KeepsFieldsNotInTheFile) {
+    settings_t settings = {};
+    settings.charger_name = "pf1550-charger";
+    settings.net_devices = { "wlan0" };
+    std::string error;
+    ASSERT_TRUE(parse("# Comment\n\n   \t\r\n  sleep_enabled=1  \r\n# net_devices = usb0", settings, error))
+        << error;
+    EXPECT_TRUE(settings.sleep_enabled);
+    EXPECT_EQ(settings.charger_name, "pf1550-charger");
+    EXPECT_EQ(settings.net_devices, std::vector<std::string>{ "wlan0" });
+
+    // An empty list clears the field
+    ASSERT_TRUE(parse("net_devices =\n", settings, error)) << error;
+    EXPECT_TRUE(settings.net_devices.empty());
+}
+
+TEST(ConfigFile, ReportsTheFailingLine) {
+    settings_t settings = {};
+    std::string error;
+    EXPECT_FALSE(parse("sleep_enabled = true\nbattery_voltage = 3.3\n", settings, error));
+    EXPECT_EQ(error, "line 2: unknown key 'battery_voltage'");
+
+    EXPECT_FALSE(parse("\n\ninactive_on_battery_limit = 30m\n", settings, error));
+    EXPECT_EQ(error, "line 3: invalid inactive_on_battery_limit '30m'");
+
+    EXPECT_FALSE(parse("battery_monitor_mode = current\n", settings, error));
+    EXPECT_EQ(error, "line 1: invalid battery_monitor_mode 'current'");
+
+    EXPECT_FALSE(parse("net_activity_percentile = 101\n", settings, error));
+    EXPECT_EQ(error, "line 1: invalid net_activity_percentile '101'");
+
+    EXPECT_FALSE(parse("battery_voltage_limit = 3.4V\n", settings, error));
+    EXPECT_EQ(error, "line 1: invalid battery_voltage_limit '3.4V'");
+
+    EXPECT_FALSE(parse("battery_voltage_limit = nan\n", settings, error));
+    EXPECT_EQ(error, "line 1: invalid battery_voltage_limit 'nan'");
+
+    EXPECT_FALSE(parse("net_activity_limit = inf\n", settings, error));
+    EXPECT_EQ(error, "line 1: invalid net_activity_limit 'inf'");
+
+    EXPECT_FALSE(parse("battery_voltage_limit = 0x1p1\n", settings, error));
+    EXPECT_EQ(error, "line 1: invalid battery_voltage_limit '0x1p1'");
+
+    EXPECT_FALSE(parse("use_logind\n", settings, error));
+    EXPECT_EQ(error, "line 1: expected 'key = value'");
+}
+
+TEST(ConfigFile, MissingFileIsNotAnError) {
+    settings_t settings = {};
+    settings.battery_name = "battery";
+    std::string error;
+    EXPECT_TRUE(read_config_file("/nonexistent/flir-activity-monitor.conf", settings, error));
+    EXPECT_EQ(settings.battery_name, "battery");
+}
+
+TEST(ConfigFile, WatcherNoticesEditsAndReplacement) {
+    char dir[] = "/tmp/fam_config_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    const std::string path = std::string(dir) + "/fam.conf";
+    write_file(path, "sleep_enabled = true\n");
+
+    EventLoop loop;
+    ConfigWatcher watcher(loop, path);
+    int changes = 0;
+    ASSERT_TRUE(watcher.start([&changes] () { ++changes; }));
+    const auto wait_for_change = [&loop, &changes] (int expected) {
+        for (int i = 0; i < 100 && changes < expected; ++i) {
+            loop.dispatch(10);
+        }
+        return changes == expected;
+    };
+
+    // Other files in the directory are ignored
+    write_file(std::string(dir) + "/other.conf", "use_logind = false\n");
+    write_file(path, "sleep_enabled = false\n");
+    EXPECT_TRUE(wait_for_change(1));
+
+    const std::string tmp = path + ".tmp";
+    write_file(tmp, "sleep_enabled = true\n");
+    ASSERT_EQ(rename(tmp.c_str(), path.c_str()), 0);
+    EXPECT_TRUE(wait_for_change(2));
+
+    settings_t settings = {};
+    std::string error;
+    ASSERT_TRUE(read_config_file(path, settings, error)) << error;
+    EXPECT_TRUE(settings.sleep_enabled);
+
+    unlink(path.c_str());
+    EXPECT_TRUE(wait_for_change(3));
+    unlink((std::string(dir) + "/other.conf").c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,93 @@
+#include "gtest/gtest.h"
+
+#include <math.h>
+
+#include "../discharge_trend.hpp"
+
+namespace {
+const uint64_t second_usec = 1000000;
+}
+
+TEST(DischargeTrend, FitsALine) {
+    DischargeTrend trend;
+    // 4.0 V falling by 1 mV/s
+    for (uint64_t t = 0; t <= 100; t += 10) {
+        trend.add(1000 * second_usec + t * second_usec, 4.0 - 0.001 * t);
+    }
+    ASSERT_TRUE(trend.valid());
+    EXPECT_NEAR(trend.slope(), -0.001, 1e-9);
+    EXPECT_NEAR(trend.level(), 3.9, 1e-9);
+    EXPECT_NEAR(trend.secondsToLimit(3.4), 500, 1e-3);
+    EXPECT_EQ(trend.secondsToLimit(3.95), 0);
+    EXPECT_EQ(trend.lastUsec(), 1100 * second_usec);
+}
+
+TEST(DischargeTrend, SparseSamplesGiveTheSameEstimate) {
+    DischargeTrend dense;
+    DischargeTrend sparse;
+    for (uint64_t t = 0; t <= 1800; t += 5) {
+        const double capacity = 80 - 0.01 * t;
+        dense.add(t * second_usec, capacity);
+        if (t % 300 == 0 || t == 455) {
+            sparse.add(t * second_usec, capacity);
+        }
+    }
+    ASSERT_TRUE(sparse.valid());
+    EXPECT_NEAR(dense.slope(), -0.01, 1e-9);
+    EXPECT_NEAR(sparse.slope(), -0.01, 1e-9);
+    EXPECT_NEAR(sparse.secondsToLimit(5), dense.secondsToLimit(5), 1e-3);
+}
+
+TEST(DischargeTrend, NeedsSamplesSpreadOverTime) {
+    DischargeTrend trend;
+    EXPECT_FALSE(trend.valid());
+    EXPECT_EQ(trend.secondsToLimit(3.3), INFINITY);
+
+    trend.add(10 * second_usec, 3.8);
+    trend.add(10 * second_usec, 3.7);
+    trend.add(10 * second_usec, 3.6);
+    EXPECT_FALSE(trend.valid());
+    EXPECT_EQ(trend.slope(), 0);
+    EXPECT_NEAR(trend.level(), 3.7, 1e-9);
+
+    // Out of order samples are ignored
+    trend.add(5 * second_usec, 3.0);
+    EXPECT_NEAR(trend.level(), 3.7, 1e-9);
+
+    trend.add(20 * second_usec, 3.7);
+    EXPECT_TRUE(trend.valid());
+    trend.reset();
+    EXPECT_FALSE(trend.valid());
+}
+
+TEST(DischargeTrend, RisingOrFlatNeverReachesTheLimit) {
+    DischargeTrend trend;
+    for (uint64_t t = 0; t < 600; t += 60) {
+        trend.add(t * second_usec, 3.7);
+    }
+    ASSERT_TRUE(trend.valid());
+    EXPECT_NEAR(trend.slope(), 0, 1e-12);
+    EXPECT_GT(trend.secondsToLimit(3.3), 1e9);
+
+    // Charging
+    for (uint64_t t = 600; t < 1200; t += 60) {
+        trend.add(t * second_usec, 3.7 + 0.0005 * (t - 600));
+    }
+    EXPECT_GT(trend.slope(), 0);
+    EXPECT_EQ(trend.secondsToLimit(3.3), INFINITY);
+}
+
+TEST(DischargeTrend, OldSamplesFade) {
+    DischargeTrend trend(300);
+    DischargeTrend unfaded(1e9);
+    // An hour flat, then 10 minutes of a heavy load reaching 3.3 V in
+    // another 10 minutes
+    for (uint64_t t = 0; t <= 4200; t += 30) {
+        const double voltage = t < 3600 ? 3.9 : 3.9 - 0.0005 * (t - 3600);
+        trend.add(t * second_usec, voltage);
+        unfaded.add(t * second_usec, voltage);
+    }
+    EXPECT_LT(trend.slope(), -0.00025);
+    EXPECT_LT(trend.secondsToLimit(3.3), 1200);
+    EXPECT_GT(unfaded.secondsToLimit(3.3), 10000);
+}
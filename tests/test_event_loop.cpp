@@ -0,0 +1,187 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "../event_loop.hpp"
+
+TEST(EventLoop, DispatchesFdAndStops) {
+    EventLoop loop;
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    int calls = 0;
+    ASSERT_TRUE(loop.addFd(fds[0], EPOLLIN, [&] (uint32_t events) {
+        char c;
+        read(fds[0], &c, 1);
+        EXPECT_TRUE(events & EPOLLIN);
+        if (++calls == 2) {
+            loop.stop();
+        }
+    }));
+
+    write(fds[1], "ab", 2);
+    EXPECT_TRUE(loop.run());
+    EXPECT_EQ(calls, 2);
+
+    loop.removeFd(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(EventLoop, PeriodicTimer) {
+    EventLoop loop;
+    int ticks = 0;
+    const int timer = loop.addTimer([&] (uint32_t) {
+        if (++ticks == 3) {
+            loop.stop();
+        }
+    });
+    ASSERT_NE(timer, -1);
+    ASSERT_TRUE(loop.armTimer(timer, 1, 1));
+
+    EXPECT_TRUE(loop.run());
+    EXPECT_EQ(ticks, 3);
+    loop.removeTimer(timer);
+}
+
+TEST(EventLoop, CallbackMayRemoveItself) {
+    EventLoop loop;
+    int timer = -1;
+    timer = loop.addTimer([&] (uint32_t) {
+        loop.removeTimer(timer);
+        loop.stop();
+    });
+    ASSERT_TRUE(loop.armTimer(timer, 1, 0));
+    EXPECT_TRUE(loop.run());
+}
+
+TEST(EventLoop, ReusedFdMissesTheOldSourcesEvent) {
+    EventLoop loop;
+    int first[2];
+    int second[2];
+    int third[2];
+    ASSERT_EQ(pipe(first), 0);
+    ASSERT_EQ(pipe(second), 0);
+    ASSERT_EQ(pipe(third), 0);
+    const int reused = second[0];
+
+    int second_calls = 0;
+    int third_calls = 0;
+    // Ready in the same batch, the first callback runs first and replaces
+    // the second source with a new one on the same fd number.
+    write(first[1], "a", 1);
+    write(second[1], "b", 1);
+    write(third[1], "c", 1);
+    ASSERT_TRUE(loop.addFd(first[0], EPOLLIN, [&] (uint32_t) {
+        char c;
+        read(first[0], &c, 1);
+        loop.removeFd(reused);
+        close(reused);
+        ASSERT_EQ(dup2(third[0], reused), reused);
+        loop.addFd(reused, EPOLLIN, [&] (uint32_t) {
+            char c;
+            read(reused, &c, 1);
+            ++third_calls;
+        });
+    }));
+    ASSERT_TRUE(loop.addFd(second[0], EPOLLIN, [&] (uint32_t) { ++second_calls; }));
+
+    EXPECT_EQ(loop.dispatch(0), 1);
+    EXPECT_EQ(second_calls, 0);
+    EXPECT_EQ(third_calls, 0);
+    EXPECT_EQ(loop.dispatch(0), 1);
+    EXPECT_EQ(third_calls, 1);
+
+    loop.removeFd(first[0]);
+    loop.removeFd(reused);
+    for (const int fd: { first[0], first[1], reused, second[1], third[0], third[1] }) {
+        close(fd);
+    }
+}
+
+TEST(EventLoop, RunsPostedFromOtherThread) {
+    EventLoop loop;
+    std::thread::id ran_on;
+    std::thread poster([&] () {
+        loop.post([&] () {
+            ran_on = std::this_thread::get_id();
+            loop.stop();
+        });
+    });
+    EXPECT_TRUE(loop.run());
+    poster.join();
+    EXPECT_EQ(ran_on, std::this_thread::get_id());
+}
+
+TEST(EventLoop, CountsWakeups) {
+    EventLoop loop;
+    PerfCounter loop_wakeups;
+    PerfCounter group_wakeups;
+    loop.setWakeupCounter(&loop_wakeups);
+
+    EventSourceGroup group("test", &group_wakeups);
+    group.attach(loop);
+    std::atomic<int> ticks(0);
+    const int timer = group.addTimer([&] (uint32_t) {
+        if (++ticks == 3) {
+            loop.stop();
+        }
+    });
+    ASSERT_NE(timer, -1);
+    ASSERT_TRUE(group.armTimer(timer, 1, 1));
+    ASSERT_TRUE(group.start());
+
+#ifdef FAM_PER_MONITOR_THREADS
+    while (ticks < 3) {
+        std::this_thread::yield();
+    }
+    group.stop();
+    EXPECT_GE(group_wakeups.value(), 3u);
+#else
+    EXPECT_TRUE(loop.run());
+    EXPECT_EQ(group_wakeups.value(), 3u);
+    EXPECT_GE(loop_wakeups.value(), 3u);
+    group.stop();
+#endif
+}
+
+TEST(EventLoop, VirtualClockFiresTimersInOrder) {
+    VirtualClock clock;
+    set_clock(&clock);
+    EventLoop loop;
+    set_clock(nullptr);
+    const auto settle = [&loop] () { while (loop.dispatch(0) > 0) {} };
+
+    std::vector<std::pair<char, uint64_t>> fired;
+    const int periodic = loop.addTimer([&] (uint32_t) { fired.push_back({ 'p', clock.nowUsec() }); });
+    int once = -1;
+    once = loop.addTimer([&] (uint32_t) {
+        fired.push_back({ 'o', clock.nowUsec() });
+        // Re-armed from the callback at the time it fired
+        loop.armTimer(once, 2500, 0);
+    });
+    const uint64_t start = clock.nowUsec();
+    ASSERT_TRUE(loop.armTimer(periodic, 1000, 1000));
+    ASSERT_TRUE(loop.armTimer(once, 1500, 0));
+
+    clock.advance(3600 * 1000, settle);
+    ASSERT_EQ(fired.size(), 4u);
+    EXPECT_EQ(fired[0], std::make_pair('p', start + 1000000));
+    EXPECT_EQ(fired[1], std::make_pair('o', start + 1500000));
+    EXPECT_EQ(fired[2], std::make_pair('p', start + 2000000));
+    EXPECT_EQ(fired[3], std::make_pair('p', start + 3000000));
+    EXPECT_EQ(clock.nowUsec(), start + 3600000);
+
+    // The one-shot timer is due at 4 s, 0 disarms it
+    ASSERT_TRUE(loop.armTimer(once, 0, 0));
+    fired.clear();
+    clock.advance(1000 * 1000, settle);
+    ASSERT_EQ(fired.size(), 1u);
+    EXPECT_EQ(fired[0], std::make_pair('p', start + 4000000));
+}
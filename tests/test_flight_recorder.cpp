@@ -0,0 +1,153 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../flight_recorder.hpp"
+
+namespace {
+std::string read_file(const std::string &path) {
+    std::ifstream f(path, std::ios::binary);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+}
+
+TEST(FlightRecorder, KeepsLatestRecordsInOrder) {
+    // Too large for the stack
+    std::unique_ptr<FlightRecorder> recorder(new FlightRecorder());
+    EXPECT_TRUE(recorder->snapshot().empty());
+
+    const size_t total = FlightRecorder::capacity + 10;
+    for (size_t i = 0; i < total; ++i) {
+        recorder->record(flight_event::NET_RATE, 0, i);
+    }
+    const auto records = recorder->snapshot();
+    ASSERT_EQ(records.size(), FlightRecorder::capacity);
+    EXPECT_EQ(records.front().value, 10);
+    EXPECT_EQ(records.back().value, int64_t(total - 1));
+    EXPECT_EQ(records.back().event, flight_event::NET_RATE);
+    EXPECT_LE(records.front().time_usec, records.back().time_usec);
+}
+
+TEST(FlightRecorder, DumpRoundTrip) {
+    char dir[] = "/tmp/fam_flight_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    const std::string path = std::string(dir) + "/dump.bin";
+
+    std::unique_ptr<FlightRecorder> recorder(new FlightRecorder());
+    EXPECT_FALSE(recorder->dump());
+    recorder->setDumpPath(path);
+    recorder->record(flight_event::BATTERY_SAMPLE, 42, 3700000);
+    recorder->record(flight_event::STATE_TRANSITION, 0, 2);
+    ASSERT_TRUE(recorder->dump());
+
+    const std::string content = read_file(path);
+    flight_dump_header_t header;
+    std::vector<flight_record_t> records;
+    ASSERT_TRUE(parse_flight_dump(content.data(), content.size(), header, records));
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_EQ(records[0].event, flight_event::BATTERY_SAMPLE);
+    EXPECT_EQ(records[0].a, 42u);
+    EXPECT_EQ(records[0].value, 3700000);
+    EXPECT_EQ(records[1].event, flight_event::STATE_TRANSITION);
+    EXPECT_GE(header.monotonic_usec, records[1].time_usec);
+    EXPECT_STREQ(flight_event_name(records[1].event), "state-transition");
+
+    // Truncated or foreign files are rejected
+    EXPECT_FALSE(parse_flight_dump(content.data(), content.size() - 1, header, records));
+    std::string foreign = content;
+    foreign[0] = 'X';
+    EXPECT_FALSE(parse_flight_dump(foreign.data(), foreign.size(), header, records));
+
+    unlink(path.c_str());
+    rmdir(dir);
+}
+
+TEST(FlightRecorder, CreatesTheDumpDirectory) {
+    char dir[] = "/tmp/fam_flight_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    const std::string log_dir = std::string(dir) + "/flir-activity-monitor";
+    const std::string path = log_dir + "/flight-recorder.bin";
+
+    std::unique_ptr<FlightRecorder> recorder(new FlightRecorder());
+    recorder->setDumpPath(path);
+    recorder->record(flight_event::CHARGER, 1);
+    ASSERT_TRUE(recorder->dump());
+    EXPECT_TRUE(recorder->dump());
+    EXPECT_EQ(read_file(path).size(), sizeof(flight_dump_header_t) + sizeof(flight_record_t));
+
+    // Only the last directory is created
+    recorder->setDumpPath(std::string(dir) + "/missing/flir-activity-monitor/flight-recorder.bin");
+    EXPECT_FALSE(recorder->dump());
+    EXPECT_EQ(errno, ENOENT);
+
+    unlink(path.c_str());
+    rmdir(log_dir.c_str());
+    rmdir(dir);
+}
+
+TEST(FlightRecorder, ConcurrentDumps) {
+    char dir[] = "/tmp/fam_flight_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    const std::string path = std::string(dir) + "/dump.bin";
+
+    std::unique_ptr<FlightRecorder> recorder(new FlightRecorder());
+    recorder->setDumpPath(path);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        recorder->record(flight_event::NET_RATE, i, i);
+    }
+    std::vector<std::thread> dumpers;
+    for (int d = 0; d < 2; ++d) {
+        dumpers.emplace_back([&recorder] () {
+            for (int i = 0; i < 20; ++i) {
+                EXPECT_TRUE(recorder->dump());
+            }
+        });
+    }
+    for (auto &t: dumpers) {
+        t.join();
+    }
+
+    const std::string content = read_file(path);
+    flight_dump_header_t header;
+    std::vector<flight_record_t> records;
+    ASSERT_TRUE(parse_flight_dump(content.data(), content.size(), header, records));
+    EXPECT_EQ(records.size(), 1000u);
+
+    unlink(path.c_str());
+    rmdir(dir);
+}
+
+TEST(FlightRecorder, SnapshotWhileRecording) {
+    std::unique_ptr<FlightRecorder> recorder(new FlightRecorder());
+    std::vector<std::thread> writers;
+    for (uint32_t w = 0; w < 3; ++w) {
+        writers.emplace_back([&recorder, w] {
+            for (int64_t i = 0; i < 20000; ++i) {
+                recorder->record(flight_event::INPUT_ACTIVITY, w, i * 4 + w);
+            }
+        });
+    }
+    // Every record seen is complete, never mixed from two writes
+    bool consistent = true;
+    for (int n = 0; n < 50; ++n) {
+        for (const auto &r: recorder->snapshot()) {
+            consistent &= r.event == flight_event::INPUT_ACTIVITY && uint32_t(r.value % 4) == r.a;
+        }
+    }
+    for (auto &t: writers) {
+        t.join();
+    }
+    EXPECT_TRUE(consistent);
+    EXPECT_EQ(recorder->snapshot().size(), FlightRecorder::capacity);
+}
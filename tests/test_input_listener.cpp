@@ -1 +1,71 @@
+#include "gtest/gtest.h"
 
+#include <map>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include "../input_monitor.hpp"
+
+namespace {
+std::function<const char *(const char *)> properties(const std::map<std::string, std::string> &props) {
+    return [props] (const char *key) -> const char * {
+        const auto it = props.find(key);
+        return it == props.end() ? nullptr : it->second.c_str();
+    };
+}
+}
+
+TEST(InputMonitor, DevnodePatterns) {
+    settings_t settings = {};
+    settings.input_event_devices = { "/dev/input/event*", "/dev/touch0" };
+    const auto none = properties({});
+
+    EXPECT_TRUE(input_device_matches(settings, "/dev/input/event0", none));
+    EXPECT_TRUE(input_device_matches(settings, "/dev/input/event12", none));
+    EXPECT_TRUE(input_device_matches(settings, "/dev/touch0", none));
+    EXPECT_FALSE(input_device_matches(settings, "/dev/input/mouse0", none));
+    EXPECT_FALSE(input_device_matches(settings, "/dev/input/by-id/event0", none));
+}
+
+TEST(InputMonitor, PropertyMatches) {
+    settings_t settings = {};
+    settings.input_event_devices = { "/dev/input/event*" };
+    settings.input_device_properties = { "ID_INPUT_KEYBOARD=1", "ID_INPUT_TOUCHSCREEN" };
+
+    EXPECT_TRUE(input_device_matches(settings, "/dev/input/event0",
+                                     properties({{ "ID_INPUT_KEYBOARD", "1" }})));
+    EXPECT_TRUE(input_device_matches(settings, "/dev/input/event0",
+                                     properties({{ "ID_INPUT_TOUCHSCREEN", "1" }})));
+    EXPECT_FALSE(input_device_matches(settings, "/dev/input/event0",
+                                      properties({{ "ID_INPUT_KEYBOARD", "0" }})));
+    EXPECT_FALSE(input_device_matches(settings, "/dev/input/event0",
+                                      properties({{ "ID_INPUT_ACCELEROMETER", "1" }})));
+    EXPECT_FALSE(input_device_matches(settings, "/dev/input/mouse0",
+                                      properties({{ "ID_INPUT_KEYBOARD", "1" }})));
+}
+
+TEST(InputMonitor, DrainReadsAllQueuedEvents) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+
+    // More than one read() batch
+    const int nbr_events = 150;
+    for (int i = 0; i < nbr_events; ++i) {
+        struct input_event ev = {};
+        ev.time.tv_sec = 100 + i;
+        ev.type = EV_KEY;
+        ASSERT_EQ(write(fds[1], &ev, sizeof(ev)), ssize_t(sizeof(ev)));
+    }
+
+    timestamp_t time = 0;
+    EXPECT_EQ(drain_input_events(fds[0], time), nbr_events);
+    EXPECT_EQ(time, timestamp_t(100 + nbr_events - 1));
+    EXPECT_EQ(drain_input_events(fds[0], time), 0);
+
+    close(fds[1]);
+    EXPECT_EQ(drain_input_events(fds[0], time), -1);
+    close(fds[0]);
+}
@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+#include "../link_stats.hpp"
+
+namespace {
+link_msg_t link(int index, const char *name, uint64_t tx, uint64_t rx) {
+    return { index, name, true, tx, rx };
+}
+}
+
+TEST(LinkStats, GlobPatterns) {
+    const std::vector<std::string> patterns = { "wlan*", "usb0" };
+
+    EXPECT_TRUE(net_device_matches(patterns, "wlan0"));
+    EXPECT_TRUE(net_device_matches(patterns, "wlan12"));
+    EXPECT_TRUE(net_device_matches(patterns, "usb0"));
+    EXPECT_FALSE(net_device_matches(patterns, "usb1"));
+    EXPECT_FALSE(net_device_matches(patterns, "eth0"));
+}
+
+TEST(LinkStats, MaxPacketsOfMatchingLinks) {
+    LinkTable table({ "wlan*", "usb*" });
+
+    EXPECT_TRUE(table.update(link(2, "wlan0", 100, 100)));
+    EXPECT_TRUE(table.update(link(3, "usb0", 10, 10)));
+    EXPECT_FALSE(table.update(link(4, "eth0", 0, 0)));
+    EXPECT_EQ(table.matchingLinks(), 2u);
+    EXPECT_EQ(table.maxPacketsSinceLastSample(), 0u);
+
+    table.update(link(2, "wlan0", 150, 120));
+    table.update(link(3, "usb0", 100, 10));
+    table.update(link(4, "eth0", 5000, 5000));
+    EXPECT_EQ(table.maxPacketsSinceLastSample(), 90u);
+    EXPECT_EQ(table.maxPacketsSinceLastSample(), 0u);
+}
+
+TEST(LinkStats, LinksComeAndGo) {
+    LinkTable table({ "usb*" });
+
+    table.update(link(3, "usb0", 10, 10));
+    EXPECT_TRUE(table.remove(3));
+    EXPECT_EQ(table.matchingLinks(), 0u);
+
+    // Re-enumerated gadget starts from its current counters
+    table.update(link(7, "usb0", 500, 500));
+    EXPECT_EQ(table.maxPacketsSinceLastSample(), 0u);
+
+    // Links missing from a dump are dropped
+    table.beginDump();
+    table.endDump();
+    EXPECT_EQ(table.matchingLinks(), 0u);
+}
+
+TEST(LinkStats, WindowOfTheBusiestLinks) {
+    const uint64_t second_usec = 1000000;
+    LinkTable table({ "wlan*", "usb*" });
+    table.setWindow(10, 10);
+    table.update(link(2, "wlan0", 0, 0));
+    table.update(link(3, "usb0", 0, 0));
+    table.update(link(4, "eth0", 0, 0));
+
+    // wlan0 steady at 20 packets/s, usb0 one burst, eth0 not watched
+    table.update(link(2, "wlan0", 50, 50));
+    table.update(link(3, "usb0", 500, 0));
+    table.update(link(4, "eth0", 9000, 0));
+    table.maxPacketsSinceLastSample(0, 5 * second_usec);
+    table.update(link(2, "wlan0", 100, 100));
+    table.maxPacketsSinceLastSample(5 * second_usec, 10 * second_usec);
+    table.maxPacketsSinceLastSample(10 * second_usec, 11 * second_usec);
+
+    network_status_t status = {};
+    table.windowStatus(status);
+    EXPECT_DOUBLE_EQ(status.window_traffic, 50);
+    EXPECT_EQ(status.window_buckets, 10u);
+    EXPECT_EQ(status.busy_buckets, 10u);
+}
+
+TEST(LinkStats, ParseNewLink) {
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+        char attrs[256];
+    } msg = {};
+
+    char *p = msg.attrs;
+    auto rta = reinterpret_cast<struct rtattr *>(p);
+    rta->rta_type = IFLA_IFNAME;
+    rta->rta_len = RTA_LENGTH(6);
+    memcpy(RTA_DATA(rta), "wlan0", 6);
+    p += RTA_ALIGN(rta->rta_len);
+
+    rta = reinterpret_cast<struct rtattr *>(p);
+    rta->rta_type = IFLA_STATS64;
+    rta->rta_len = RTA_LENGTH(sizeof(struct rtnl_link_stats64));
+    struct rtnl_link_stats64 stats = {};
+    stats.tx_packets = 1234;
+    stats.rx_packets = 5678;
+    memcpy(RTA_DATA(rta), &stats, sizeof(stats));
+    p += RTA_ALIGN(rta->rta_len);
+
+    msg.nlh.nlmsg_type = RTM_NEWLINK;
+    msg.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)) + (p - msg.attrs);
+    msg.ifi.ifi_index = 5;
+
+    link_msg_t parsed;
+    ASSERT_TRUE(parse_link_message(&msg.nlh, parsed));
+    EXPECT_EQ(parsed.index, 5);
+    EXPECT_STREQ(parsed.name, "wlan0");
+    EXPECT_TRUE(parsed.has_stats);
+    EXPECT_EQ(parsed.tx_packets, 1234u);
+    EXPECT_EQ(parsed.rx_packets, 5678u);
+}
@@ -0,0 +1,42 @@
+#include "gtest/gtest.h"
+
+#include "../log.hpp"
+
+namespace {
+int counted_argument(int &evaluated) {
+    ++evaluated;
+    return evaluated;
+}
+}
+
+TEST(Logger, ParseNames) {
+    log_type_t type = log_type_t::SYSLOG;
+    EXPECT_TRUE(parse_log_type("journal", type));
+    EXPECT_EQ(type, log_type_t::JOURNAL);
+    EXPECT_TRUE(parse_log_type("PRINTF", type));
+    EXPECT_EQ(type, log_type_t::PRINTF);
+    EXPECT_FALSE(parse_log_type("file", type));
+    EXPECT_EQ(type, log_type_t::PRINTF);
+
+    log_level_t level = log_level_t::INFO;
+    EXPECT_TRUE(parse_log_level("Debug", level));
+    EXPECT_EQ(level, log_level_t::DEBUG);
+    EXPECT_TRUE(parse_log_level("warning", level));
+    EXPECT_EQ(level, log_level_t::WARNING);
+    EXPECT_FALSE(parse_log_level("verbose", level));
+    EXPECT_EQ(level, log_level_t::WARNING);
+}
+
+TEST(Logger, DisabledLevelSkipsArguments) {
+    const log_level_t previous = g_logger_level.load();
+    logger_set_level(log_level_t::ERROR);
+
+    int evaluated = 0;
+    LOG_INFO("not logged %d", counted_argument(evaluated));
+    LOG_DEBUG("not logged %d", counted_argument(evaluated));
+    EXPECT_EQ(evaluated, 0);
+    EXPECT_TRUE(logger_enabled(log_level_t::ERROR));
+    EXPECT_FALSE(logger_enabled(log_level_t::WARNING));
+
+    logger_set_level(previous);
+}
@@ -0,0 +1,65 @@
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+#include "../mpsc_ring.hpp"
+
+TEST(MpscRing, FifoAndFull) {
+    MpscRing<int, 4> ring;
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(ring.tryPush([i] (int &v) { v = i; }));
+    }
+    EXPECT_FALSE(ring.tryPush([] (int &v) { v = 99; }));
+
+    int value = -1;
+    EXPECT_TRUE(ring.readable());
+    EXPECT_TRUE(ring.tryPop([&] (const int &v) { value = v; }));
+    EXPECT_EQ(value, 0);
+    EXPECT_TRUE(ring.tryPush([] (int &v) { v = 4; }));
+
+    for (int i = 1; i <= 4; ++i) {
+        EXPECT_TRUE(ring.tryPop([&] (const int &v) { value = v; }));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_FALSE(ring.readable());
+    EXPECT_FALSE(ring.tryPop([] (const int &) {}));
+    EXPECT_EQ(ring.pushed(), 5u);
+    EXPECT_EQ(ring.popped(), 5u);
+}
+
+TEST(MpscRing, ConcurrentProducers) {
+    const int nbr_producers = 4;
+    const int per_producer = 50000;
+    MpscRing<uint64_t, 64> ring;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nbr_producers; ++p) {
+        producers.emplace_back([&ring, p] {
+            for (int i = 0; i < per_producer; ++i) {
+                const uint64_t value = (uint64_t(p) << 32) | i;
+                while (!ring.tryPush([value] (uint64_t &v) { v = value; })) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Values of each producer arrive in order and none is lost
+    std::vector<int> next(nbr_producers, 0);
+    int received = 0;
+    bool in_order = true;
+    while (received < nbr_producers * per_producer) {
+        ring.tryPop([&] (const uint64_t &v) {
+            const int p = v >> 32;
+            in_order &= int(v & 0xffffffff) == next[p];
+            ++next[p];
+            ++received;
+        });
+    }
+    for (auto &t: producers) {
+        t.join();
+    }
+    EXPECT_TRUE(in_order);
+    EXPECT_FALSE(ring.readable());
+}
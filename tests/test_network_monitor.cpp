@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+#include "../clock.hpp"
+#include "../flight_recorder.hpp"
+#include "../network_monitor.hpp"
+
+TEST(NetworkMonitor, QuietTrafficBacksOffToTheMaximum) {
+    int interval = 5000;
+    interval = next_sample_interval_ms(0, 100, interval, 5000, 60000);
+    EXPECT_EQ(interval, 10000);
+    interval = next_sample_interval_ms(10, 100, interval, 5000, 60000);
+    EXPECT_EQ(interval, 20000);
+    interval = next_sample_interval_ms(49.9, 100, interval, 5000, 60000);
+    EXPECT_EQ(interval, 40000);
+    interval = next_sample_interval_ms(0, 100, interval, 5000, 60000);
+    EXPECT_EQ(interval, 60000);
+    interval = next_sample_interval_ms(0, 100, interval, 5000, 60000);
+    EXPECT_EQ(interval, 60000);
+}
+
+TEST(NetworkMonitor, TrafficNearTheLimitSamplesAtTheMinimum) {
+    EXPECT_EQ(next_sample_interval_ms(50, 100, 60000, 5000, 60000), 5000);
+    EXPECT_EQ(next_sample_interval_ms(99, 100, 40000, 5000, 60000), 5000);
+    EXPECT_EQ(next_sample_interval_ms(1000, 100, 5000, 5000, 60000), 5000);
+}
+
+TEST(NetworkMonitor, ZeroLimitBacksOff) {
+    EXPECT_EQ(next_sample_interval_ms(1000, 0, 5000, 5000, 60000), 10000);
+}
+
+TEST(NetworkMonitor, DumpEndsOnTheLoop) {
+    settings_t settings = {};
+    settings.net_devices = { "lo" };
+    settings.net_activity_limit = 5;
+    settings.net_sample_min_interval = 1;
+    settings.net_sample_max_interval = 1;
+    const uint64_t start = get_clock().nowUsec();
+
+    EventLoop loop;
+    NetworkMonitor monitor(std::make_shared<const settings_t>(settings));
+    ASSERT_TRUE(monitor.start(loop));
+    const int stop = loop.addTimer([&] (uint32_t) { loop.stop(); });
+    loop.armTimer(stop, 1500, 0);
+    loop.run();
+    loop.removeTimer(stop);
+
+    const auto records = g_flight_recorder.snapshot();
+    EXPECT_TRUE(std::any_of(records.begin(), records.end(), [start] (const flight_record_t &r) {
+        return r.event == flight_event::NET_RATE && r.time_usec > start;
+    }));
+}
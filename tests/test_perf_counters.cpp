@@ -0,0 +1,52 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../perf_counters.hpp"
+
+TEST(PerfCounters, HistogramBuckets) {
+    PerfHistogram h;
+    h.record(0);
+    h.record(1);
+    h.record(3);
+    h.record(1000);
+    h.record(uint64_t(1) << 40);
+
+    EXPECT_EQ(h.count(), 5u);
+    EXPECT_EQ(h.maxUsec(), uint64_t(1) << 40);
+    EXPECT_EQ(h.sumUsec(), 1004u + (uint64_t(1) << 40));
+    EXPECT_EQ(h.bucket(0), 1u);
+    EXPECT_EQ(h.bucket(1), 1u);
+    EXPECT_EQ(h.bucket(2), 1u);
+    // 512 <= 1000 < 1024
+    EXPECT_EQ(h.bucket(10), 1u);
+    EXPECT_EQ(h.bucket(PerfHistogram::buckets - 1), 1u);
+}
+
+TEST(PerfCounters, ConcurrentAdds) {
+    PerfCounter counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&counter] {
+            for (int i = 0; i < 10000; ++i) {
+                counter.add();
+            }
+        });
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+    EXPECT_EQ(counter.value(), 40000u);
+}
+
+TEST(PerfCounters, NamesAreUnique) {
+    std::vector<std::string> names;
+    perf_for_each_counter([&names] (const char *name, uint64_t) { names.push_back(name); });
+    perf_for_each_histogram([&names] (const char *name, const PerfHistogram &) { names.push_back(name); });
+    EXPECT_EQ(names.size(), 12u);
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ(std::unique(names.begin(), names.end()), names.end());
+}
@@ -0,0 +1,69 @@
+#include "gtest/gtest.h"
+
+#include <sys/wait.h>
+
+#include "../process_launcher.hpp"
+
+namespace {
+// Runs command on a fresh loop and returns its exit callback status.
+int run(const std::string &command, int timeout_ms) {
+    EventLoop loop;
+    ProcessLauncher launcher(loop);
+    int result = -2;
+    launcher.launch(command, timeout_ms, [&] (int status) {
+        result = status;
+        loop.stop();
+    });
+    loop.run();
+    EXPECT_EQ(launcher.running(), 0u);
+    return result;
+}
+}
+
+TEST(ProcessLauncher, SplitCommand) {
+    EXPECT_EQ(split_command("systemctl suspend"),
+              std::vector<std::string>({ "systemctl", "suspend" }));
+    EXPECT_EQ(split_command("  a\t'b c' \"d'e\"f  "),
+              std::vector<std::string>({ "a", "b c", "d'ef" }));
+    EXPECT_EQ(split_command("x ''"), std::vector<std::string>({ "x", "" }));
+    EXPECT_TRUE(split_command("   ").empty());
+}
+
+TEST(ProcessLauncher, DetectsShellSyntax) {
+    EXPECT_FALSE(command_needs_shell("systemctl suspend"));
+    EXPECT_FALSE(command_needs_shell("logger -t fam 'a | b' \"c;d\" --opt=x"));
+    EXPECT_TRUE(command_needs_shell("sync && systemctl poweroff"));
+    EXPECT_TRUE(command_needs_shell("echo mem > /sys/power/state"));
+    EXPECT_TRUE(command_needs_shell("rtcwake -m mem -s $DELAY"));
+    EXPECT_TRUE(command_needs_shell("echo \"$HOME\""));
+    EXPECT_TRUE(command_needs_shell("LANG=C systemctl suspend"));
+    EXPECT_TRUE(command_needs_shell("rm /tmp/fam-*"));
+    EXPECT_TRUE(command_needs_shell("a\\ b"));
+}
+
+TEST(ProcessLauncher, RunsShellSyntaxThroughTheShell) {
+    const int piped = run("echo a | grep -q a && exit 4", 0);
+    EXPECT_TRUE(WIFEXITED(piped));
+    EXPECT_EQ(WEXITSTATUS(piped), 4);
+}
+
+TEST(ProcessLauncher, ReportsExitStatus) {
+    const int ok = run("true", 0);
+    EXPECT_TRUE(WIFEXITED(ok));
+    EXPECT_EQ(WEXITSTATUS(ok), 0);
+
+    const int failed = run("sh -c 'exit 3'", 0);
+    EXPECT_TRUE(WIFEXITED(failed));
+    EXPECT_EQ(WEXITSTATUS(failed), 3);
+}
+
+TEST(ProcessLauncher, MissingCommand) {
+    EXPECT_EQ(run("/nonexistent/command", 0), -1);
+    EXPECT_EQ(run("", 0), -1);
+}
+
+TEST(ProcessLauncher, TerminatesOnTimeout) {
+    const int status = run("sleep 10", 50);
+    EXPECT_TRUE(WIFSIGNALED(status));
+    EXPECT_EQ(WTERMSIG(status), SIGTERM);
+}
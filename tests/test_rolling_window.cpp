@@ -1,5 +1,7 @@
 #include "gtest/gtest.h"
 
+#include <stdlib.h>
+
 #include "../rolling_window.hpp"
 
 TEST(RollingWindow, AddValues) {
@@ -60,3 +62,76 @@ TEST(RollingWindow, TestReset) {
 
     EXPECT_EQ(window.isFullyPopulated(), true);
 }
+
+TEST(FixedRollingWindow, AddValues) {
+    RollingWindow<int, 10> window;
+
+    EXPECT_EQ(window.isFullyPopulated(), false);
+
+    for (int i = 0; i < 10; ++i)
+        window.addValue(10);
+
+    EXPECT_EQ(window.isFullyPopulated(), true);
+}
+
+TEST(FixedRollingWindow, TestLimit) {
+    RollingWindow<int, 10> window;
+
+    EXPECT_EQ(window.allValuesAreBelow(5), true);
+
+    for (int i = 0; i < 10; ++i)
+        window.addValue(10);
+
+    EXPECT_EQ(window.allValuesAreBelow(5), false);
+    EXPECT_EQ(window.allValuesAreAbove(9), true);
+
+    for (int i = 0; i < 9; ++i)
+        window.addValue(4);
+
+    EXPECT_EQ(window.allValuesAreBelow(5), false);
+    EXPECT_EQ(window.allValuesAreAbove(9), false);
+    window.addValue(4);
+
+    EXPECT_EQ(window.allValuesAreBelow(5), true);
+
+    window.addValue(5);
+    EXPECT_EQ(window.allValuesAreBelow(5), false);
+}
+
+TEST(FixedRollingWindow, TestReset) {
+    RollingWindow<int, 10> window;
+
+    for (int i = 0; i < 10; ++i)
+        window.addValue(10);
+
+    window.reset();
+
+    EXPECT_EQ(window.isFullyPopulated(), false);
+    EXPECT_EQ(window.allValuesAreBelow(5), true);
+
+    for (int i = 0; i < 9; ++i)
+        window.addValue(1);
+
+    EXPECT_EQ(window.isFullyPopulated(), false);
+    EXPECT_EQ(window.allValuesAreBelow(5), true);
+
+    window.addValue(1);
+
+    EXPECT_EQ(window.isFullyPopulated(), true);
+}
+
+TEST(FixedRollingWindow, MatchesRuntimeWindow) {
+    RollingWindow<int> reference(7);
+    RollingWindow<int, 7> window;
+
+    unsigned int seed = 1;
+    for (int i = 0; i < 1000; ++i) {
+        const int v = rand_r(&seed) % 100;
+        reference.addValue(v);
+        window.addValue(v);
+        for (int limit = 0; limit <= 100; limit += 10) {
+            EXPECT_EQ(window.allValuesAreBelow(limit), reference.allValuesAreBelow(limit));
+        }
+    }
+    EXPECT_EQ(window.getDataAsString(), reference.getDataAsString());
+}
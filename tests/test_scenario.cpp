@@ -0,0 +1,404 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include "../clock.hpp"
+#include "../daemon.hpp"
+#include "../flight_recorder.hpp"
+#include "../input_monitor.hpp"
+#include "../settings_handler.hpp"
+#include "../utils.hpp"
+
+/*
+ * Whole-daemon scenarios on a VirtualClock below a filesystem root: the
+ * battery and network counters are files in a temporary tree, the input
+ * device is a FIFO the test writes input_events to. The events are stamped
+ * with the virtual clock, so the FIFO is coalesced like an evdev node.
+ */
+namespace {
+const uint64_t second_usec = 1000000;
+const uint64_t minute_usec = 60 * second_usec;
+
+void write_file(const std::string &path, const std::string &content) {
+    std::ofstream f(path, std::ios::trunc);
+    f << content;
+}
+
+std::string read_file(const std::string &path) {
+    std::ifstream f(path);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+class DaemonScenario : public ::testing::Test {
+protected:
+    void SetUp() override {
+#ifdef FAM_PER_MONITOR_THREADS
+        GTEST_SKIP() << "The monitors' timers fire on their own threads";
+#endif
+        char dir[] = "/tmp/fam_scenario_XXXXXX";
+        ASSERT_NE(mkdtemp(dir), nullptr);
+        mRoot = dir;
+        const std::string supply = mRoot + "/sys/class/power_supply";
+        const std::string net = mRoot + "/sys/class/net/wlan0";
+        std::filesystem::create_directories(supply + "/battery");
+        std::filesystem::create_directories(supply + "/charger");
+        std::filesystem::create_directories(net + "/statistics");
+        std::filesystem::create_directories(mRoot + "/dev/input");
+        write_file(supply + "/battery/uevent",
+                   "POWER_SUPPLY_VOLTAGE_NOW=3800000\nPOWER_SUPPLY_CAPACITY=80\n");
+        write_file(supply + "/charger/online", "0\n");
+        write_file(net + "/ifindex", "3\n");
+        write_file(net + "/statistics/rx_packets", "0\n");
+        setTxPackets(0);
+        ASSERT_EQ(mkfifo((mRoot + "/dev/input/event0").c_str(), 0600), 0);
+
+        mSettings = {};
+        mSettings.battery_monitor_mode = battery_monitor_mode_t::VOLTAGE;
+        mSettings.battery_voltage_limit = 3.3;
+        mSettings.battery_capacity_limit = 5;
+        mSettings.net_activity_limit = 5;
+        mSettings.input_event_devices = { "/dev/input/event*" };
+        mSettings.input_coalescing = true;
+        mSettings.net_devices = { "wlan*" };
+        mSettings.net_sample_min_interval = 10;
+        mSettings.net_sample_max_interval = 60;
+        mSettings.inactive_on_battery_limit = 30 * 60;
+        mSettings.inactive_on_charger_limit = 0;
+        mSettings.sleep_enabled = true;
+        mSettings.use_logind = false;
+        mSettings.stats_target = mRoot + "/stats";
+        mSettings.sleep_system_cmd = "touch " + mRoot + "/suspended";
+        mSettings.shutdown_system_cmd = "touch " + mRoot + "/powered-off";
+        mSettings.charger_name = "charger";
+        mSettings.battery_name = "battery";
+
+        // The recorder is shared with the previous tests
+        const auto before = g_flight_recorder.snapshot();
+        mRecordsBefore = before.empty() ? flight_record_t{} : before.back();
+        set_clock(&mClock);
+        set_filesystem_root(mRoot);
+        set_input_clock_probe([] (int) { return true; });
+        mLoop.reset(new EventLoop());
+        mDaemon.reset(new Daemon(*mLoop, std::make_shared<const settings_t>(mSettings), nullptr));
+        ASSERT_TRUE(mDaemon->start());
+        mInput = open((mRoot + "/dev/input/event0").c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        ASSERT_NE(mInput, -1);
+    }
+
+    void TearDown() override {
+        mDaemon.reset();
+        mLoop.reset();
+        if (mInput != -1) {
+            close(mInput);
+        }
+        set_clock(nullptr);
+        set_filesystem_root("");
+        set_input_clock_probe(nullptr);
+        if (!mRoot.empty()) {
+            std::filesystem::remove_all(mRoot);
+        }
+    }
+
+    void settle() {
+        while (mLoop->dispatch(0) > 0) {
+        }
+    }
+
+    void advance(uint64_t usec) {
+        mClock.advance(usec, [this] () { settle(); });
+    }
+
+    void reconfigure(const settings_t &settings) {
+        mDaemon->applySettings(std::make_shared<const settings_t>(settings), diff_settings(mSettings, settings));
+        mSettings = settings;
+        settle();
+    }
+
+    // Every 5 minutes a burst of 3000 packets, 10 s after the sample
+    // before it, for minutes of idle time.
+    void burstEveryFiveMinutes(int minutes) {
+        uint64_t packets = 0;
+        for (int i = 0; i < minutes * 6; ++i) {
+            if (i % 30 == 15) {
+                packets += 3000;
+                setTxPackets(packets);
+            }
+            advance(10 * second_usec);
+        }
+    }
+
+    void setTxPackets(uint64_t packets) {
+        write_file(mRoot + "/sys/class/net/wlan0/statistics/tx_packets", std::to_string(packets) + "\n");
+    }
+
+    // Queues a key press stamped with the current time
+    void writeInput() {
+        const uint64_t now = mClock.nowUsec();
+        struct input_event ev = {};
+        ev.input_event_sec = now / second_usec;
+        ev.input_event_usec = now % second_usec;
+        ev.type = EV_KEY;
+        ev.code = KEY_A;
+        ev.value = 1;
+        ASSERT_EQ(write(mInput, &ev, sizeof(ev)), ssize_t(sizeof(ev)));
+    }
+
+    void touchInput() {
+        writeInput();
+        settle();
+    }
+
+    // The transition command runs in real time, the clock only moves for
+    // the waitpid() polling on kernels without pidfds.
+    bool waitForCommand(const std::string &done_file) {
+        for (int i = 0; i < 500; ++i) {
+            if (access(done_file.c_str(), F_OK) == 0 && mDaemon->state() == state_t::ACTIVE) {
+                return true;
+            }
+            mLoop->dispatch(10);
+            advance(100 * 1000);
+        }
+        return false;
+    }
+
+    // Sleep and shutdown decisions so far. The state itself may already be
+    // back to active, the command runs in real time and its exit may be
+    // dispatched by any settle().
+    uint64_t decisions() {
+        return mDaemon->stats().pending() + mDaemon->stats().flushed();
+    }
+
+    // Time of the last STATE_TRANSITION into to, 0 if there is none.
+    uint64_t lastTransition(state_t to) {
+        const auto records = g_flight_recorder.snapshot();
+        for (auto it = records.rbegin(); it != records.rend(); ++it) {
+            if (it->event == flight_event::STATE_TRANSITION && state_t(it->value) == to) {
+                return it->time_usec;
+            }
+        }
+        return 0;
+    }
+
+    // Records of event of this test after time_usec
+    std::vector<flight_record_t> records(flight_event event, uint64_t time_usec) {
+        const auto records = g_flight_recorder.snapshot();
+        auto it = records.end();
+        while (it != records.begin() && memcmp(&it[-1], &mRecordsBefore, sizeof(mRecordsBefore)) != 0) {
+            --it;
+        }
+        std::vector<flight_record_t> found;
+        for (; it != records.end(); ++it) {
+            if (it->event == event && it->time_usec > time_usec) {
+                found.push_back(*it);
+            }
+        }
+        return found;
+    }
+
+    std::vector<flight_record_t> netRates(uint64_t time_usec) {
+        return records(flight_event::NET_RATE, time_usec);
+    }
+
+    void setBatteryVoltage(double voltage) {
+        write_file(mRoot + "/sys/class/power_supply/battery/uevent",
+                   "POWER_SUPPLY_VOLTAGE_NOW=" + std::to_string(llround(voltage * 1000000)) +
+                   "\nPOWER_SUPPLY_CAPACITY=80\n");
+    }
+
+    std::string mRoot;
+    settings_t mSettings;
+    VirtualClock mClock;
+    std::unique_ptr<EventLoop> mLoop;
+    std::unique_ptr<Daemon> mDaemon;
+    int mInput = -1;
+    flight_record_t mRecordsBefore;
+};
+}
+
+TEST_F(DaemonScenario, IdleOnBatterySuspendsAfterThirtyMinutes) {
+    const uint64_t start = mClock.nowUsec();
+    advance(29 * minute_usec);
+    EXPECT_EQ(decisions(), 0u);
+
+    advance(2 * minute_usec);
+    EXPECT_EQ(decisions(), 1u);
+    // get_new_state() requires more than the limit in whole seconds
+    EXPECT_EQ(lastTransition(state_t::SLEEP), start + 30 * minute_usec + second_usec);
+
+    ASSERT_TRUE(waitForCommand(mRoot + "/suspended"));
+    ASSERT_TRUE(mDaemon->stats().flushNow());
+    EXPECT_NE(read_file(mRoot + "/stats").find("event-id=auto-suspend"), std::string::npos);
+}
+
+TEST_F(DaemonScenario, InputActivityRestartsTheIdleTime) {
+    const uint64_t start = mClock.nowUsec();
+    advance(20 * minute_usec);
+    touchInput();
+
+    advance(29 * minute_usec);
+    EXPECT_EQ(decisions(), 0u);
+
+    advance(2 * minute_usec);
+    EXPECT_EQ(decisions(), 1u);
+    EXPECT_EQ(lastTransition(state_t::SLEEP), start + 50 * minute_usec + second_usec);
+    ASSERT_TRUE(waitForCommand(mRoot + "/suspended"));
+}
+
+TEST_F(DaemonScenario, ActivityWhileDisarmedKeepsItsEventTime) {
+    const uint64_t start = mClock.nowUsec();
+    // Disarms the device until a second before the limit
+    touchInput();
+
+    advance(10 * minute_usec);
+    const uint64_t burst = mClock.nowUsec();
+    for (int i = 0; i < 100; ++i) {
+        writeInput();
+    }
+    settle();
+    EXPECT_TRUE(records(flight_event::INPUT_ACTIVITY, burst - second_usec).empty());
+
+    // Found on re-arm, dated by the events rather than the re-arm
+    advance(20 * minute_usec + 2 * second_usec);
+    const auto found = records(flight_event::INPUT_ACTIVITY, burst);
+    ASSERT_EQ(found.size(), 1u);
+    EXPECT_EQ(found[0].time_usec, start + 30 * minute_usec - second_usec);
+    EXPECT_EQ(uint64_t(found[0].value), burst / second_usec);
+    EXPECT_EQ(decisions(), 0u);
+
+    advance(10 * minute_usec);
+    EXPECT_EQ(decisions(), 1u);
+    EXPECT_EQ(lastTransition(state_t::SLEEP), burst + 30 * minute_usec + second_usec);
+    ASSERT_TRUE(waitForCommand(mRoot + "/suspended"));
+}
+
+TEST_F(DaemonScenario, NetworkTrafficHoldsOffSuspend) {
+    const uint64_t start = mClock.nowUsec();
+    // 100 packets in every 10 s network sample, above 5 packets/s
+    uint64_t packets = 0;
+    for (int i = 0; i < 6 * 40; ++i) {
+        packets += 100;
+        setTxPackets(packets);
+        advance(10 * second_usec);
+    }
+    EXPECT_EQ(decisions(), 0u);
+
+    // Idle for 40 minutes already, the next quiet sample decides
+    advance(20 * second_usec);
+    EXPECT_EQ(decisions(), 1u);
+    EXPECT_EQ(lastTransition(state_t::SLEEP), start + 40 * minute_usec + 10 * second_usec);
+    ASSERT_TRUE(waitForCommand(mRoot + "/suspended"));
+}
+
+TEST_F(DaemonScenario, QuietNetworkBacksOffUntilTheIdleDeadline) {
+    const uint64_t start = mClock.nowUsec();
+    // 10, 20, 40 and then 60 s apart instead of every 10 s
+    advance(10 * minute_usec);
+    auto rates = netRates(start);
+    ASSERT_EQ(rates.size(), 11u);
+    EXPECT_EQ(rates[0].a, 10000u);
+    EXPECT_EQ(rates[2].a, 40000u);
+    EXPECT_EQ(rates.back().a, 60000u);
+    EXPECT_EQ(rates.back().time_usec, start + 550 * second_usec);
+
+    // 600 packets in the 60 s since the last sample are 10 packets/s
+    setTxPackets(600);
+    advance(10 * second_usec);
+    rates = netRates(start + 550 * second_usec);
+    ASSERT_EQ(rates.size(), 1u);
+    EXPECT_EQ(rates[0].value, 10000);
+    // Near the limit, back at the minimum interval
+    setTxPackets(700);
+    advance(10 * second_usec);
+    rates = netRates(start + 610 * second_usec);
+    ASSERT_EQ(rates.size(), 1u);
+    EXPECT_EQ(rates[0].a, 10000u);
+    EXPECT_EQ(rates[0].value, 10000);
+
+    // Quiet again, a sample is taken just before the idle deadline
+    advance(20 * minute_usec);
+    EXPECT_EQ(decisions(), 1u);
+    EXPECT_EQ(lastTransition(state_t::SLEEP), start + 30 * minute_usec + second_usec);
+    rates = netRates(start + 29 * minute_usec);
+    EXPECT_TRUE(std::any_of(rates.begin(), rates.end(), [start] (const flight_record_t &r) {
+        return r.time_usec == start + 30 * minute_usec;
+    }));
+    ASSERT_TRUE(waitForCommand(mRoot + "/suspended"));
+}
+
+TEST_F(DaemonScenario, WindowMeanHoldsOffSuspendBetweenBursts) {
+    settings_t settings = mSettings;
+    settings.net_activity_window = 600;
+    settings.net_sample_max_interval = 10;
+    reconfigure(settings);
+
+    // 10 packets/s on average over the window, above the limit
+    burstEveryFiveMinutes(40);
+    EXPECT_EQ(decisions(), 0u);
+}
+
+TEST_F(DaemonScenario, PercentileIgnoresShortBursts) {
+    const uint64_t start = mClock.nowUsec();
+    settings_t settings = mSettings;
+    settings.net_activity_window = 600;
+    settings.net_activity_percentile = 90;
+    settings.net_sample_max_interval = 10;
+    reconfigure(settings);
+
+    // Busy in less than a tenth of the window
+    burstEveryFiveMinutes(31);
+    EXPECT_EQ(decisions(), 1u);
+    EXPECT_EQ(lastTransition(state_t::SLEEP), start + 30 * minute_usec + second_usec);
+    ASSERT_TRUE(waitForCommand(mRoot + "/suspended"));
+}
+
+TEST_F(DaemonScenario, LowBatteryShutsDown) {
+    const uint64_t start = mClock.nowUsec();
+    write_file(mRoot + "/sys/class/power_supply/battery/uevent",
+               "POWER_SUPPLY_VOLTAGE_NOW=3200000\nPOWER_SUPPLY_CAPACITY=2\n");
+    // The whole window of 10 samples must be below the limit
+    advance(90 * second_usec);
+    EXPECT_EQ(decisions(), 0u);
+    advance(20 * second_usec);
+    EXPECT_EQ(decisions(), 1u);
+    EXPECT_EQ(lastTransition(state_t::SHUTDOWN), start + 100 * second_usec);
+    ASSERT_TRUE(waitForCommand(mRoot + "/powered-off"));
+}
+
+TEST_F(DaemonScenario, FallingVoltageShutsDownAheadOfTheLimit) {
+    settings_t settings = mSettings;
+    settings.battery_shutdown_lead = 600;
+    settings.sleep_enabled = false;
+    reconfigure(settings);
+
+    // A steady battery is sampled every 5 minutes once the trend is known
+    const uint64_t start = mClock.nowUsec();
+    advance(30 * minute_usec);
+    EXPECT_LE(records(flight_event::BATTERY_SAMPLE, start).size(), 10u);
+    EXPECT_EQ(decisions(), 0u);
+
+    // 1 mV/s reaches the 3.3 V limit in 500 s
+    const uint64_t fall = mClock.nowUsec();
+    for (int i = 0; i < 50 && decisions() == 0; ++i) {
+        setBatteryVoltage(3.8 - 0.001 * i * 10);
+        advance(10 * second_usec);
+    }
+    EXPECT_EQ(decisions(), 1u);
+    const uint64_t shutdown = lastTransition(state_t::SHUTDOWN);
+    EXPECT_GT(shutdown, fall);
+    EXPECT_LT(shutdown, fall + 400 * second_usec);
+    ASSERT_TRUE(waitForCommand(mRoot + "/powered-off"));
+}
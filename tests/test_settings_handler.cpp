@@ -0,0 +1,106 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../settings_handler.hpp"
+
+TEST(SettingsHandler, DiffOfEqualSettingsIsEmpty) {
+    SettingsHandler handler;
+    const auto settings = handler.getSettings();
+    EXPECT_EQ(diff_settings(*settings, *settings), 0u);
+}
+
+TEST(SettingsHandler, DiffReportsChangedFields) {
+    SettingsHandler handler;
+    const settings_t old_settings = *handler.getSettings();
+
+    auto settings = old_settings;
+    settings.inactive_on_battery_limit = 300;
+    EXPECT_EQ(diff_settings(old_settings, settings),
+              settings_change(settings_field::INACT_ON_BAT_LIMIT));
+
+    settings.net_devices.push_back("eth0");
+    settings.charger_name = "ac";
+    EXPECT_EQ(diff_settings(old_settings, settings),
+              settings_change(settings_field::INACT_ON_BAT_LIMIT) |
+              settings_change(settings_field::NET_DEVICES) |
+              settings_change(settings_field::NAME_CHARGER));
+}
+
+TEST(SettingsHandler, GenerateSettingsReportsDbusChanges) {
+    SettingsHandler handler;
+    settings_changes_t changes = ~0u;
+    ASSERT_TRUE(handler.generateSettings(&changes));
+    EXPECT_EQ(changes, 0u);
+
+    handler.addDbusSetting(settings_field::ENABLED_SLEEP, "false");
+    ASSERT_TRUE(handler.generateSettings(&changes));
+    EXPECT_EQ(changes, settings_change(settings_field::ENABLED_SLEEP));
+    EXPECT_FALSE(handler.getSettings()->sleep_enabled);
+
+    ASSERT_TRUE(handler.generateSettings(&changes));
+    EXPECT_EQ(changes, 0u);
+}
+
+TEST(SettingsHandler, ChangesPublishNewSnapshot) {
+    SettingsHandler handler;
+    const settings_snapshot_t before = handler.getSettings();
+    ASSERT_TRUE(handler.generateSettings());
+    // Nothing changed, readers keep sharing the snapshot
+    EXPECT_EQ(handler.getSettings(), before);
+
+    handler.addDbusSetting(settings_field::INACT_ON_BAT_LIMIT, "600");
+    ASSERT_TRUE(handler.generateSettings());
+    const settings_snapshot_t after = handler.getSettings();
+    EXPECT_NE(after, before);
+    EXPECT_EQ(after->inactive_on_battery_limit, 600);
+    // A held snapshot never changes
+    EXPECT_EQ(before->inactive_on_battery_limit, 0);
+}
+
+TEST(SettingsHandler, ConfigFileIsLayeredBetweenDefaultsAndDbus) {
+    char path[] = "/tmp/fam_settings_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+    std::ofstream(path, std::ios::trunc) <<
+        "inactive_on_battery_limit = 900\n"
+        "inactive_on_charger_limit = 1200\n";
+
+    SettingsHandler handler;
+    handler.addDbusSetting(settings_field::INACT_ON_CHARGER_LIMIT, "60");
+    ASSERT_TRUE(handler.loadConfigFile(path));
+    settings_changes_t changes = 0;
+    ASSERT_TRUE(handler.generateSettings(&changes));
+    EXPECT_EQ(changes, settings_change(settings_field::INACT_ON_BAT_LIMIT) |
+                       settings_change(settings_field::INACT_ON_CHARGER_LIMIT));
+    EXPECT_EQ(handler.getSettings()->inactive_on_battery_limit, 900);
+    EXPECT_EQ(handler.getSettings()->inactive_on_charger_limit, 60);
+
+    // Only the edited field is reported, a removed key is back to its default
+    std::ofstream(path, std::ios::trunc) << "net_devices = eth0\n";
+    ASSERT_TRUE(handler.loadConfigFile(path));
+    ASSERT_TRUE(handler.generateSettings(&changes));
+    EXPECT_EQ(changes, settings_change(settings_field::INACT_ON_BAT_LIMIT) |
+                       settings_change(settings_field::NET_DEVICES));
+    EXPECT_EQ(handler.getSettings()->inactive_on_battery_limit, 0);
+    EXPECT_EQ(handler.getSettings()->inactive_on_charger_limit, 60);
+
+    // A broken edit keeps the previous file
+    std::ofstream(path, std::ios::trunc) << "net_devices = usb0\nsleep = off\n";
+    EXPECT_FALSE(handler.loadConfigFile(path));
+    ASSERT_TRUE(handler.generateSettings(&changes));
+    EXPECT_EQ(changes, 0u);
+    EXPECT_EQ(handler.getSettings()->net_devices, std::vector<std::string>{ "eth0" });
+    unlink(path);
+}
+
+TEST(SettingsHandler, NoBusBeforeDbusStarted) {
+    SettingsHandler handler;
+    bool called = false;
+    EXPECT_FALSE(handler.withBus([&] (sd_bus *) { called = true; }));
+    EXPECT_FALSE(called);
+}
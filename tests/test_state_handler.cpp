@@ -27,3 +27,128 @@ TEST(StateHandler, TransitionToSleep) {
 
 
 
+
+TEST(StateHandler, DeadlineFromIdleLimit) {
+    const timestamp_t now = 1000;
+
+    settings_t settings = {};
+    settings.sleep_enabled = true;
+    settings.inactive_on_battery_limit = 60;
+    settings.inactive_on_charger_limit = 120;
+    settings.net_activity_limit = 100;
+    status_t status = {};
+    status.input.event_time = now - 10;
+
+    const auto deadline = get_next_deadline(state_t::ACTIVE, settings, status, now);
+    EXPECT_EQ(deadline, now + 51);
+    EXPECT_EQ(get_new_state(state_t::ACTIVE, settings, status, deadline - 1), state_t::ACTIVE);
+    EXPECT_EQ(get_new_state(state_t::ACTIVE, settings, status, deadline), state_t::SLEEP);
+
+    status.input.charger_online = true;
+    EXPECT_EQ(get_next_deadline(state_t::ACTIVE, settings, status, now), now + 111);
+}
+
+TEST(StateHandler, IdleDeadlineIgnoresTheNetwork) {
+    const timestamp_t now = 1000;
+
+    settings_t settings = {};
+    settings.sleep_enabled = true;
+    settings.inactive_on_battery_limit = 60;
+    settings.net_activity_limit = 100;
+    status_t status = {};
+    status.input.event_time = now - 100;
+    status.net.max_traffic_last_period = 200;
+
+    // Passed already, only the traffic keeps the system awake
+    EXPECT_EQ(get_idle_deadline(settings, status), now - 39);
+    EXPECT_EQ(get_next_deadline(state_t::ACTIVE, settings, status, now), no_deadline);
+
+    settings.sleep_enabled = false;
+    EXPECT_EQ(get_idle_deadline(settings, status), no_deadline);
+}
+
+TEST(StateHandler, NoDeadlineWithoutTimedTransition) {
+    const timestamp_t now = 1000;
+
+    settings_t settings = {};
+    settings.sleep_enabled = true;
+    settings.inactive_on_battery_limit = 60;
+    settings.net_activity_limit = 100;
+    status_t status = {};
+    status.input.event_time = now;
+
+    status.net.max_traffic_last_period = 200;
+    EXPECT_EQ(get_next_deadline(state_t::ACTIVE, settings, status, now), no_deadline);
+
+    status.net.max_traffic_last_period = 0;
+    settings.sleep_enabled = false;
+    EXPECT_EQ(get_next_deadline(state_t::ACTIVE, settings, status, now), no_deadline);
+
+    settings.sleep_enabled = true;
+    settings.inactive_on_battery_limit = 0;
+    EXPECT_EQ(get_next_deadline(state_t::ACTIVE, settings, status, now), no_deadline);
+}
+
+TEST(StateHandler, NetworkActivityOverTheWindow) {
+    settings_t settings = {};
+    settings.net_activity_limit = 100;
+    network_status_t net = {};
+    net.max_traffic_last_period = 500;
+    net.window_traffic = 50;
+    net.window_buckets = 60;
+    net.busy_buckets = 6;
+
+    EXPECT_TRUE(network_is_active(settings, net));
+
+    // The mean of the window ignores the last burst
+    settings.net_activity_window = 60;
+    EXPECT_FALSE(network_is_active(settings, net));
+    net.window_traffic = 100;
+    EXPECT_TRUE(network_is_active(settings, net));
+
+    // The 90th percentile needs more than 6 of 60 busy buckets
+    settings.net_activity_percentile = 90;
+    EXPECT_FALSE(network_is_active(settings, net));
+    net.busy_buckets = 7;
+    EXPECT_TRUE(network_is_active(settings, net));
+
+    settings.net_activity_percentile = 100;
+    net.busy_buckets = 1;
+    EXPECT_TRUE(network_is_active(settings, net));
+    net.busy_buckets = 0;
+    EXPECT_FALSE(network_is_active(settings, net));
+}
+
+TEST(StateHandler, ShutdownAheadOfThePredictedLimit) {
+    const timestamp_t now = 1000;
+
+    settings_t settings = {};
+    settings.battery_monitor_mode = battery_monitor_mode_t::VOLTAGE;
+    settings.battery_shutdown_lead = 300;
+    settings.sleep_enabled = true;
+    settings.inactive_on_battery_limit = 600;
+    settings.net_activity_limit = 100;
+    status_t status = {};
+    status.input.event_time = now;
+    status.bat.voltage_limit_time = now + 400;
+    status.bat.capacity_limit_time = now + 100;
+
+    // Capacity is not monitored
+    EXPECT_EQ(get_battery_deadline(settings, status.bat), now + 100);
+    EXPECT_EQ(get_next_deadline(state_t::ACTIVE, settings, status, now), now + 100);
+    EXPECT_EQ(get_new_state(state_t::ACTIVE, settings, status, now + 99), state_t::ACTIVE);
+    EXPECT_EQ(get_new_state(state_t::ACTIVE, settings, status, now + 100), state_t::SHUTDOWN);
+
+    settings.battery_monitor_mode = battery_monitor_mode_t::BOTH;
+    EXPECT_EQ(get_battery_deadline(settings, status.bat), now - 200);
+    EXPECT_EQ(get_new_state(state_t::ACTIVE, settings, status, now), state_t::SHUTDOWN);
+
+    // Without a falling trend or a lead only the idle limit is left
+    status.bat.voltage_limit_time = no_deadline;
+    status.bat.capacity_limit_time = no_deadline;
+    EXPECT_EQ(get_next_deadline(state_t::ACTIVE, settings, status, now), now + 601);
+    status.bat.voltage_limit_time = now + 400;
+    settings.battery_shutdown_lead = 0;
+    EXPECT_EQ(get_battery_deadline(settings, status.bat), no_deadline);
+    EXPECT_EQ(get_new_state(state_t::ACTIVE, settings, status, now + 400), state_t::ACTIVE);
+}
@@ -0,0 +1,142 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../stats_sink.hpp"
+
+namespace {
+std::string read_file(const std::string &path) {
+    std::ifstream f(path);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+class StatsSinkTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char dir[] = "/tmp/fam_stats_XXXXXX";
+        ASSERT_NE(mkdtemp(dir), nullptr);
+        mDir = dir;
+    }
+
+    void TearDown() override {
+        unlink((mDir + "/spool").c_str());
+        unlink((mDir + "/sock").c_str());
+        unlink((mDir + "/collector").c_str());
+        unlink((mDir + "/calls").c_str());
+        rmdir(mDir.c_str());
+    }
+
+    std::string mDir;
+};
+}
+
+TEST_F(StatsSinkTest, FlushesBatchToSpoolFile) {
+    EventLoop loop;
+    const std::string spool = mDir + "/spool";
+    StatsSink sink(loop, spool);
+
+    sink.record("auto-suspend");
+    sink.record("low-battery-shutdown");
+    EXPECT_EQ(sink.pending(), 2u);
+    EXPECT_TRUE(read_file(spool).empty());
+
+    EXPECT_TRUE(sink.flushNow());
+    EXPECT_EQ(sink.pending(), 0u);
+    EXPECT_EQ(sink.flushed(), 2u);
+
+    const auto content = read_file(spool);
+    EXPECT_NE(content.find(" event-id=auto-suspend event-source=flir-activity-monitor event-type=info\n"), std::string::npos);
+    EXPECT_NE(content.find(" event-id=low-battery-shutdown "), std::string::npos);
+}
+
+TEST_F(StatsSinkTest, FullBatchFlushesFromLoop) {
+    EventLoop loop;
+    const std::string spool = mDir + "/spool";
+    StatsSink sink(loop, spool);
+
+    for (size_t i = 0; i < StatsSink::batch_size; ++i) {
+        sink.record("auto-suspend");
+    }
+    const int stop = loop.addTimer([&] (uint32_t) { loop.stop(); });
+    loop.armTimer(stop, 50, 0);
+    loop.run();
+    EXPECT_EQ(sink.flushed(), StatsSink::batch_size);
+    EXPECT_EQ(sink.pending(), 0u);
+}
+
+TEST_F(StatsSinkTest, KeepsEventsWhileTargetUnavailableAndDropsWhenFull) {
+    EventLoop loop;
+    StatsSink sink(loop, mDir + "/missing/spool");
+
+    for (size_t i = 0; i < StatsSink::capacity + 3; ++i) {
+        sink.record("auto-suspend");
+    }
+    EXPECT_FALSE(sink.flushNow());
+    EXPECT_EQ(sink.pending(), StatsSink::capacity);
+    EXPECT_EQ(sink.dropped(), 3u);
+
+    sink.setTarget(mDir + "/spool");
+    EXPECT_TRUE(sink.flushNow());
+    EXPECT_EQ(sink.flushed(), StatsSink::capacity);
+}
+
+TEST_F(StatsSinkTest, SendsDatagramToUnixSocket) {
+    const std::string path = mDir + "/sock";
+    const int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_NE(fd, -1);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    ASSERT_EQ(bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)), 0);
+
+    EventLoop loop;
+    StatsSink sink(loop, "unix:" + path);
+    sink.record("auto-suspend");
+    sink.record("auto-suspend");
+    EXPECT_TRUE(sink.flushNow());
+
+    char buf[1024];
+    const ssize_t len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    ASSERT_GT(len, 0);
+    const std::string batch(buf, len);
+    EXPECT_EQ(std::count(batch.begin(), batch.end(), '\n'), 2);
+    close(fd);
+}
+
+TEST_F(StatsSinkTest, RunsTheCollectorOncePerEvent) {
+    const std::string collector = mDir + "/collector";
+    const std::string calls = mDir + "/calls";
+    {
+        std::ofstream f(collector);
+        f << "#!/bin/sh\necho \"$@\" >> '" << calls << "'\n";
+    }
+    ASSERT_EQ(chmod(collector.c_str(), 0755), 0);
+
+    EventLoop loop;
+    StatsSink sink(loop, "exec:" + collector);
+    sink.record("auto-suspend");
+    sink.record("low-battery-shutdown");
+    EXPECT_TRUE(sink.flushNow());
+    EXPECT_EQ(sink.flushed(), 2u);
+
+    std::string content;
+    for (int i = 0; i < 500 && std::count(content.begin(), content.end(), '\n') < 2; ++i) {
+        loop.dispatch(10);
+        content = read_file(calls);
+    }
+    EXPECT_EQ(content,
+              "--event-id auto-suspend --field event-source=flir-activity-monitor --field event-type=info\n"
+              "--event-id low-battery-shutdown --field event-source=flir-activity-monitor --field event-type=info\n");
+}
@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "../seqlock.hpp"
+#include "../input_monitor.hpp"
+
+namespace {
+typedef struct {
+    uint64_t a;
+    uint32_t b;
+    double c;
+    bool d;
+} snapshot_t;
+
+const int nbr_readers = 4;
+const int nbr_writes = 200000;
+}
+
+TEST(StatusSnapshot, ReadersNeverSeeTornValues) {
+    SeqLock<snapshot_t> lock(snapshot_t{0, 0, 0, false});
+    std::atomic<bool> done(false);
+    std::atomic<int> torn(0);
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < nbr_readers; ++r) {
+        readers.emplace_back([&] {
+            while (!done) {
+                const auto s = lock.load();
+                if (s.b != uint32_t(s.a) || s.c != double(s.a) || s.d != bool(s.a & 1)) {
+                    torn++;
+                }
+            }
+        });
+    }
+
+    for (uint64_t i = 1; i <= nbr_writes; ++i) {
+        lock.store(snapshot_t{i, uint32_t(i), double(i), bool(i & 1)});
+    }
+    done = true;
+    for (auto &t: readers) {
+        t.join();
+    }
+
+    EXPECT_EQ(torn, 0);
+    EXPECT_EQ(lock.load().a, uint64_t(nbr_writes));
+}
+
+TEST(StatusSnapshot, InputMonitorGetStatusUnderContention) {
+    settings_t settings = {};
+    settings.charger_name = "fam-test-no-such-charger";
+    InputMonitor input(std::make_shared<const settings_t>(settings));
+    input.reset();
+
+    std::atomic<bool> done(false);
+    std::atomic<long> reads(0);
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < nbr_readers; ++r) {
+        readers.emplace_back([&] {
+            while (!done) {
+                const auto status = input.getStatus();
+                EXPECT_NE(status.event_time, 0u);
+                reads++;
+            }
+        });
+    }
+
+    // Events injected from two writers, as the battery and input threads do
+    std::thread charger([&] {
+        for (int i = 0; i < nbr_writes / 10; ++i) {
+            input.chargerChanged(true);
+        }
+    });
+    for (int i = 0; i < nbr_writes / 10; ++i) {
+        input.chargerChanged(false);
+    }
+    charger.join();
+    input.chargerChanged(true);
+
+    done = true;
+    for (auto &t: readers) {
+        t.join();
+    }
+
+    EXPECT_TRUE(input.getStatus().charger_online);
+    EXPECT_GT(reads, 0);
+}
@@ -0,0 +1,55 @@
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sysfs_attribute.hpp"
+
+namespace {
+void write_file(const std::string &path, const char *content) {
+    FILE *f = fopen(path.c_str(), "w");
+    ASSERT_NE(f, nullptr);
+    fputs(content, f);
+    fclose(f);
+}
+}
+
+TEST(SysfsAttribute, ParsePowerSupplyUevent) {
+    const char uevent[] =
+        "POWER_SUPPLY_NAME=battery\n"
+        "POWER_SUPPLY_STATUS=Discharging\n"
+        "POWER_SUPPLY_VOLTAGE_NOW=3712000\n"
+        "POWER_SUPPLY_VOLTAGE_NOW_MAX=4200000\n"
+        "POWER_SUPPLY_CAPACITY=42\n"
+        "POWER_SUPPLY_CAPACITY_LEVEL=Normal\n";
+
+    auto values = power_supply_failed_values();
+    parse_power_supply_uevent(uevent, sizeof(uevent) - 1, values);
+
+    EXPECT_EQ(values.voltage_now, 3712000);
+    EXPECT_EQ(values.capacity, 42);
+    EXPECT_EQ(values.online, power_supply_failed_values().online);
+}
+
+TEST(SysfsAttribute, RereadsAndRecovers) {
+    char dir[] = "/tmp/fam_sysfs_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    const std::string path = std::string(dir) + "/online";
+
+    SysfsAttribute attribute(path);
+    EXPECT_EQ(attribute.readInt(-1), -1);
+
+    write_file(path, "1\n");
+    EXPECT_EQ(attribute.readInt(-1), 1);
+
+    write_file(path, "0\n");
+    EXPECT_EQ(attribute.readInt(-1), 0);
+
+    write_file(path, "garbage\n");
+    EXPECT_EQ(attribute.readInt(-1), -1);
+
+    unlink(path.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,140 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../trace_replay.hpp"
+
+namespace {
+const uint64_t sec = 1000000;
+
+settings_t decision_settings() {
+    settings_t settings = {};
+    settings.battery_monitor_mode = battery_monitor_mode_t::VOLTAGE;
+    settings.battery_voltage_limit = 3.2;
+    settings.battery_capacity_limit = 5;
+    settings.net_activity_limit = 100;
+    settings.inactive_on_battery_limit = 300;
+    settings.inactive_on_charger_limit = 0;
+    settings.sleep_enabled = true;
+    return settings;
+}
+
+flight_record_t rec(uint64_t time_s, flight_event event, uint32_t a, int64_t value) {
+    return { time_s * sec, event, a, value };
+}
+
+std::vector<flight_record_t> settings_records(const settings_t &settings, uint64_t time_s) {
+    std::unique_ptr<FlightRecorder> recorder(new FlightRecorder());
+    record_decision_settings(*recorder, settings);
+    auto records = recorder->snapshot();
+    for (auto &r: records) {
+        r.time_usec = time_s * sec;
+    }
+    return records;
+}
+}
+
+TEST(TraceReplay, SettingsRoundTrip) {
+    settings_t settings = decision_settings();
+    settings.battery_shutdown_lead = 300;
+    settings_t replayed = {};
+    for (const auto &r: settings_records(settings, 0)) {
+        EXPECT_TRUE(apply_setting_record(replayed, r));
+    }
+    EXPECT_EQ(replayed.battery_monitor_mode, settings.battery_monitor_mode);
+    EXPECT_EQ(replayed.battery_voltage_limit, settings.battery_voltage_limit);
+    EXPECT_EQ(replayed.battery_capacity_limit, settings.battery_capacity_limit);
+    EXPECT_EQ(replayed.battery_shutdown_lead, settings.battery_shutdown_lead);
+    EXPECT_EQ(replayed.net_activity_limit, settings.net_activity_limit);
+    EXPECT_EQ(replayed.inactive_on_battery_limit, settings.inactive_on_battery_limit);
+    EXPECT_EQ(replayed.inactive_on_charger_limit, settings.inactive_on_charger_limit);
+    EXPECT_EQ(replayed.sleep_enabled, settings.sleep_enabled);
+}
+
+TEST(TraceReplay, SleepResumeAndLowBattery) {
+    std::vector<flight_record_t> trace = settings_records(decision_settings(), 1000);
+    trace.push_back(rec(1000, flight_event::INPUT_RESET, 0, 1000));
+    // Idle from 1000 s, the 300 s limit runs out at 1301 s
+    trace.push_back(rec(1301, flight_event::STATE_TRANSITION, 0, 1));
+    // Resumed at 1400 s
+    trace.push_back(rec(1400, flight_event::INPUT_RESET, 0, 1400));
+    trace.push_back(rec(1400, flight_event::BATTERY_RESET, 0, 0));
+    trace.push_back(rec(1400, flight_event::TRANSITION_DONE, 1, 0));
+    for (uint64_t i = 0; i < 10; ++i) {
+        trace.push_back(rec(1410 + i, flight_event::BATTERY_SAMPLE, 3, 3100000));
+        trace.push_back(rec(1410 + i, flight_event::INPUT_ACTIVITY, 0, 1410 + i));
+    }
+    trace.push_back(rec(1419, flight_event::STATE_TRANSITION, 0, 2));
+
+    TraceReplay replay(settings_t{});
+    for (const auto &r: trace) {
+        replay.feed(r);
+    }
+    ASSERT_EQ(replay.recorded().size(), 2u);
+    ASSERT_EQ(replay.transitions().size(), 2u);
+    EXPECT_EQ(replay.transitions()[0].to, state_t::SLEEP);
+    EXPECT_EQ(replay.transitions()[0].time_usec, 1301 * sec);
+    EXPECT_EQ(replay.transitions()[1].from, state_t::ACTIVE);
+    EXPECT_EQ(replay.transitions()[1].to, state_t::SHUTDOWN);
+    EXPECT_EQ(replay.transitions()[1].time_usec, 1419 * sec);
+}
+
+TEST(TraceReplay, ShutdownAheadOfTheVoltageLimit) {
+    settings_t settings = decision_settings();
+    settings.battery_shutdown_lead = 300;
+    settings.sleep_enabled = false;
+    std::vector<flight_record_t> trace = settings_records(settings, 1000);
+    trace.push_back(rec(1000, flight_event::INPUT_RESET, 0, 1000));
+    // 1 mV/s from 3.7 V reaches 3.2 V at 1500 s, 300 s ahead is 1200 s
+    for (uint64_t t = 1000; t <= 1100; t += 50) {
+        trace.push_back(rec(t, flight_event::BATTERY_SAMPLE, 50, 3700000 - 1000 * (t - 1000)));
+    }
+    trace.push_back(rec(1200, flight_event::STATE_TRANSITION, 0, 2));
+    trace.push_back(rec(1500, flight_event::NET_RATE, 10000, 0));
+
+    TraceReplay replay(settings_t{});
+    for (const auto &r: trace) {
+        replay.feed(r);
+    }
+    ASSERT_EQ(replay.transitions().size(), 1u);
+    EXPECT_EQ(replay.transitions()[0].to, state_t::SHUTDOWN);
+    EXPECT_EQ(replay.transitions()[0].time_usec, 1200 * sec);
+}
+
+TEST(TraceReplay, TraceFileRoundTrip) {
+    char dir[] = "/tmp/fam_trace_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    const std::string path = std::string(dir) + "/trace";
+
+    std::unique_ptr<FlightRecorder> recorder(new FlightRecorder());
+    ASSERT_TRUE(recorder->startTrace(path));
+    recorder->record(flight_event::NET_RATE, 0, 12300);
+    recorder->record(flight_event::INPUT_ACTIVITY, 1, 42);
+    recorder->stopTrace();
+    recorder->record(flight_event::NET_RATE, 0, 1);
+
+    std::ifstream f(path, std::ios::binary);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    const std::string content = ss.str();
+    flight_dump_header_t header;
+    std::vector<flight_record_t> records;
+    ASSERT_TRUE(parse_flight_trace(content.data(), content.size(), header, records));
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_EQ(records[1].event, flight_event::INPUT_ACTIVITY);
+    EXPECT_EQ(records[1].value, 42);
+    // A record cut short is ignored, a dump is not a trace
+    EXPECT_TRUE(parse_flight_trace(content.data(), content.size() - 5, header, records));
+    EXPECT_EQ(records.size(), 1u);
+    EXPECT_FALSE(parse_flight_dump(content.data(), content.size(), header, records));
+
+    unlink(path.c_str());
+    rmdir(dir);
+}
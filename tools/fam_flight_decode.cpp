@@ -0,0 +1,108 @@
+/*
+ * Prints the records of a flight recorder dump or trace, one per line:
+ *
+ *   fam-flight-decode /var/log/flir-activity-monitor/flight-recorder.bin
+ */
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "flight_recorder.hpp"
+#include "state_handler.hpp"
+
+namespace {
+const char *state_name(int64_t state) {
+    switch (state_t(state)) {
+        case state_t::ACTIVE:
+            return "active";
+        case state_t::SLEEP:
+            return "sleep";
+        case state_t::SHUTDOWN:
+            return "shutdown";
+    }
+    return "?";
+}
+
+void print_details(const flight_record_t &r) {
+    switch (r.event) {
+        case flight_event::BATTERY_SAMPLE:
+            printf("voltage=%.3fV capacity=%" PRIu32 "%%", double(r.value) / 1000000, r.a);
+            break;
+        case flight_event::CHARGER:
+            printf("online=%" PRIu32, r.a);
+            break;
+        case flight_event::INPUT_ACTIVITY:
+        case flight_event::INPUT_RESET:
+            printf("event_time=%" PRId64 " charger=%" PRIu32, r.value, r.a);
+            break;
+        case flight_event::SETTING:
+            printf("field=%" PRIu32 " value=%" PRId64, r.a, r.value);
+            break;
+        case flight_event::NET_RATE:
+            printf("packets_per_s=%.3f elapsed_ms=%" PRIu32, double(r.value) / 1000, r.a);
+            break;
+        case flight_event::NET_WINDOW:
+            printf("packets_per_s=%.3f busy_buckets=%" PRIu32 "/%" PRIu32,
+                   double(r.value) / 1000, r.a >> 16, r.a & 0xffff);
+            break;
+        case flight_event::SETTINGS_CHANGE:
+            printf("changes=0x%" PRIx32, r.a);
+            break;
+        case flight_event::STATE_TRANSITION:
+            printf("from=%s to=%s", state_name(r.a), state_name(r.value));
+            break;
+        case flight_event::TRANSITION_DONE:
+            printf("state=%s status=%" PRId64, state_name(r.a), r.value);
+            break;
+        default:
+            printf("a=%" PRIu32 " value=%" PRId64, r.a, r.value);
+            break;
+    }
+}
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <flight recorder dump>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream f(argv[1], std::ios::binary);
+    if (!f) {
+        fprintf(stderr, "Cannot open '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    const std::string content = ss.str();
+
+    flight_dump_header_t header;
+    std::vector<flight_record_t> records;
+    if (!parse_flight_dump(content.data(), content.size(), header, records) &&
+        !parse_flight_trace(content.data(), content.size(), header, records)) {
+        fprintf(stderr, "'%s' is not a version %u flight recorder dump or trace\n", argv[1], FlightRecorder::version);
+        return EXIT_FAILURE;
+    }
+
+    for (const auto &r: records) {
+        // Wall time from the clocks at the dump or trace start, off by any
+        // clock change or suspend in between
+        const int64_t wall_usec = int64_t(header.realtime_usec) - int64_t(header.monotonic_usec - r.time_usec);
+        const time_t sec = wall_usec / 1000000;
+        struct tm tm;
+        char date[32];
+        localtime_r(&sec, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("%s.%06d %12.6f %-16s ", date, int(wall_usec % 1000000),
+               double(r.time_usec) / 1000000, flight_event_name(r.event));
+        print_details(r);
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/*
+ * Replays a trace recorded with flir-activity-monitor --trace through the
+ * state decision and compares the transitions with the recorded ones:
+ *
+ *   fam-replay /tmp/field.trace
+ *
+ * Exits with 1 if the replayed transitions differ from the recorded ones.
+ */
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.hpp"
+#include "trace_replay.hpp"
+
+namespace {
+const char *state_name(state_t state) {
+    switch (state) {
+        case state_t::ACTIVE:
+            return "active";
+        case state_t::SLEEP:
+            return "sleep";
+        case state_t::SHUTDOWN:
+            return "shutdown";
+    }
+    return "?";
+}
+
+void print_changes(const char *title, const std::vector<state_change_t> &changes) {
+    printf("%s (%zu):\n", title, changes.size());
+    for (const auto &c: changes) {
+        printf("  %12.6f %s -> %s\n", double(c.time_usec) / 1000000, state_name(c.from), state_name(c.to));
+    }
+}
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    // get_new_state() logs every decision
+    logger_set_level(log_level_t::ERROR);
+
+    std::ifstream f(argv[1], std::ios::binary);
+    if (!f) {
+        fprintf(stderr, "Cannot open '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    const std::string content = ss.str();
+
+    flight_dump_header_t header;
+    std::vector<flight_record_t> records;
+    if (!parse_flight_trace(content.data(), content.size(), header, records)) {
+        fprintf(stderr, "'%s' is not a version %u trace\n", argv[1], FlightRecorder::version);
+        return EXIT_FAILURE;
+    }
+    // Threads append in the order they took the trace lock
+    std::stable_sort(records.begin(), records.end(), [] (const flight_record_t &a, const flight_record_t &b) {
+        return a.time_usec < b.time_usec;
+    });
+
+    // The trace's SETTING records replace these before the first decision
+    TraceReplay replay(settings_t{});
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto &r: records) {
+        replay.feed(r);
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    print_changes("Recorded transitions", replay.recorded());
+    print_changes("Replayed transitions", replay.transitions());
+
+    const auto &a = replay.recorded();
+    const auto &b = replay.transitions();
+    const bool same = a.size() == b.size() &&
+        std::equal(a.begin(), a.end(), b.begin(), [] (const state_change_t &x, const state_change_t &y) {
+            return x.from == y.from && x.to == y.to;
+        });
+    uint64_t max_skew_usec = 0;
+    if (same) {
+        for (size_t i = 0; i < a.size(); ++i) {
+            const uint64_t skew = a[i].time_usec > b[i].time_usec ?
+                a[i].time_usec - b[i].time_usec : b[i].time_usec - a[i].time_usec;
+            max_skew_usec = std::max(max_skew_usec, skew);
+        }
+    }
+
+    const double span = records.empty() ? 0 :
+        double(records.back().time_usec - records.front().time_usec) / 1000000;
+    printf("%zu records covering %.0f s replayed in %.3f s, %zu evaluations.\n",
+           records.size(), span, elapsed, replay.evaluations());
+    if (!same) {
+        printf("Replayed transitions differ from the recorded ones.\n");
+        return 1;
+    }
+    printf("Transitions match, largest time difference %.3f s.\n", double(max_skew_usec) / 1000000);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "trace_replay.hpp"
+
+#include <math.h>
+
+void record_decision_settings(FlightRecorder &recorder, const settings_t &settings) {
+    const auto record = [&recorder] (settings_field field, int64_t value) {
+        recorder.record(flight_event::SETTING, static_cast<uint32_t>(field), value);
+    };
+    record(settings_field::BAT_MONITOR_MODE, static_cast<int64_t>(settings.battery_monitor_mode));
+    record(settings_field::BAT_VOLTAGE_LIMIT, llround(settings.battery_voltage_limit * 1000000));
+    record(settings_field::BAT_PERCENTAGE_LIMIT, llround(settings.battery_capacity_limit * 1000));
+    record(settings_field::NET_ACTIVITY_LIMIT, llround(settings.net_activity_limit * 1000));
+    record(settings_field::INACT_ON_BAT_LIMIT, settings.inactive_on_battery_limit);
+    record(settings_field::INACT_ON_CHARGER_LIMIT, settings.inactive_on_charger_limit);
+    record(settings_field::ENABLED_SLEEP, settings.sleep_enabled);
+    record(settings_field::NET_ACTIVITY_WINDOW, settings.net_activity_window);
+    record(settings_field::NET_ACTIVITY_PERCENTILE, settings.net_activity_percentile);
+    record(settings_field::BAT_SHUTDOWN_LEAD, settings.battery_shutdown_lead);
+}
+
+bool apply_setting_record(settings_t &settings, const flight_record_t &record) {
+    switch (static_cast<settings_field>(record.a)) {
+        case settings_field::BAT_MONITOR_MODE:
+            settings.battery_monitor_mode = static_cast<battery_monitor_mode_t>(record.value);
+            return true;
+        case settings_field::BAT_VOLTAGE_LIMIT:
+            settings.battery_voltage_limit = double(record.value) / 1000000;
+            return true;
+        case settings_field::BAT_PERCENTAGE_LIMIT:
+            settings.battery_capacity_limit = double(record.value) / 1000;
+            return true;
+        case settings_field::NET_ACTIVITY_LIMIT:
+            settings.net_activity_limit = double(record.value) / 1000;
+            return true;
+        case settings_field::INACT_ON_BAT_LIMIT:
+            settings.inactive_on_battery_limit = record.value;
+            return true;
+        case settings_field::INACT_ON_CHARGER_LIMIT:
+            settings.inactive_on_charger_limit = record.value;
+            return true;
+        case settings_field::ENABLED_SLEEP:
+            settings.sleep_enabled = record.value != 0;
+            return true;
+        case settings_field::NET_ACTIVITY_WINDOW:
+            settings.net_activity_window = record.value;
+            return true;
+        case settings_field::NET_ACTIVITY_PERCENTILE:
+            settings.net_activity_percentile = record.value;
+            return true;
+        case settings_field::BAT_SHUTDOWN_LEAD:
+            settings.battery_shutdown_lead = record.value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+TraceReplay::TraceReplay(const settings_t &settings)
+: mSettings(settings)
+, mState(state_t::ACTIVE)
+, mStatus{}
+, mDeadline(no_deadline)
+, mEvaluations(0)
+{
+    mStatus.bat = evaluateBattery();
+}
+
+void
+TraceReplay::feed(const flight_record_t &record) {
+    // Deadlines passed before the record, as the evaluation timer would
+    while (mDeadline != no_deadline && uint64_t(mDeadline) * 1000000 <= record.time_usec) {
+        evaluate(uint64_t(mDeadline) * 1000000);
+    }
+
+    switch (record.event) {
+        case flight_event::BATTERY_SAMPLE:
+        {
+            const power_supply_values_t values = {
+                .voltage_now = record.value,
+                .capacity = int32_t(record.a),
+                .online = -1,
+            };
+            mVoltage.addValue(double(values.voltage_now) / 1000000);
+            mCapacity.addValue(values.capacity);
+            add_battery_trend_sample(mVoltageTrend, mCapacityTrend, record.time_usec, values);
+            mStatus.bat = evaluateBattery();
+            evaluate(record.time_usec);
+            break;
+        }
+        case flight_event::BATTERY_RESET:
+            mVoltage.reset();
+            mCapacity.reset();
+            mVoltageTrend.reset();
+            mCapacityTrend.reset();
+            mStatus.bat = evaluateBattery();
+            break;
+        case flight_event::INPUT_ACTIVITY:
+            mStatus.input = { .event_time = timestamp_t(record.value), .charger_online = record.a != 0 };
+            evaluate(record.time_usec);
+            break;
+        case flight_event::INPUT_RESET:
+            mStatus.input = { .event_time = timestamp_t(record.value), .charger_online = record.a != 0 };
+            // The input monitor starts with a reset, the daemon evaluates once
+            // all monitors started
+            if (mEvaluations == 0) {
+                evaluate(record.time_usec);
+            }
+            break;
+        case flight_event::NET_WINDOW:
+            // Precedes the NET_RATE record of the same sample
+            mStatus.net.window_traffic = double(record.value) / 1000;
+            mStatus.net.window_buckets = record.a & 0xffff;
+            mStatus.net.busy_buckets = record.a >> 16;
+            break;
+        case flight_event::NET_RATE:
+            mStatus.net.max_traffic_last_period = double(record.value) / 1000;
+            evaluate(record.time_usec);
+            break;
+        case flight_event::SETTING:
+            apply_setting_record(mSettings, record);
+            break;
+        case flight_event::SETTINGS_CHANGE:
+            // Follows the SETTING records of the change
+            mStatus.bat = evaluateBattery();
+            evaluate(record.time_usec);
+            break;
+        case flight_event::STATE_TRANSITION:
+            mRecorded.push_back({ record.time_usec, state_t(record.a), state_t(record.value) });
+            break;
+        case flight_event::TRANSITION_DONE:
+            if (mState == state_t(record.a)) {
+                mState = state_t::ACTIVE;
+            }
+            evaluate(record.time_usec);
+            break;
+        default:
+            break;
+    }
+}
+
+void
+TraceReplay::evaluate(uint64_t time_usec) {
+    const timestamp_t now = time_usec / 1000000;
+    ++mEvaluations;
+    const state_t new_state = get_new_state(mState, mSettings, mStatus, now);
+    if (new_state != mState) {
+        mTransitions.push_back({ time_usec, mState, new_state });
+        mState = new_state;
+    }
+    mDeadline = get_next_deadline(mState, mSettings, mStatus, now);
+}
+
+battery_status_t
+TraceReplay::evaluateBattery() const {
+    return evaluate_battery_windows(mVoltage, mCapacity, mVoltageTrend, mCapacityTrend, mSettings);
+}
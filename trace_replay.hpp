@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.hpp"
+#include "state_handler.hpp"
+#include "battery_monitor.hpp"
+#include "flight_recorder.hpp"
+
+// Records the settings get_new_state() and get_next_deadline() depend on
+// as SETTING records, so a trace carries them. Limits in V and % are
+// stored in millionths and thousandths.
+void record_decision_settings(FlightRecorder &recorder, const settings_t &settings);
+// Applies a SETTING record, false if the field is not recorded.
+bool apply_setting_record(settings_t &settings, const flight_record_t &record);
+
+typedef struct {
+    uint64_t time_usec;
+    state_t from;
+    state_t to;
+} state_change_t;
+
+/*
+ * Feeds a recorded trace through the state decision of the daemon.
+ *
+ * Status records rebuild the input, network and battery status the way
+ * the monitors built them, the battery through the same sample windows
+ * and trends.
+ * The state is evaluated after every status record, at every deadline
+ * returned by get_next_deadline() and when a transition finished, without
+ * waiting in between. reset() records apply without an evaluation since
+ * the daemon evaluates once all monitors are reset, except for the input
+ * reset starting the trace.
+ */
+class TraceReplay {
+public:
+    // settings are used until the trace's SETTING records replace them.
+    explicit TraceReplay(const settings_t &settings);
+
+    // Records must be fed in time order.
+    void feed(const flight_record_t &record);
+
+    // Transitions decided by the replay and those found in the trace.
+    const std::vector<state_change_t> &transitions() const { return mTransitions; }
+    const std::vector<state_change_t> &recorded() const { return mRecorded; }
+    size_t evaluations() const { return mEvaluations; }
+
+private:
+    void evaluate(uint64_t time_usec);
+    battery_status_t evaluateBattery() const;
+
+    settings_t mSettings;
+    state_t mState;
+    status_t mStatus;
+    battery_window_t mVoltage;
+    battery_window_t mCapacity;
+    DischargeTrend mVoltageTrend;
+    DischargeTrend mCapacityTrend;
+    timestamp_t mDeadline;
+    std::vector<state_change_t> mTransitions;
+    std::vector<state_change_t> mRecorded;
+    size_t mEvaluations;
+};
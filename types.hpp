@@ -1,7 +1,9 @@
 #pragma once
 #include <chrono>
+#include <memory>
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 using timestamp_t = uint32_t;
 
@@ -12,12 +14,22 @@ typedef struct {
 
 typedef struct {
     double max_traffic_last_period;
+    // Over net_activity_window: the highest mean rate of an interface, and
+    // the completed and busy buckets of the interface with the largest
+    // busy share
+    double window_traffic;
+    uint32_t window_buckets;
+    uint32_t busy_buckets;
 } network_status_t;
 
 typedef struct {
     bool valid;
     bool voltage_below_limit;
     bool capacity_below_limit;
+    // Time at which the voltage and capacity trends reach their limits,
+    // UINT32_MAX (no_deadline) while they are not falling
+    timestamp_t voltage_limit_time;
+    timestamp_t capacity_limit_time;
 } battery_status_t;
 
 typedef struct {
@@ -38,14 +50,72 @@ typedef struct {
     battery_monitor_mode_t battery_monitor_mode;
     double battery_voltage_limit;
     double battery_capacity_limit;
+    // Seconds before a battery limit is predicted to be reached to shut
+    // down, 0 to wait for the samples to reach it
+    int battery_shutdown_lead;
     double net_activity_limit;
     std::vector<std::string> input_event_devices;
+    std::vector<std::string> input_device_properties;
+    bool input_coalescing;
     std::vector<std::string> net_devices;
+    // Seconds between network samples, longer while the traffic is far
+    // below net_activity_limit
+    int net_sample_min_interval;
+    int net_sample_max_interval;
+    // Seconds of history the network activity is judged on, 0 for the last
+    // sample only. Active if the mean rate over the window reaches the
+    // limit, or with a percentile of 1 to 100, if that percentile of the
+    // rates of the window's buckets does.
+    int net_activity_window;
+    int net_activity_percentile;
     int inactive_on_battery_limit;
     int inactive_on_charger_limit;
     bool sleep_enabled;
+    // Suspend and power off through logind, the commands are the fallback
+    bool use_logind;
+    // Spool file, "unix:<socket path>" or "exec:<collector path>" receiving
+    // usage statistics
+    std::string stats_target;
+    // Run without a shell unless they use shell syntax, see
+    // command_needs_shell()
     std::string sleep_system_cmd;
     std::string shutdown_system_cmd;
     std::string charger_name;
     std::string battery_name;
 } settings_t;
+
+// Immutable settings shared by the handler, the daemon and the monitors. A
+// change publishes a new snapshot, readers keep the one they hold.
+using settings_snapshot_t = std::shared_ptr<const settings_t>;
+
+enum class settings_field {
+    BAT_MONITOR_MODE,
+    BAT_VOLTAGE_LIMIT,
+    BAT_PERCENTAGE_LIMIT,
+    NET_DEVICES,
+    NET_ACTIVITY_LIMIT,
+    INPUT_DEVICES,
+    INPUT_PROPERTIES,
+    INPUT_COALESCING,
+    INACT_ON_BAT_LIMIT,
+    INACT_ON_CHARGER_LIMIT,
+    NAME_BATTERY,
+    NAME_CHARGER,
+    CMD_SLEEP,
+    CMD_SHUTDOWN,
+    ENABLED_SLEEP,
+    USE_LOGIND,
+    STATS_TARGET,
+    NET_SAMPLE_MIN_INTERVAL,
+    NET_SAMPLE_MAX_INTERVAL,
+    NET_ACTIVITY_WINDOW,
+    NET_ACTIVITY_PERCENTILE,
+    BAT_SHUTDOWN_LEAD,
+};
+
+// One bit per settings_field
+using settings_changes_t = uint32_t;
+
+inline constexpr settings_changes_t settings_change(settings_field field) {
+    return settings_changes_t(1) << static_cast<int>(field);
+}
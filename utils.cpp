@@ -1,37 +1,32 @@
 #include "utils.hpp"
-#include <iostream>
-#include <fstream>
-
-template<typename t>
-t get_value_from_file(const std::string &filename, t failed_value) {
-    std::ifstream f(filename);
-    if (!f.good()) {
-        return failed_value;
-    }
-    t value = failed_value;
-    f >> value;
-
-    return value;
-}
 
+#include "clock.hpp"
+#include "sysfs_attribute.hpp"
+
+namespace {
+std::string fs_root;
+}
 
 timestamp_t get_timestamp() {
-    using std::chrono::duration_cast;
-    using std::chrono::seconds;
-    using std::chrono::steady_clock;
-    const auto now = std::chrono::steady_clock::now();
-    const auto duration = duration_cast<seconds>(now.time_since_epoch());
+    return get_clock().nowUsec() / 1000000;
+}
+
+void set_filesystem_root(const std::string &root) {
+    fs_root = root;
+}
 
-    timestamp_t time = duration.count();
+const std::string &filesystem_root() {
+    return fs_root;
+}
 
-    return time;
+std::string root_path(const std::string &path) {
+    return fs_root + path;
 }
 
-bool get_charger_online(const settings_t &settings) {
-    std::string charger_file = "/sys/class/power_supply/";
-    charger_file += settings.charger_name;
-    charger_file += "/online";
-    int online = get_value_from_file(charger_file, -1);
+std::string charger_online_path(const settings_t &settings) {
+    return root_path("/sys/class/power_supply/" + settings.charger_name + "/online");
+}
 
-    return online == 1;
+bool get_charger_online(const settings_t &settings) {
+    return read_sysfs_int(charger_online_path(settings), -1) == 1;
 }
@@ -1,7 +1,18 @@
 #pragma once
 #include "types.hpp"
 
+// Seconds of the installed clock, see clock.hpp.
 timestamp_t get_timestamp();
 
-bool get_charger_online(const settings_t &settings);
+// Prefix of the sysfs and device paths the monitors use, empty on a real
+// system. Tests point it at a tmpfs tree, udev and netlink then describe
+// the wrong system and the monitors scan the tree instead. Set before the
+// monitors start.
+void set_filesystem_root(const std::string &root);
+const std::string &filesystem_root();
+// path below the filesystem root.
+std::string root_path(const std::string &path);
+
+std::string charger_online_path(const settings_t &settings);
 
+bool get_charger_online(const settings_t &settings);